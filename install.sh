@@ -12,7 +12,7 @@ done
 sudo rm -rf /usr/src/mk_arcade_joystick_rpi-*
 sudo mkdir /usr/src/mk_arcade_joystick_rpi-$CURR_VER
 sudo cp -a * /usr/src/mk_arcade_joystick_rpi-$CURR_VER/
-sudo apt-get install -y --force-yes dkms cpp-4.7 gcc-4.7 joystick raspberrypi-kernel raspberrypi-kernel-headers wiringpi
+sudo apt-get install -y --force-yes dkms cpp-4.7 gcc-4.7 joystick raspberrypi-kernel raspberrypi-kernel-headers wiringpi libgpiod-dev
 echo If your kernel was just updated, you may need to reboot and rerun this script
 sudo dkms build -m mk_arcade_joystick_rpi -v $CURR_VER
 sudo dkms install -m mk_arcade_joystick_rpi -v $CURR_VER --force
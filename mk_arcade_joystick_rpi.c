@@ -35,12 +35,45 @@
 #include <linux/slab.h>
 
 #include <linux/i2c.h>
+#include <linux/spi/spi.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/consumer.h>
+#include <linux/iio/machine.h>
+#include <linux/iio/driver.h>
 
 #include <linux/ioport.h>
 #include <asm/io.h>
 
 #include <linux/jiffies.h>
 
+#include <linux/interrupt.h>
+#include <linux/gpio.h>
+#include <linux/gpio/consumer.h>
+#include <linux/gpio/machine.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include <linux/platform_device.h>
+#include <linux/pm_runtime.h>
+#include <linux/ktime.h>
+
+#include <linux/miscdevice.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/log2.h>
+#include <linux/uaccess.h>
+#include <linux/rcupdate.h>
+#include <linux/hrtimer.h>
+#include <linux/firmware.h>
+#include <linux/jump_label.h>
+
+#define mk_i2c_read_word(client,reg) i2c_smbus_read_word_swapped(client,reg) //core i2c access
+#define mk_i2c_write_word(client,reg,value) i2c_smbus_write_word_swapped(client,reg,value)
+#define mk_i2c_read_byte(client,command) i2c_smbus_read_byte_data(client,command)
+#define mk_udelay(usec) udelay(usec)
+#include "mk_arcade_joystick_rpi_core.h"
+
 
 MODULE_AUTHOR("Matthieu Proucelle (edited for Freeplaytech by Ed Mandy)");
 MODULE_DESCRIPTION("Freeplay GPIO Arcade Joystick Driver");
@@ -49,7 +82,6 @@ MODULE_LICENSE("GPL");
 
 // MK
 #define MK_MAX_DEVICES  2
-#define MK_MAX_BUTTONS  21 //13
 static const char *mk_names[] = {NULL, "GPIO Controller 1", "GPIO Controller 2", "MCP23017 Controller", "GPIO Controller 1" , "GPIO Controller 1", "GPIO Controller 2"};
 
 enum mk_type {
@@ -68,6 +100,16 @@ struct mk_pad {
     char phys[32];
     int hotkey_mode;
     int gpio_maps[MK_MAX_BUTTONS];
+    unsigned long pressed; //last read button state, bit per button
+    unsigned char data_prev[MK_MAX_BUTTONS]; //button state of previous tick, adaptive polling
+    struct gpio_descs *gpiods; //gpiolib backend: button lines
+    int gpiod_map[MK_MAX_BUTTONS]; //gpiolib backend: line index to button index
+    uint32_t level[2]; //raw GPLEV0/GPLEV1 of last read (pressed bitmap with gpiolib), capture
+    int16_t adc_raw[4]; //raw adc x1,y1,x2,y2 of last read, capture
+    struct mk_inject *inject; //injection backend: samples written by userspace
+    struct mk_turbo *turbo; //autofire of held turbo buttons
+    struct mk_combo_state combo; //hotkey actions lookup
+    unsigned int combo_code; //action key reported down, 0 if none
 };
 
 struct mk {
@@ -141,6 +183,28 @@ module_param_array_named(gpio2, gpio_cfg2.mk_arcade_gpio_maps_custom, int, &(gpi
 MODULE_PARM_DESC(gpio2, "Numbers of custom GPIO for Arcade Joystick 2");
 
 static volatile unsigned *gpio;
+
+// GPIO backend
+struct gpio_backend_config {
+    int backend[1];   //GPIO_BACKEND_*
+    unsigned int nargs;
+};
+
+static struct gpio_backend_config gpio_backend_cfg __initdata;
+module_param_array_named(gpiobackend, gpio_backend_cfg.backend, int, &(gpio_backend_cfg.nargs), 0);
+MODULE_PARM_DESC(gpiobackend, "GPIO access: 0=BCM registers (default), 1=gpiolib (any Pi revision, gpio-sim), 2=injection (no hardware, samples from /dev/mk_arcade_injectN)");
+static char gpiochip_label[32] = "";
+module_param_string(gpiochip, gpiochip_label, sizeof(gpiochip_label), 0);
+MODULE_PARM_DESC(gpiochip, "gpiolib backend: label of the GPIO chip, default to the Raspberry Pi one");
+#define GPIO_BACKEND_RAW        0
+#define GPIO_BACKEND_GPIOLIB    1
+#define GPIO_BACKEND_INJECT     2 //buttons and analog from userspace samples, no GPIO/I2C access
+int gpio_backend=GPIO_BACKEND_RAW; //GPIO_BACKEND_*
+static const char *gpiochip_labels[] = {"pinctrl-bcm2835", "pinctrl-bcm2711", "pinctrl-rp1"}; //tried in order if gpiochip not set
+#define GPIOD_MAX_OUTPUTS 3
+int gpiod_out_pin[GPIOD_MAX_OUTPUTS]; //gpiolib backend: force feedback pins
+struct gpio_descs *gpiod_out_descs[GPIOD_MAX_OUTPUTS]; //gpiolib backend: force feedback lines
+int gpiod_out_count=0; //gpiolib backend: force feedback lines count
 unsigned char data[MK_MAX_BUTTONS];     //so we always keep the state of data
 
 // Map of the gpios :                     up, down, left, right, start, select, a,  b,  tr, y,  x,  tl, hk, l2, r2, c,  z
@@ -151,6 +215,20 @@ static const int mk_arcade_gpio_maps_bplus[] = {11, 5,    6,    13,    19,    26
 // Map joystick on the b+ GPIOS with TFT      up, down, left, right, start, select, a,  b,  tr, y,  x,  tl, hk, l2, r2, c,  z
 static const int mk_arcade_gpio_maps_tft[] = {21, 13,    26,    19,    5,    6,     22, 4, 20, 17, 27,  16, 12, -1, -1, -1, -1};
 static const short mk_arcade_gpio_btn[] = {BTN_START, BTN_SELECT, BTN_A, BTN_B, BTN_TR, BTN_Y, BTN_X, BTN_TL, BTN_MODE /*this one can be special*/, BTN_TL2, BTN_TR2, BTN_C, BTN_Z, BTN_TOP, BTN_TOP2, BTN_BASE, BTN_BASE2};
+static const char *mk_arcade_dpad_names[] = {"UP", "DOWN", "LEFT", "RIGHT"}; //sysfs
+static const char *mk_arcade_gpio_btn_names[] = {"BTN_START", "BTN_SELECT", "BTN_A", "BTN_B", "BTN_TR", "BTN_Y", "BTN_X", "BTN_TL", "BTN_MODE", "BTN_TL2", "BTN_TR2", "BTN_C", "BTN_Z", "BTN_TOP", "BTN_TOP2", "BTN_BASE", "BTN_BASE2"}; //sysfs
+
+
+// Turbo, autofire cadence from an hrtimer, independent of the polling period
+struct mk_turbo { //one per pad
+    struct hrtimer timer;
+    struct input_dev *dev;
+    unsigned long held; //turbo buttons held, firing
+    unsigned long level; //reported state of firing buttons
+    ktime_t next[MK_MAX_BUTTONS]; //next edge of firing buttons
+};
+struct mk_turbo mk_turbos[MK_MAX_DEVICES];
+static DEFINE_SPINLOCK(mk_turbo_lock); //turbo state, turbo and combo config, active profile, key reports of polling and timer
 
 
 // Hotkey
@@ -161,12 +239,18 @@ struct hkmode_config {
 static struct hkmode_config hkmode_cfg __initdata;
 module_param_array_named(hkmode, hkmode_cfg.mode, int, &(hkmode_cfg.nargs), 0);
 MODULE_PARM_DESC(hkmode, "Hotkey Button Mode: 1=NORMAL, 2=TOGGLE");
-unsigned char hk_state_prev = 0xFF;
-unsigned char hk_pre_mode = 0;
-int hotkey_combo_btn = -1;
-#define HOTKEY_MODE_UNDEFINED   0
-#define HOTKEY_MODE_NORMAL      1
-#define HOTKEY_MODE_TOGGLE      2
+struct mk_hotkey hk_state = {0xFF, 0, -1, 0, 0, -1, 0, -1}; //toggle hotkey state machine
+
+struct combo_config {
+    int params[MK_MAX_COMBOS*3]; //button, key code, hold msec
+    unsigned int nargs;
+};
+static struct combo_config combo_cfg __initdata;
+module_param_array_named(combo, combo_cfg.params, int, &(combo_cfg.nargs), 0);
+MODULE_PARM_DESC(combo, "Hotkey actions on the \"GPIO Controller Hotkeys\" device: <button, index in gpio order>,<key code>,<hold msec, 0=hotkey combo>[,...]");
+static const unsigned short mk_combo_keys[] = {KEY_ESC, KEY_MUTE, KEY_VOLUMEDOWN, KEY_VOLUMEUP, KEY_POWER, KEY_PAUSE, KEY_SLEEP, KEY_BRIGHTNESSDOWN, KEY_BRIGHTNESSUP,
+    KEY_F1, KEY_F2, KEY_F3, KEY_F4, KEY_F5, KEY_F6, KEY_F7, KEY_F8, KEY_F9, KEY_F10, KEY_F11, KEY_F12}; //always available to sysfs, F keys for emulator save states
+struct input_dev *mk_combo_dev=NULL; //hotkeys input device, NULL if no combo parameter
 
 
 // I2C Bus
@@ -189,26 +273,22 @@ struct analog_config {
 
 static struct analog_config analog_x1_cfg __initdata;
 module_param_array_named(x1addr, analog_x1_cfg.address, int, &(analog_x1_cfg.nargs), 0);
-MODULE_PARM_DESC(x1addr, "I2C address of X1 ADC MCP3021A chip");
-struct i2c_client* i2c_client_x1 = NULL;
+MODULE_PARM_DESC(x1addr, "I2C address of X1 ADC MCP3021A chip, or X1 channel of ADS1015/ADS1115/ADS7830/SPI ADC");
 bool x1_enable = false; //nns: x1 enabled?
 
 static struct analog_config analog_y1_cfg __initdata;
 module_param_array_named(y1addr, analog_y1_cfg.address, int, &(analog_y1_cfg.nargs), 0);
-MODULE_PARM_DESC(y1addr, "I2C address of Y1 ADC MCP3021A chip");
-struct i2c_client* i2c_client_y1 = NULL;
+MODULE_PARM_DESC(y1addr, "I2C address of Y1 ADC MCP3021A chip, or Y1 channel of ADS1015/ADS1115/ADS7830/SPI ADC");
 bool y1_enable = false; //nns: y1 enabled?
 
 static struct analog_config analog_x2_cfg __initdata;
 module_param_array_named(x2addr, analog_x2_cfg.address, int, &(analog_x2_cfg.nargs), 0);
-MODULE_PARM_DESC(x2addr, "I2C address of X2 ADC MCP3021A chip");
-struct i2c_client* i2c_client_x2 = NULL;
+MODULE_PARM_DESC(x2addr, "I2C address of X2 ADC MCP3021A chip, or X2 channel of ADS1015/ADS1115/ADS7830/SPI ADC");
 bool x2_enable = false; //nns: x2 enabled?
 
 static struct analog_config analog_y2_cfg __initdata;
 module_param_array_named(y2addr, analog_y2_cfg.address, int, &(analog_y2_cfg.nargs), 0);
-MODULE_PARM_DESC(y2addr, "I2C address of Y2 ADC MCP3021A chip");
-struct i2c_client* i2c_client_y2 = NULL;
+MODULE_PARM_DESC(y2addr, "I2C address of Y2 ADC MCP3021A chip, or Y2 channel of ADS1015/ADS1115/ADS7830/SPI ADC");
 bool y2_enable = false; //nns: y2 enabled?
 
 
@@ -218,12 +298,186 @@ struct ads1015_config { //nns: add ads1015 support
     unsigned int nargs;
 };
 
+#if IS_ENABLED(CONFIG_MK_ADC_ADS1X15)
 static struct ads1015_config ads1015_cfg __initdata;
 module_param_array_named(ads1015addr, ads1015_cfg.address, int, &(ads1015_cfg.nargs), 0);
 MODULE_PARM_DESC(ads1015addr, "I2C address of ADC ADS1015 chip");
-bool ads1015_enable = false; //nns: ads1015 enabled?
-int ads1015_lookup[] = {-1,-1,-1,-1}; //ads1015 ain x1,y1,x2,y2 lookup table
-uint16_t ads1015_ain[] = {0x4000,0x5000,0x6000,0x7000}; //ain0,ain1,ain2,ain3 value for bitwise operation
+
+// I2C ADS1115, ADS7830
+static struct ads1015_config ads1115_cfg __initdata;
+module_param_array_named(ads1115addr, ads1115_cfg.address, int, &(ads1115_cfg.nargs), 0);
+MODULE_PARM_DESC(ads1115addr, "I2C address of ADC ADS1115 chip (16bits)");
+#endif
+
+#if IS_ENABLED(CONFIG_MK_ADC_ADS7830)
+static struct ads1015_config ads7830_cfg __initdata;
+module_param_array_named(ads7830addr, ads7830_cfg.address, int, &(ads7830_cfg.nargs), 0);
+MODULE_PARM_DESC(ads7830addr, "I2C address of ADC ADS7830 chip (8bits, 8 channels)");
+#endif
+
+#if IS_ENABLED(CONFIG_MK_ADC_ADS1X15)
+// ADS1015/ADS1115 per axis full scale and data rate
+struct ads_axis_config {
+    int params[3];   //full scale mV, rate SPS, stick supply mV
+    unsigned int nargs;
+};
+
+static struct ads_axis_config ads_x1_cfg __initdata;
+module_param_array_named(x1ads, ads_x1_cfg.params, int, &(ads_x1_cfg.nargs), 0);
+MODULE_PARM_DESC(x1ads, "ADS1015/ADS1115 X1 channel: <full scale mV: 6144,4096,2048,1024,512,256>[,<rate SPS>[,<stick supply mV, 0 keeps chip scale>]]");
+
+static struct ads_axis_config ads_y1_cfg __initdata;
+module_param_array_named(y1ads, ads_y1_cfg.params, int, &(ads_y1_cfg.nargs), 0);
+MODULE_PARM_DESC(y1ads, "ADS1015/ADS1115 Y1 channel: <full scale mV>[,<rate SPS>[,<stick supply mV>]]");
+
+static struct ads_axis_config ads_x2_cfg __initdata;
+module_param_array_named(x2ads, ads_x2_cfg.params, int, &(ads_x2_cfg.nargs), 0);
+MODULE_PARM_DESC(x2ads, "ADS1015/ADS1115 X2 channel: <full scale mV>[,<rate SPS>[,<stick supply mV>]]");
+
+static struct ads_axis_config ads_y2_cfg __initdata;
+module_param_array_named(y2ads, ads_y2_cfg.params, int, &(ads_y2_cfg.nargs), 0);
+MODULE_PARM_DESC(y2ads, "ADS1015/ADS1115 Y2 channel: <full scale mV>[,<rate SPS>[,<stick supply mV>]]");
+#endif
+
+// Analog pre-filter
+struct filter_axis_config {
+    int params[2];   //median window, oversampling
+    unsigned int nargs;
+};
+
+static struct filter_axis_config filter_x1_cfg __initdata;
+module_param_array_named(x1filter, filter_x1_cfg.params, int, &(filter_x1_cfg.nargs), 0);
+MODULE_PARM_DESC(x1filter, "X1 raw value pre-filter: <median window: 1 (off), 3, 5>[,<conversions averaged per poll, up to 16>]");
+
+static struct filter_axis_config filter_y1_cfg __initdata;
+module_param_array_named(y1filter, filter_y1_cfg.params, int, &(filter_y1_cfg.nargs), 0);
+MODULE_PARM_DESC(y1filter, "Y1 raw value pre-filter: <median window>[,<oversampling>]");
+
+static struct filter_axis_config filter_x2_cfg __initdata;
+module_param_array_named(x2filter, filter_x2_cfg.params, int, &(filter_x2_cfg.nargs), 0);
+MODULE_PARM_DESC(x2filter, "X2 raw value pre-filter: <median window>[,<oversampling>]");
+
+static struct filter_axis_config filter_y2_cfg __initdata;
+module_param_array_named(y2filter, filter_y2_cfg.params, int, &(filter_y2_cfg.nargs), 0);
+MODULE_PARM_DESC(y2filter, "Y2 raw value pre-filter: <median window>[,<oversampling>]");
+
+// Adaptive smoothing
+struct smooth_axis_config {
+    int params[3];   //min cutoff, beta, speed cutoff
+    unsigned int nargs;
+};
+
+static struct smooth_axis_config smooth_x1_cfg __initdata;
+module_param_array_named(x1smooth, smooth_x1_cfg.params, int, &(smooth_x1_cfg.nargs), 0);
+MODULE_PARM_DESC(x1smooth, "X1 adaptive smoothing (1 euro filter): <cutoff at rest, centiHz>[,<beta, centiHz per 100 codes/s>[,<speed cutoff, centiHz>]]");
+
+static struct smooth_axis_config smooth_y1_cfg __initdata;
+module_param_array_named(y1smooth, smooth_y1_cfg.params, int, &(smooth_y1_cfg.nargs), 0);
+MODULE_PARM_DESC(y1smooth, "Y1 adaptive smoothing: <cutoff at rest>[,<beta>[,<speed cutoff>]]");
+
+static struct smooth_axis_config smooth_x2_cfg __initdata;
+module_param_array_named(x2smooth, smooth_x2_cfg.params, int, &(smooth_x2_cfg.nargs), 0);
+MODULE_PARM_DESC(x2smooth, "X2 adaptive smoothing: <cutoff at rest>[,<beta>[,<speed cutoff>]]");
+
+static struct smooth_axis_config smooth_y2_cfg __initdata;
+module_param_array_named(y2smooth, smooth_y2_cfg.params, int, &(smooth_y2_cfg.nargs), 0);
+MODULE_PARM_DESC(y2smooth, "Y2 adaptive smoothing: <cutoff at rest>[,<beta>[,<speed cutoff>]]");
+
+#define SMOOTH_DEFAULT_BETA 20 //9Hz cutoff at 4000 codes/s
+#define SMOOTH_DEFAULT_DCUTOFF 100 //1Hz
+struct mk_smooth adc_smooth[MK_ADC_MAX_AXES]; //1 euro filter state of x1,y1,x2,y2
+
+struct mk_adc_filter adc_filters[MK_ADC_MAX_AXES]; //median ring of x1,y1,x2,y2
+int adc_oversample[MK_ADC_MAX_AXES]; //conversions averaged per poll
+bool adc_filter_enable=false; //any axis filtered or smoothed
+unsigned int adc_wait_us=0; //conversion wait of the last poll, oversampling included
+
+#if IS_ENABLED(CONFIG_MK_ADC_ADS1X15)
+#define ADS_DEFAULT_SUPPLY 3300 //stick supply in mV, its full travel is scaled to 12bits
+struct mk_ads1x15_priv ads1x15_priv; //per channel config register, wait and scale
+
+// ADS1015/ADS1115 comparator rest
+struct ads_rest_config {
+    int params[3];   //ALERT gpio, rest msec, window
+    unsigned int nargs;
+};
+
+static struct ads_rest_config ads_rest_cfg __initdata;
+module_param_array_named(adsrest, ads_rest_cfg.params, int, &(ads_rest_cfg.nargs), 0);
+MODULE_PARM_DESC(adsrest, "ADS1015/ADS1115 reads stop while sticks rest, comparator ALERT resumes them: <ALERT gpio>[,<rest msec>[,<window, 12bits units>]]");
+#define ADS_REST_DEFAULT_TIME 1000 //msec centered before rest
+#define ADS_REST_DEFAULT_WINDOW 64 //around rest codes, 12bits axis units
+struct mk_adc *ads_rest_adc=NULL; //chip with comparator rest, NULL if disabled
+unsigned int ads_rest_axes=0; //axes on that chip
+unsigned int ads_rest_channels=0; //their channels
+unsigned long ads_rest_timeout=0; //jiffies centered before rest
+int ads_rest_window=ADS_REST_DEFAULT_WINDOW;
+unsigned long ads_rest_since=0; //last time an axis of the chip moved
+int16_t ads_rest_values[MK_ADC_MAX_AXES]; //values kept while resting
+int ads_rest_irq=-1; //ALERT interrupt
+struct gpio_descs *ads_rest_descs=NULL; //ALERT line requested for its irq
+bool ads_alert=false; //ALERT seen, set by interrupt
+unsigned int ads_rest_count=0, ads_rest_wakes=0; //statistics
+u64 ads_rest_skipped=0; //polls without conversion
+#endif
+
+
+// ADC chips
+struct mk_adc mk_adcs[MK_ADC_MAX_AXES]; //one chip per axis at most
+int mk_adc_count=0;
+struct mk_adc_axis mk_adc_axes[MK_ADC_MAX_AXES]; //chip and channel of x1,y1,x2,y2
+
+
+#if IS_ENABLED(CONFIG_MK_ADC_SPI)
+// SPI ADC
+struct spiadc_config {
+    int params[4];   //bus, chip select, chip type, clock
+    unsigned int nargs;
+};
+
+static struct spiadc_config spiadc_cfg __initdata;
+module_param_array_named(spiadc, spiadc_cfg.params, int, &(spiadc_cfg.nargs), 0);
+MODULE_PARM_DESC(spiadc, "SPI ADC used instead of I2C ones: <bus>,<chip select>,<3008|3208>[,<clock Hz>], x1addr..y2addr are the channels");
+#define SPIADC_DEFAULT_SPEED 1000000 //1MHz, safe for both chips at 3.3v
+char spiadc_name[16]; //spiB.C, the only device bound
+struct spi_device *spiadc_dev=NULL; //bound by mk_spiadc_driver, NULL until probed
+bool spiadc_registered=false; //mk_spiadc_driver registered
+bool spiadc_enable=false; //spi adc enabled?
+int spiadc_type=0; //MK_SPIADC_*
+u32 spiadc_speed=SPIADC_DEFAULT_SPEED; //transfer clock
+u8 *spiadc_tx=NULL, *spiadc_rx=NULL; //frames per axis, dma safe
+#else
+#define spiadc_enable false
+#endif
+
+
+#if IS_ENABLED(CONFIG_MK_ADC_IIO)
+// IIO ADC
+struct iioadc_config {
+    int params[2];   //iio device number, sampling frequency
+    unsigned int nargs;
+};
+
+static struct iioadc_config iioadc_cfg __initdata;
+module_param_array_named(iioadc, iioadc_cfg.params, int, &(iioadc_cfg.nargs), 0);
+MODULE_PARM_DESC(iioadc, "IIO ADC used instead of I2C ones: <N of iio:deviceN>[,<sampling Hz>], x1addr..y2addr are the channels, buffered if the device has a trigger");
+#define IIOADC_MAX_CHANNELS 8
+#define IIOADC_TIMESTAMP IIOADC_MAX_CHANNELS //channel data of the mapped timestamp
+struct iio_dev *iioadc_dev=NULL; //iio:deviceN, reference held
+struct iio_map iioadc_maps[MK_ADC_MAX_AXES+2]; //channels mapped to this driver and timestamp, null terminated
+struct iio_channel *iioadc_chans=NULL; //mapped channels, data is the channel number or IIOADC_TIMESTAMP
+struct iio_channel *iioadc_lookup[IIOADC_MAX_CHANNELS]; //channel number to mapped channel
+int iioadc_offset[IIOADC_MAX_CHANNELS]; //byte offset in a buffered scan
+int iioadc_ts_offset=-1; //byte offset of the timestamp in a buffered scan, -1 if not in it
+struct iio_cb_buffer *iioadc_buffer=NULL; //triggered capture, callback buffer
+bool iioadc_enable=false; //iio adc enabled?
+bool iioadc_buffered=false; //samples pushed by the trigger instead of read on demand
+int16_t iioadc_values[IIOADC_MAX_CHANNELS]; //last buffered sample per channel, 12bits
+u64 iioadc_scans=0; //buffered scans received
+u64 iioadc_scan_ns=0; //time of the last scan, iio device clock
+#else
+#define iioadc_enable false
+#endif
 
 
 // Analog Auto Center
@@ -269,6 +523,7 @@ MODULE_PARM_DESC(y2dir, "Y2 analog direction");
 bool y2_reverse = false; //nns: y2 reverse direction
 
 
+#if IS_ENABLED(CONFIG_MK_FF_GPIO)
 // GPIO based Force Feedback
 struct ff_config { //nns: gpio force feedback support
     int pins[2];   //gpio pin to use
@@ -283,8 +538,6 @@ int ff_gpio_strong_pin=-1; //rumble strong pin
 int ff_gpio_weak_pin=-1; //rumble weak pin
 bool ff_effect_strong_reverse=false; //rumble strong reverse logic
 bool ff_effect_weak_reverse=false; //rumble weak reverse logic
-bool ff_effect_strong_running=false; //rumble strong running
-bool ff_effect_weak_running=false; //rumble weak running
 
 
 // GPIO based Force Feedback Direction
@@ -300,8 +553,12 @@ bool ff_dir_enable=false; //force feedback direction enable
 int ff_gpio_dir_pin=-1; //rumble direction pin
 bool ff_gpio_dir_reverse=false; //rumble direction reverse logic
 unsigned int ff_effect_dir=0; //rumble direction
+#else
+#define ff_enable false
+#endif
 
 
+#if IS_ENABLED(CONFIG_MK_FF_PWM)
 // I2C PCA9633 based PWM Force Feedback
 struct ffpwm_config { //nns: pwm force feedback support
     int params[3];   //gpio pin to use
@@ -323,9 +580,17 @@ bool ff_strong_pwm_sent=true; //rumble strong pwm already sent via i2c
 bool ff_weak_pwm_sent=true; //rumble weak pwm already sent via i2c
 int ff_strong_pwm_value=0; //rumble strong PCA9633 pwm value
 int ff_weak_pwm_value=0; //rumble weak PCA9633 pwm value
+#else
+#define ff_pwm_enable false
+#endif
+
+#if IS_ENABLED(CONFIG_MK_FF_GPIO) || IS_ENABLED(CONFIG_MK_FF_PWM)
+struct mk_ff_state ff_state; //rumble motors running
+#endif
 
 
 
+#if IS_ENABLED(CONFIG_MK_DEBUG)
 // Debug
 struct debug_config { //nns: add debug
     int debug[1];
@@ -336,12 +601,128 @@ static struct debug_config debug_config_cfg __initdata;
 module_param_array_named(debug, debug_config_cfg.debug, int, &(debug_config_cfg.nargs), 0);
 MODULE_PARM_DESC(debug, "Debug level, 0:disable, 1:event, 2:loop");
 unsigned int debug_mode=0; //debug level, 0:disable, 1:event, 2:loop
-unsigned int benchmark_maxloop=200; //loop count before report, may be removed in the future
-unsigned int benchmark_loop=0; //loop count, may be removed in the future
-unsigned int benchmark_time=0; //duration, may be removed in the future
-unsigned int benchmark_tmp=0; //tmp, may be removed in the future
-unsigned long benchmark_time_start=0; //loop start time, may be removed in the future
-unsigned long jiffies_last=0; //backup to check jiffies rollover, may be removed in the future
+unsigned int benchmark_maxloop=200; //loop count before report
+unsigned int benchmark_loop=0; //loop count
+u64 benchmark_time=0; //longest loop, nsec
+u64 benchmark_total=0; //loops duration, nsec
+u64 benchmark_time_start=0; //loop start time
+#else
+#define debug_mode 0
+#endif
+struct dentry *mk_debugfs_dir=NULL; //debugfs directory, statistics
+
+
+// Capture
+struct capture_config {
+    int size[1];   //samples per pad
+    unsigned int nargs;
+};
+
+static struct capture_config capture_cfg __initdata;
+module_param_array_named(capture, capture_cfg.size, int, &(capture_cfg.nargs), 0);
+MODULE_PARM_DESC(capture, "Raw sample capture buffer per pad, in samples (0=disabled), read from /dev/mk_arcade_captureN");
+#define MK_CAPTURE_MAX_SIZE (1<<20) //24MB per pad
+#define MK_CAPTURE_OPEN 0 //flags bit: reader attached
+
+struct mk_capture { //single producer (work handler), single consumer (reader) ring
+    struct miscdevice misc;
+    char name[24];
+    int pad; //pad index
+    struct mk_capture_sample *ring; //samples
+    unsigned int size; //ring size, power of 2
+    unsigned int head; //next sample written, work handler only
+    unsigned int tail; //next sample read, reader only
+    unsigned long flags; //MK_CAPTURE_OPEN
+    bool header_pending; //header not yet read since open
+    u64 samples; //samples captured
+    u64 overruns; //samples dropped, reader too slow
+    wait_queue_head_t wait;
+};
+struct mk_capture mk_captures[MK_MAX_DEVICES];
+bool capture_enable=false; //capture devices registered
+
+
+// Injection
+#define MK_INJECT_SIZE 64 //samples queued per pad, power of 2
+#define MK_INJECT_OPEN 0 //flags bit: writer attached
+
+struct mk_inject { //single producer (writer), single consumer (work handler) ring, one sample used per poll
+    struct miscdevice misc;
+    char name[24];
+    int pad; //pad index
+    struct mk_capture_sample ring[MK_INJECT_SIZE]; //samples
+    unsigned int head; //next sample written, writer only
+    unsigned int tail; //next sample used, work handler only
+    struct mk_capture_sample last; //sample of the current poll, held while the ring is empty
+    uint32_t stream_flags; //MK_CAPTURE_FLAG_* from the stream header
+    unsigned long flags; //MK_INJECT_OPEN
+    bool header_checked; //stream start parsed since open
+    u8 partial[sizeof(struct mk_capture_sample)]; //incomplete header or sample from last write
+    unsigned int partial_len;
+    u64 samples; //samples used
+    u64 underruns; //polls without a new sample
+    wait_queue_head_t wait;
+};
+struct mk_inject mk_injects[MK_MAX_DEVICES];
+bool inject_enable=false; //injection devices registered
+
+
+// Adaptive polling
+struct idle_config {
+    int params[2];   //idle timeout in msec, idle polling rate in Hz
+    unsigned int nargs;
+};
+
+static struct idle_config idle_cfg __initdata;
+module_param_array_named(idle, idle_cfg.params, int, &(idle_cfg.nargs), 0);
+MODULE_PARM_DESC(idle, "Adaptive polling parameters (idle timeout in msec, idle polling rate in Hz), no button change and sticks in deadzone for timeout drops polling to idle rate");
+#define IDLE_DEFAULT_RATE 10
+bool idle_enable=false; //adaptive polling enable
+unsigned long idle_timeout=0; //jiffies without activity before switching to idle rate
+unsigned long idle_refresh_time=MK_REFRESH_TIME; //delay between polls in idle mode
+unsigned long poll_refresh_time=MK_REFRESH_TIME; //current delay between polls
+bool poll_running=false; //polling work scheduled (input device opened)
+static DEFINE_SPINLOCK(mk_poll_lock); //poll_running cleared against the wake irqs queueing a poll
+bool poll_idle=false; //polling at idle rate
+bool poll_activity=false; //button changed or stick out of deadzone during last poll, or wake interrupt
+unsigned long poll_last_activity=0; //jiffies of last activity
+unsigned long poll_mode_start=0; //jiffies when current mode started
+u64 poll_time_full=0; //jiffies spent polling at full rate
+u64 poll_time_idle=0; //jiffies spent polling at idle rate
+unsigned int poll_mode_switches=0; //full/idle transitions count
+
+struct wake_config {
+    int pins[MK_MAX_BUTTONS];   //gpio pins used as wake interrupt
+    unsigned int nargs;
+};
+
+static struct wake_config idle_wake_cfg __initdata;
+module_param_array_named(idlewake, idle_wake_cfg.pins, int, &(idle_wake_cfg.nargs), 0);
+MODULE_PARM_DESC(idlewake, "GPIO pins whose edge interrupt immediately restores full polling rate");
+
+
+// Power management
+static struct wake_config wake_cfg __initdata;
+module_param_array_named(wake, wake_cfg.pins, int, &(wake_cfg.nargs), 0);
+MODULE_PARM_DESC(wake, "GPIO pins allowed to wake the system from suspend, default to hotkey and start pins");
+
+#define MK_WAKE_MAX (MK_MAX_BUTTONS*2)
+#define MK_AUTOSUSPEND_DELAY 2000 //msec before runtime suspend once last input client closed
+int wake_irq[MK_WAKE_MAX]; //irq numbers of wake pins
+int wake_pin[MK_WAKE_MAX]; //BCM pin of each wake irq
+struct gpio_descs *wake_descs[MK_WAKE_MAX]; //line requested only to get the irq, NULL if a button line was used
+bool wake_irq_system[MK_WAKE_MAX]; //irq is a system wake source
+int wake_irq_count=0; //wake irq count
+struct platform_device *mk_pdev=NULL; //platform device, parent of input devices, hold pm callbacks
+bool pm_hw_suspended=false; //outputs and chips powered down
+#if IS_ENABLED(CONFIG_MK_FF_PWM)
+int pca9633_mode1=-1; //PCA9633 MODE1 register backup while suspended
+#endif
+bool pm_resume_pending=false; //waiting for first event since last resume
+ktime_t pm_resume_time; //last system resume timestamp
+s64 pm_resume_latency_us=-1; //last resume to first event latency
+unsigned int pm_suspend_count=0; //system suspend count
+unsigned int pm_runtime_suspend_count=0; //runtime suspend count
 
 
 
@@ -384,7 +765,68 @@ MODULE_PARM_DESC(y2params, "Y2 ADC absolute parameters (min,max,fuzz,flat)");
 uint16_t y2_max = 0;
 uint16_t y2_min = 0xFFFF;
 
-struct analog_abs_params_struct {int min, max, fuzz, flat;} x1_analog_abs_params, x2_analog_abs_params, y1_analog_abs_params, y2_analog_abs_params;
+struct analog_abs_params_struct x1_analog_abs_params, x2_analog_abs_params, y1_analog_abs_params, y2_analog_abs_params;
+
+// Hot path, what a poll does is decided once at init: static keys patch the branches, enabled axes are a table
+static DEFINE_STATIC_KEY_FALSE(mk_analog_key); //at least one axis
+static DEFINE_STATIC_KEY_FALSE(mk_inject_key); //injection backend
+#if IS_ENABLED(CONFIG_MK_ADC_ADS1X15)
+static DEFINE_STATIC_KEY_FALSE(mk_ads_rest_key); //comparator rest
+#endif
+#if IS_ENABLED(CONFIG_MK_FF_PWM)
+static DEFINE_STATIC_KEY_FALSE(mk_ff_pwm_key); //PCA9633 rumble
+#endif
+static DEFINE_STATIC_KEY_FALSE(mk_capture_key); //capture devices
+static DEFINE_STATIC_KEY_FALSE(mk_combo_key); //hotkeys input device
+#if IS_ENABLED(CONFIG_MK_DEBUG)
+static DEFINE_STATIC_KEY_FALSE(mk_debug_key); //debug_mode>0
+static DEFINE_STATIC_KEY_FALSE(mk_bench_key); //debug_mode>1
+#endif
+struct mk_axis_report { //enabled axis
+    int axis; //x1,y1,x2,y2
+    unsigned int code; //ABS_*
+    bool reverse;
+    uint16_t *seen_min, *seen_max; //limits seen, printed at exit
+    int shift; //axis bits over 12, mk_adc_axes
+};
+struct mk_axis_report mk_axis_reports[MK_ADC_MAX_AXES];
+int mk_axis_report_count=0;
+unsigned int mk_dpad_abs[2] = {ABS_X, ABS_Y}; //hat when the stick has the axis
+static const char *mk_axis_names[] = {"x1", "y1", "x2", "y2"}; //sysfs
+
+// Response curves, sysfs binary attributes curve_x1..curve_y2 of the platform device
+struct mk_curve {
+    uint16_t points[MK_CURVE_POINTS]; //last written control points
+    int16_t __rcu *table; //raw value to reported value, NULL while linear
+};
+bool mk_curve_enable=false; //attributes created
+
+
+// Profiles, configuration sets preloaded through sysfs, switched by a pointer swap
+struct mk_profile {
+    char name[16]; //empty while unused
+    short keys[MK_MAX_BUTTONS-4]; //key code reported by each button
+    struct analog_abs_params_struct params[MK_ADC_MAX_AXES]; //calibration and flat of x1,y1,x2,y2
+    int16_t offset[MK_ADC_MAX_AXES]; //center of x1,y1,x2,y2
+    struct mk_curve curves[MK_ADC_MAX_AXES]; //response curves of x1,y1,x2,y2
+    uint32_t turbo_period_ns[MK_MAX_BUTTONS]; //0 if the button has no turbo
+    uint32_t turbo_on_ns[MK_MAX_BUTTONS]; //pressed part of a period
+    struct mk_combo combos[MK_MAX_COMBOS]; //hotkey actions
+    int combo_count;
+};
+static struct mk_profile mk_profiles_default[MK_MAX_PROFILES]; //profiles of the module parameters and sysfs
+struct mk_profile *mk_profiles=mk_profiles_default; //all the profiles, replaced by the config blob under mk_profile_mutex and mk_turbo_lock
+struct mk_profile __rcu *mk_profile; //active profile, swapped under mk_turbo_lock, read under rcu or mk_turbo_lock
+int mk_profile_edit=0; //profile changed by curve, turbo, combos, keymap and absparams attributes
+static DEFINE_MUTEX(mk_profile_mutex); //profile writers, curves
+
+struct fwconfig_config {
+    int enable[1];
+    unsigned int nargs;
+};
+static struct fwconfig_config fwconfig_cfg __initdata;
+module_param_array_named(fwconfig, fwconfig_cfg.enable, int, &(fwconfig_cfg.nargs), 0);
+MODULE_PARM_DESC(fwconfig, "1=replace the profiles with the config blob /lib/firmware/" MK_CONFIG_FILE " once it can be read");
 
 
 
@@ -393,67 +835,288 @@ struct mk *g_mk = NULL;
 
 static struct i2c_board_info __initdata board_info[] = {{I2C_BOARD_INFO("MCP3021X1", 0x48),}};
 
-struct i2c_client *i2c_new_MCP3021(struct i2c_adapter *adapter, u16 address){
-    struct i2c_board_info info = {I2C_BOARD_INFO("MCP3021", address),};
+#if IS_ENABLED(CONFIG_MK_FF_PWM)
+struct i2c_client *i2c_new_PCA9633(struct i2c_adapter *adapter, u16 address){ //nns: add PCA9633 support
+    struct i2c_board_info info = {I2C_BOARD_INFO("PCA9633", address),};
     return i2c_new_client_device(adapter, &info);//    used to be i2c_new_device(adapter, &info), but that may be deprecated now
 }
+#endif
 
-struct i2c_client *i2c_new_ADS1015(struct i2c_adapter *adapter, u16 address){ //nns: add ADS1015 support
-    struct i2c_board_info info = {I2C_BOARD_INFO("ADS1015", address),};
-    return i2c_new_client_device(adapter, &info);//    used to be i2c_new_device(adapter, &info), but that may be deprecated now
+
+
+#if IS_ENABLED(CONFIG_MK_ADC_SPI)
+static int mk_spiadc_read_all(struct mk_adc *adc, const int *channels, int16_t *values, int count){ //spi adc: all channels in one message, chip select toggled between frames
+    struct spi_transfer xfers[MK_ADC_MAX_AXES] = {};
+    struct spi_message msg;
+    int i, err;
+    
+    spi_message_init(&msg);
+    for(i=0;i<count;i++){
+        mk_mcp3x08_frame(spiadc_type, channels[i], spiadc_tx + i*MK_SPIADC_FRAME);
+        xfers[i].tx_buf = spiadc_tx + i*MK_SPIADC_FRAME;
+        xfers[i].rx_buf = spiadc_rx + i*MK_SPIADC_FRAME;
+        xfers[i].len = MK_SPIADC_FRAME;
+        xfers[i].speed_hz = spiadc_speed;
+        xfers[i].cs_change = i < count-1; //each conversion needs its own chip select cycle, released at the end
+        spi_message_add_tail(&xfers[i], &msg);
+    }
+    err = spi_sync(adc->client, &msg);
+    for(i=0;i<count;i++){values[i] = err ? err : mk_mcp3x08_value(spiadc_type, spiadc_rx + i*MK_SPIADC_FRAME);}
+    return err;
 }
 
-struct i2c_client *i2c_new_PCA9633(struct i2c_adapter *adapter, u16 address){ //nns: add PCA9633 support
-    struct i2c_board_info info = {I2C_BOARD_INFO("PCA9633", address),};
-    return i2c_new_client_device(adapter, &info);//    used to be i2c_new_device(adapter, &info), but that may be deprecated now
+static const struct mk_adc_ops mk_adc_spi_ops = {"MCP3x08", 8, 12, 0, NULL, NULL, mk_spiadc_read_all}; //values already scaled to 12bits
+
+
+static int mk_spiadc_probe(struct spi_device *spi){ //spi adc: device declared for this driver by an overlay, or driver_override
+    if(strcmp(dev_name(&spi->dev), spiadc_name)){return -ENODEV;} //not the chip select given by spiadc=
+    spi->mode = SPI_MODE_0;
+    spi->bits_per_word = 8;
+    if(spi_setup(spi)){printk("mk_arcade_joystick_rpi: SPI ADC : %s setup failed\n", spiadc_name);}
+    spiadc_dev = spi;
+    return 0;
+}
+
+static const struct spi_device_id mk_spiadc_ids[] = {{"arcade-spiadc", 0}, {}};
+static const struct of_device_id mk_spiadc_of_ids[] = {{.compatible = "mk,arcade-spiadc"}, {}};
+
+static struct spi_driver mk_spiadc_driver = {
+    .driver = {
+        .name = "mk_arcade_spiadc",
+        .of_match_table = mk_spiadc_of_ids,
+        .suppress_bind_attrs = true, //no unbind under the poll, the device is released at exit
+    },
+    .probe = mk_spiadc_probe,
+    .id_table = mk_spiadc_ids,
+};
+
+static void mk_spiadc_exit(void){
+    if(spiadc_registered){spi_unregister_driver(&mk_spiadc_driver);}
+    spiadc_registered = false;
+    spiadc_dev = NULL;
+    kfree(spiadc_tx); kfree(spiadc_rx);
+    spiadc_tx = spiadc_rx = NULL;
+}
+#else
+static void mk_spiadc_exit(void){}
+#endif
+
+
+static struct mk_adc __init *mk_adc_new_i2c(struct i2c_adapter *adapter, const struct mk_adc_ops *ops, u16 address){ //register an i2c adc chip
+    struct i2c_board_info info = {};
+    struct i2c_client *client;
+    
+    if(mk_adc_count>=MK_ADC_MAX_AXES){return NULL;}
+    strscpy(info.type, ops->name, sizeof(info.type));
+    info.addr = address;
+    client = i2c_new_client_device(adapter, &info);//    used to be i2c_new_device(adapter, &info), but that may be deprecated now
+    if(IS_ERR_OR_NULL(client)){printk("mk_arcade_joystick_rpi: %s : Failed to assign I2C address 0x%02X\n", ops->name, address); return NULL;}
+    printk("mk_arcade_joystick_rpi: %s I2C address 0x%02X\n", ops->name, address);
+    mk_adcs[mk_adc_count] = (struct mk_adc){ops, client, NULL};
+    return &mk_adcs[mk_adc_count++];
+}
+
+
+static bool __init mk_adc_axis_init(int axis, struct mk_adc *adc, int channel, bool reverse, int16_t *offset){ //map an axis to a chip channel, first conversion gives the center
+    static const char *names[] = {"X1", "Y1", "X2", "Y2"};
+    int16_t value;
+    
+    if(!adc || channel < 0){return false;} //axis not used
+    if(channel >= adc->ops->channels){printk("mk_arcade_joystick_rpi: %s : %s has no channel %d, disabled\n", names[axis], adc->ops->name, channel); return false;}
+    mk_adc_axes[axis] = (struct mk_adc_axis){adc, channel, adc_oversample[axis], mk_adc_axis_shift(adc)}; //center oversampled too, chip resolution kept
+    mk_adc_poll(&mk_adc_axes[axis], 1, &value);
+    if(value < 0){
+        printk("mk_arcade_joystick_rpi: %s : %s channel %d failed, disabled\n", names[axis], adc->ops->name, channel);
+        if(debug_mode>0){printk("mk_arcade_joystick_rpi: returned %i\n",value);}
+        mk_adc_axes[axis].adc = NULL;
+        return false;
+    }
+    printk("mk_arcade_joystick_rpi: %s assigned to %s channel %d\n", names[axis], adc->ops->name, channel);
+    if(reverse){ //nns: reverse direction
+        printk("mk_arcade_joystick_rpi: %s direction reversed\n", names[axis]);
+        value = (4096<<mk_adc_axes[axis].shift)-value; //nns: reverse value
+    }
+    *offset = (value>>mk_adc_axes[axis].shift)-2047; //nns: center offset, 12bits like xNparams
+    printk("mk_arcade_joystick_rpi: %s initial value : %d (0x%04X)\n", names[axis], value, value);
+    return true;
+}
+
+#if IS_ENABLED(CONFIG_MK_ADC_IIO)
+#if IS_ENABLED(CONFIG_IIO)
+static int16_t mk_iioadc_sample(const void *data, const struct iio_chan_spec *spec){ //buffered scan element to 12bits
+    const struct iio_scan_type *t = &spec->scan_type;
+    u32 raw;
+    int value;
+    
+    if(t->storagebits == 32){raw = t->endianness == IIO_BE ? be32_to_cpu(*(const __be32 *)data) : t->endianness == IIO_LE ? le32_to_cpu(*(const __le32 *)data) : *(const u32 *)data;
+    }else if(t->storagebits == 16){raw = t->endianness == IIO_BE ? be16_to_cpu(*(const __be16 *)data) : t->endianness == IIO_LE ? le16_to_cpu(*(const __le16 *)data) : *(const u16 *)data;
+    }else{raw = *(const u8 *)data;}
+    raw >>= t->shift;
+    value = t->sign == 's' ? sign_extend32(raw, t->realbits - 1) : (int)(raw & GENMASK(t->realbits - 1, 0));
+    return mk_adc_to_12bits(value < 0 ? 0 : value, t->realbits); //single ended, negative is noise around 0v
+}
+
+static int mk_iioadc_push(const void *data, void *private){ //callback buffer: one scan per trigger, runs in the trigger thread
+    int i;
+    
+    for(i=0;i<IIOADC_MAX_CHANNELS;i++){
+        if(iioadc_lookup[i]){WRITE_ONCE(iioadc_values[i], mk_iioadc_sample((const u8 *)data + iioadc_offset[i], iioadc_lookup[i]->channel));}
+    }
+    if(iioadc_ts_offset >= 0){WRITE_ONCE(iioadc_scan_ns, *(const s64 *)((const u8 *)data + iioadc_ts_offset)); //taken by the trigger handler
+    }else{WRITE_ONCE(iioadc_scan_ns, iio_get_time_ns(iioadc_dev));} //no timestamp in the scan, push time on the same clock
+    iioadc_scans++;
+    return 0;
+}
+
+static int mk_iioadc_read_all(struct mk_adc *adc, const int *channels, int16_t *values, int count){ //iio adc: last buffered scan, or conversion on demand
+    int i, err = 0, raw;
+    
+    for(i=0;i<count;i++){
+        if(!iioadc_lookup[channels[i]]){values[i] = err = -ENODEV; continue;} //channel not mapped
+        if(!iioadc_buffered){ //also keeps the last value for the buffered mode
+            int ret = iio_read_channel_raw(iioadc_lookup[channels[i]], &raw);
+            if(ret < 0){err = ret;}
+            WRITE_ONCE(iioadc_values[channels[i]], ret < 0 ? ret : mk_adc_to_12bits(raw < 0 ? 0 : raw, iioadc_lookup[channels[i]]->channel->scan_type.realbits));
+        }
+        values[i] = READ_ONCE(iioadc_values[channels[i]]);
+    }
+    return err;
 }
 
+static const struct mk_adc_ops mk_adc_iio_ops = {"IIO", IIOADC_MAX_CHANNELS, 12, 0, NULL, NULL, mk_iioadc_read_all}; //values scaled per channel
 
 
-static int16_t ADC_OffsetCenter(uint16_t adc_resolution,uint16_t adc_value,uint16_t adc_min,uint16_t adc_max,int16_t adc_offset){
-    int16_t adc_center; int16_t range; int32_t ratio; int16_t corrected_value; //used variables
-    adc_center=adc_resolution/2; //center value, 2048 for 12bits
-    if(adc_value<(adc_center+adc_offset)){ //value under center offset
-        range=(adc_center+adc_offset)-adc_min;
-        if(range!=0){ //to avoid divide by 0
-            ratio=10000*adc_center/range; //float workaround
-            corrected_value=(adc_value-adc_min)*ratio/10000;
-        }else{corrected_value=adc_value;} //range=0, setting problems?
-    }else{ //value over center offset
-        range=adc_max-(adc_center+adc_offset);
-        if(range!=0){ //to avoid divide by 0
-            ratio=10000*adc_center/range; //float workaround
-            corrected_value=adc_center+(adc_value-(adc_center+adc_offset))*ratio/10000;
-        }else{corrected_value=adc_value;} //range=0, setting problems?
+static struct mk_adc __init *mk_iioadc_init(struct device *consumer, int devnum, const int *channels){ //map axis channels of iio:deviceN to this driver
+    static const char *names[] = {"x1", "y1", "x2", "y2"};
+    char name[24];
+    struct device *dev;
+    struct iio_channel *chan;
+    int i, j, n = 0, offset = 0, last = -1;
+    
+    snprintf(name, sizeof(name), "iio:device%d", devnum);
+    dev = bus_find_device_by_name(&iio_bus_type, NULL, name);
+    if(!dev){printk("mk_arcade_joystick_rpi: IIO ADC : %s not found\n", name); return NULL;}
+    iioadc_dev = dev_to_iio_dev(dev);
+    
+    for(i=0;i<MK_ADC_MAX_AXES;i++){ //single ended voltage inputs, by datasheet name
+        if(channels[i] < 0){continue;}
+        for(j=0;j<iioadc_dev->num_channels;j++){
+            const struct iio_chan_spec *spec = &iioadc_dev->channels[j];
+            if(spec->type == IIO_VOLTAGE && !spec->differential && spec->channel == channels[i] && spec->datasheet_name){break;}
+        }
+        if(j == iioadc_dev->num_channels || channels[i] >= IIOADC_MAX_CHANNELS){printk("mk_arcade_joystick_rpi: IIO ADC : %s has no channel %d\n", iioadc_dev->name, channels[i]); continue;}
+        iioadc_maps[n++] = (struct iio_map){iioadc_dev->channels[j].datasheet_name, dev_name(consumer), names[i], (void *)(long)channels[i]};
+    }
+    for(j=0;n && j<iioadc_dev->num_channels;j++){ //timestamp in the scans, mapped like the channels so the callback buffer gets it
+        const struct iio_chan_spec *spec = &iioadc_dev->channels[j];
+        if(spec->type == IIO_TIMESTAMP && spec->scan_index >= 0 && spec->datasheet_name){
+            iioadc_maps[n] = (struct iio_map){spec->datasheet_name, dev_name(consumer), "ts", (void *)(long)IIOADC_TIMESTAMP};
+            break;
+        }
     }
+    if(n == 0 || iio_map_array_register(iioadc_dev, iioadc_maps)){goto err_dev;}
     
-    if(corrected_value<1){corrected_value=1;}else if(corrected_value>4094){corrected_value=4094;} //constrain computed value to 12bits value + fix for Reicast overflow
-    return corrected_value;
+#if IS_ENABLED(CONFIG_IIO_BUFFER_CB)
+    iioadc_buffer = iio_channel_get_all_cb(consumer, mk_iioadc_push, NULL);
+    if(IS_ERR(iioadc_buffer)){iioadc_buffer = NULL; goto err_map;}
+    iioadc_chans = iio_channel_cb_get_channels(iioadc_buffer);
+#else
+    iioadc_chans = iio_channel_get_all(consumer);
+    if(IS_ERR(iioadc_chans)){iioadc_chans = NULL; goto err_map;}
+#endif
+    for(chan = iioadc_chans; chan->indio_dev; chan++){if((long)chan->data != IIOADC_TIMESTAMP){iioadc_lookup[(long)chan->data] = chan;}}
+    
+    for(;;){ //scan layout: enabled channels by scan index, each aligned on its size, timestamp last
+        const struct iio_channel *next = NULL;
+        for(chan = iioadc_chans; chan->indio_dev; chan++){
+            if(chan->channel->scan_index > last && (!next || chan->channel->scan_index < next->channel->scan_index)){next = chan;}
+        }
+        if(!next){break;}
+        offset = ALIGN(offset, next->channel->scan_type.storagebits / 8);
+        if((long)next->data == IIOADC_TIMESTAMP){iioadc_ts_offset = offset;}else{iioadc_offset[(long)next->data] = offset;}
+        offset += next->channel->scan_type.storagebits / 8;
+        last = next->channel->scan_index;
+    }
+    
+    if(iioadc_cfg.nargs > 1 && iioadc_cfg.params[1] > 0){ //sampling frequency, per channel on ADS1x15
+        for(chan = iioadc_chans; chan->indio_dev; chan++){
+            if((long)chan->data == IIOADC_TIMESTAMP){continue;}
+            if(iio_write_channel_attribute(chan, iioadc_cfg.params[1], 0, IIO_CHAN_INFO_SAMP_FREQ)){printk("mk_arcade_joystick_rpi: IIO ADC : %s rejected %d Hz\n", chan->channel->datasheet_name, iioadc_cfg.params[1]);}
+        }
+    }
+    
+    iioadc_enable = true;
+    printk("mk_arcade_joystick_rpi: IIO ADC : %s (%s), %d channels%s\n", iioadc_dev->name, name, n, iioadc_ts_offset >= 0 ? ", scan timestamp" : "");
+    mk_adcs[mk_adc_count] = (struct mk_adc){&mk_adc_iio_ops, iioadc_dev, NULL};
+    return &mk_adcs[mk_adc_count++];
+    
+err_map:
+    iio_map_array_unregister(iioadc_dev);
+err_dev:
+    printk("mk_arcade_joystick_rpi: IIO ADC : no usable channel on %s\n", name);
+    put_device(dev);
+    iioadc_dev = NULL;
+    return NULL;
+}
+
+static void __init mk_iioadc_start(void){ //switch to triggered capture once centers are read
+#if IS_ENABLED(CONFIG_IIO_BUFFER_CB)
+    int err = iio_channel_start_all_cb(iioadc_buffer);
+    if(err){printk("mk_arcade_joystick_rpi: IIO ADC : buffered capture failed (%d), set a trigger first, reading on demand\n", err); return;}
+    iioadc_buffered = true;
+    printk("mk_arcade_joystick_rpi: IIO ADC : buffered capture started\n");
+#else
+    printk("mk_arcade_joystick_rpi: IIO ADC : kernel without IIO_BUFFER_CB, reading on demand\n");
+#endif
+}
+
+static u64 mk_iioadc_now(void){return iioadc_dev ? iio_get_time_ns(iioadc_dev) : ktime_get_ns();} //clock of the scan timestamps
+
+static void mk_iioadc_exit(void){
+    if(!iioadc_dev){return;}
+#if IS_ENABLED(CONFIG_IIO_BUFFER_CB)
+    if(iioadc_buffered){iio_channel_stop_all_cb(iioadc_buffer);}
+    iio_channel_release_all_cb(iioadc_buffer);
+#else
+    iio_channel_release_all(iioadc_chans);
+#endif
+    iio_map_array_unregister(iioadc_dev);
+    put_device(&iioadc_dev->dev);
 }
+#else
+static struct mk_adc __init *mk_iioadc_init(struct device *consumer, int devnum, const int *channels){printk("mk_arcade_joystick_rpi: IIO ADC : kernel without IIO support\n"); return NULL;}
+static void __init mk_iioadc_start(void){}
+static u64 mk_iioadc_now(void){return ktime_get_ns();}
+static void mk_iioadc_exit(void){}
+#endif
 
 
-static int16_t ADC_Deadzone(uint16_t adc_value,uint16_t min,uint16_t max,uint16_t flat){
-    int16_t adc_center; //used variables
-    adc_center=(max+min)/2; //center value, 2048 for 12bits
-    if(adc_value>adc_center-flat&&adc_value<adc_center+flat){adc_value=adc_center;} //apply flat value to adc value
-    return adc_value;
+static int mk_iio_stats_show(struct seq_file *s, void *unused){ //iio adc statistics, debugfs
+    u64 scan_ns=READ_ONCE(iioadc_scan_ns);
+    seq_printf(s, "mode: %s\n", iioadc_buffered?"buffered":"on demand");
+    seq_printf(s, "scans: %llu\n", iioadc_scans);
+    seq_printf(s, "timestamp: %s\n", iioadc_ts_offset>=0?"scan":"push");
+    seq_printf(s, "last_scan_age_us: %lld\n", scan_ns?(s64)(mk_iioadc_now()-scan_ns)/1000:-1);
+    return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(mk_iio_stats);
+#else
+static void mk_iioadc_exit(void){}
+#endif
 
 
-static int16_t ADS1015_read(const struct i2c_client *client,uint16_t axis){ //based on https://github.com/torvalds/linux/blob/master/drivers/hwmon/ads1015.c
-    int16_t value=0; //used variables
-    int16_t ain=ads1015_lookup[axis]; //get ain id
-    if(ain<0||ain>3){return -1;} //fail: ain oob, return -1
-    i2c_smbus_write_word_swapped(client,0x01,0x83E3|ads1015_ain[ain]); //default config but +-4.096v FSR and 3300SPS
-    udelay(450); //wait 450us for conversion, 390us sould be enough in worst case but +60us add a extra security
-    value=i2c_smbus_read_word_swapped(client,0); //read value
-    if(value>=0){ //success
-        value=value>>4; //shift bits to get 12bits value
-        if(value<=0xFFF){ //valid 12bit range
-            return value; //return adc result
-        }else{return -1;} //invalid range
-    }else{return value;} //fail: return i2c error
+#if IS_ENABLED(CONFIG_MK_ADC_ADS1X15)
+static int mk_ads_rest_stats_show(struct seq_file *s, void *unused){ //ADS1x15 comparator rest statistics, debugfs
+    struct mk_ads1x15_priv *priv = ads_rest_adc->priv;
+    seq_printf(s, "resting: %d\n", priv->resting);
+    seq_printf(s, "watched_channel: %d\n", priv->resting ? priv->watch : -1);
+    seq_printf(s, "rests: %u\n", ads_rest_count);
+    seq_printf(s, "wakes: %u\n", ads_rest_wakes);
+    seq_printf(s, "skipped_polls: %llu\n", ads_rest_skipped);
+    return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(mk_ads_rest_stats);
+#endif
 
 /* GPIO UTILS */
 #if defined(RPI4)
@@ -540,10 +1203,84 @@ static void setGpioPullUps(uint32_t pullUps, uint32_t pullUpsHigh){
 }
 #endif
 
-static void setGpioAsInput(int gpioNum){INP_GPIO(gpioNum);} //gpio: set as input
-static void setGpioAsOuput(int gpioNum){OUT_GPIO(gpioNum);} //gpio: set as output
-static void GpioOuputSet(int gpioNum){GPIO_SET(gpioNum);} //gpio: set output high
-static void GpioOuputClr(int gpioNum){GPIO_CLR(gpioNum);} //gpio: set output low
+static struct gpiod_lookup_table *mk_gpiod_lookup_add(const char *label, const char *con_id, int pins[], unsigned long flags[], int count){ //gpiolib: register lookup table for our device
+    struct gpiod_lookup_table *table;
+    int i;
+    
+    table = kzalloc(struct_size(table, table, count+1), GFP_KERNEL); //last entry is the terminator
+    if(!table){return NULL;}
+    table->dev_id = "mk_arcade_joystick_rpi";
+    for(i=0;i<count;i++){table->table[i] = GPIO_LOOKUP_IDX(label, pins[i], con_id, i, flags[i]);}
+    gpiod_add_lookup_table(table);
+    return table;
+}
+
+
+static void mk_gpiod_lookup_remove(struct gpiod_lookup_table *table){ //gpiolib: remove lookup table
+    if(!table){return;}
+    gpiod_remove_lookup_table(table);
+    kfree(table);
+}
+
+
+static struct gpio_descs *mk_gpiod_get_array(const char *con_id, int pins[], unsigned long flags[], int count, enum gpiod_flags dflags){ //gpiolib: get lines, try known chip labels
+    struct gpio_descs *descs = ERR_PTR(-ENODEV);
+    struct gpiod_lookup_table *lookup;
+    int i;
+    
+    for(i=0;i<ARRAY_SIZE(gpiochip_labels);i++){
+        const char *label = gpiochip_label[0] ? gpiochip_label : gpiochip_labels[i];
+        lookup = mk_gpiod_lookup_add(label, con_id, pins, flags, count);
+        if(!lookup){return ERR_PTR(-ENOMEM);}
+        descs = gpiod_get_array(&mk_pdev->dev, con_id, dflags);
+        mk_gpiod_lookup_remove(lookup); //gpiolib only searches the first table of a device, never keep one past the request
+        if(!IS_ERR(descs)){
+            if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : %s lines on %s\n", con_id, label);}
+            return descs;
+        }
+        if(gpiochip_label[0]){break;} //user defined chip only
+    }
+    return descs;
+}
+
+
+#if IS_ENABLED(CONFIG_MK_FF_GPIO)
+static void mk_gpiod_request_output(int gpioNum){ //gpiolib: request force feedback line
+    static const char *con_ids[] = {"ff0", "ff1", "ff2"};
+    unsigned long flags = GPIO_ACTIVE_HIGH;
+    struct gpio_descs *descs;
+    int i;
+    
+    for(i=0;i<gpiod_out_count;i++){if(gpiod_out_pin[i]==gpioNum){return;}} //already requested
+    if(gpiod_out_count>=GPIOD_MAX_OUTPUTS){return;}
+    descs = mk_gpiod_get_array(con_ids[gpiod_out_count], &gpioNum, &flags, 1, GPIOD_OUT_LOW);
+    if(IS_ERR(descs)){printk("mk_arcade_joystick_rpi: Failed to get output line for pin %d : %ld\n", gpioNum, PTR_ERR(descs)); return;}
+    if(gpiod_cansleep(descs->desc[0])){ //set from the ff-memless timer, atomic context
+        printk("mk_arcade_joystick_rpi: Output line for pin %d is on a sleeping chip, not usable for force feedback\n", gpioNum);
+        gpiod_put_array(descs);
+        return;
+    }
+    gpiod_out_pin[gpiod_out_count] = gpioNum;
+    gpiod_out_descs[gpiod_out_count] = descs;
+    gpiod_out_count++;
+}
+
+
+static void mk_gpiod_set_output(int gpioNum, int value){ //gpiolib: set force feedback line
+    int i;
+    for(i=0;i<gpiod_out_count;i++){
+        if(gpiod_out_pin[i]==gpioNum){gpiod_set_value(gpiod_out_descs[i]->desc[0], value); return;}
+    }
+}
+#endif
+
+
+static void setGpioAsInput(int gpioNum){if(gpio_backend==GPIO_BACKEND_RAW){INP_GPIO(gpioNum);}} //gpio: set as input
+#if IS_ENABLED(CONFIG_MK_FF_GPIO)
+static void setGpioAsOuput(int gpioNum){if(gpio_backend==GPIO_BACKEND_RAW){OUT_GPIO(gpioNum);}else if(gpio_backend==GPIO_BACKEND_GPIOLIB){mk_gpiod_request_output(gpioNum);}} //gpio: set as output
+static void GpioOuputSet(int gpioNum){if(gpio_backend==GPIO_BACKEND_RAW){GPIO_SET(gpioNum);}else if(gpio_backend==GPIO_BACKEND_GPIOLIB){mk_gpiod_set_output(gpioNum,1);}} //gpio: set output high
+static void GpioOuputClr(int gpioNum){if(gpio_backend==GPIO_BACKEND_RAW){GPIO_CLR(gpioNum);}else if(gpio_backend==GPIO_BACKEND_GPIOLIB){mk_gpiod_set_output(gpioNum,0);}} //gpio: set output low
+#endif
     
     
 
@@ -567,290 +1304,1554 @@ static int getPullUpMask(int gpioMap[], uint32_t *maskLow, uint32_t *maskHigh){
 }
 
 
+static unsigned long mk_gpio_read_buttons(struct mk_pad * pad){ //read all buttons of a pad at once, bit set if pressed
+    unsigned long pressed = 0;
+    int i;
+    
+    if(gpio_backend==GPIO_BACKEND_GPIOLIB){
+        DECLARE_BITMAP(values, MK_MAX_BUTTONS);
+        if(!pad->gpiods){return 0;}
+        if(gpiod_get_array_value_cansleep(pad->gpiods->ndescs, pad->gpiods->desc, pad->gpiods->info, values)){return pad->pressed;} //keep previous state on failure
+        for(i = 0; i < pad->gpiods->ndescs; i++){ //lines polarity set in lookup table, 1 is pressed
+            if(test_bit(i, values)){pressed |= 1UL<<pad->gpiod_map[i];}
+        }
+        pad->level[0] = pressed; pad->level[1] = 0;
+    }else if(gpio_backend==GPIO_BACKEND_INJECT){
+        pad->level[0] = pad->inject->last.level[0]; pad->level[1] = pad->inject->last.level[1];
+        if(pad->inject->stream_flags & MK_CAPTURE_FLAG_GPIOLIB){pressed = pad->level[0]; //already a pressed bitmap
+        }else{pressed = mk_levels_to_pressed(pad->gpio_maps, pad->level[0], pad->level[1]);}
+    }else{
+        pad->level[0] = *(gpio + 13); pad->level[1] = *(gpio + 14); //GPLEV0 and GPLEV1, one read for all buttons
+        pressed = mk_levels_to_pressed(pad->gpio_maps, pad->level[0], pad->level[1]);
+    }
+    return pressed;
+}
+
+
 static void mk_gpio_read_packet(struct mk_pad * pad, unsigned char *data){
+    pad->pressed = mk_gpio_read_buttons(pad);
+    mk_buttons_decode(pad->gpio_maps, pad->hotkey_mode, &hk_state, pad->pressed, data);
+}
+
+
+#if IS_ENABLED(CONFIG_MK_ADC_ADS1X15)
+static bool mk_ads_rest_check(void){ //comparator rest: true while the chip needs no conversion
+    struct mk_ads1x15_priv *priv = ads_rest_adc->priv;
+    if(!priv->resting){return false;}
+    if(READ_ONCE(ads_alert)){ //a watched channel left the window
+        WRITE_ONCE(ads_alert,false);
+        mk_ads1x15_wake(ads_rest_adc);
+        ads_rest_wakes++;
+        ads_rest_since=jiffies;
+        if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : ADS comparator alert on channel %d, reads resumed\n", priv->watch);}
+        return false;
+    }
+    if(mk_ads1x15_rest_next(ads_rest_adc) < 0){mk_ads1x15_wake(ads_rest_adc); ads_rest_since=jiffies; return false;} //i2c error, back to reads
+    ads_rest_skipped++;
+    return true;
+}
+
+static void mk_ads_rest_update(const int16_t *adc_values, unsigned int active){ //comparator rest: enter once the chip axes stayed centered
+    struct mk_ads1x15_priv *priv = ads_rest_adc->priv;
+    int j;
+    
+    if(priv->resting){return;}
+    for(j=0;j<4;j++){if((ads_rest_axes & (1U << j)) && adc_values[j] < 0){active |= 1U << j;}} //read errors never rest
+    if((active & ads_rest_axes) || !time_after(jiffies, ads_rest_since+ads_rest_timeout)){
+        if(active & ads_rest_axes){ads_rest_since=jiffies;}
+        return;
+    }
+    for(j=0;j<4;j++){ads_rest_values[j]=adc_values[j];}
+    WRITE_ONCE(ads_alert,false); //stale edge of a previous rest
+    if(mk_ads1x15_rest(ads_rest_adc, ads_rest_channels, ads_rest_window) < 0){ads_rest_since=jiffies; return;} //retry later
+    ads_rest_count++;
+    if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : ADS comparator rest\n");}
+}
+#endif
+
+
+static void mk_turbo_arm(struct mk_turbo *turbo){ //timer on the earliest edge, mk_turbo_lock held, the timer callback re-arms under it too
+    ktime_t next = KTIME_MAX;
+    int j;
+    for(j = 4; j < MK_MAX_BUTTONS; j++){
+        if((turbo->held & BIT(j)) && ktime_before(turbo->next[j], next)){next = turbo->next[j];}
+    }
+    if(next != KTIME_MAX){hrtimer_start(&turbo->timer, next, HRTIMER_MODE_ABS);}
+}
+
+
+static void mk_turbo_update(struct mk_pad *pad, const unsigned char *data, const struct mk_profile *prof, unsigned long enabled){ //start and stop firing of held turbo buttons, polling side, mk_turbo_lock held
+    struct mk_turbo *turbo = pad->turbo;
+    ktime_t now = ktime_get();
+    bool arm = false;
+    int j;
+    
+    for(j = 4; j < MK_MAX_BUTTONS; j++){
+        bool fire = (enabled & BIT(j)) && data[j] && prof->turbo_period_ns[j] && pad->gpio_maps[j] != -1;
+        if(fire && !(turbo->held & BIT(j))){ //pressed: first shot now, cadence from the press
+            turbo->held |= BIT(j);
+            turbo->level |= BIT(j);
+            turbo->next[j] = ktime_add_ns(now, prof->turbo_on_ns[j]);
+            input_report_key(pad->dev, prof->keys[j - 4], 1);
+            arm = true;
+        }else if(!fire && (turbo->held & BIT(j))){ //released or turbo switched off
+            turbo->held &= ~BIT(j);
+            if(turbo->level & BIT(j)){input_report_key(pad->dev, prof->keys[j - 4], 0);}
+            turbo->level &= ~BIT(j);
+        }
+    }
+    if(arm){mk_turbo_arm(turbo);}
+}
+
+
+static enum hrtimer_restart mk_turbo_timer(struct hrtimer *timer){ //turbo edges of held buttons, re-armed under mk_turbo_lock so a press on the polling side cannot race the expiry
+    struct mk_turbo *turbo = container_of(timer, struct mk_turbo, timer);
+    ktime_t now = hrtimer_cb_get_time(timer), next = KTIME_MAX;
+    const struct mk_profile *prof;
+    unsigned long flags;
+    bool changed = false;
+    int j;
+    
+    spin_lock_irqsave(&mk_turbo_lock, flags);
+    prof = rcu_dereference_protected(mk_profile, lockdep_is_held(&mk_turbo_lock));
+    for(j = 4; j < MK_MAX_BUTTONS; j++){
+        if(!(turbo->held & BIT(j))){continue;}
+        if(!ktime_before(now, turbo->next[j])){
+            turbo->level ^= BIT(j);
+            input_report_key(turbo->dev, prof->keys[j - 4], !!(turbo->level & BIT(j)));
+            changed = true;
+            turbo->next[j] = ktime_add_ns(turbo->next[j], (turbo->level & BIT(j)) ? prof->turbo_on_ns[j] : prof->turbo_period_ns[j] - prof->turbo_on_ns[j]);
+            if(ktime_before(turbo->next[j], now)){turbo->next[j] = ktime_add_ns(now, prof->turbo_on_ns[j]);} //late timer, no burst of edges
+        }
+        if(ktime_before(turbo->next[j], next)){next = turbo->next[j];}
+    }
+    if(changed){input_sync(turbo->dev);}
+    if(next != KTIME_MAX){hrtimer_start(timer, next, HRTIMER_MODE_ABS);} //may already be queued by mk_turbo_arm, start moves it
+    spin_unlock_irqrestore(&mk_turbo_lock, flags);
+    return HRTIMER_NORESTART; //queued above if needed, never restarted with an expiry set outside the lock
+}
+
+
+static void mk_turbo_stop(void){ //polling stopped, nothing fires until the buttons are seen again
+    unsigned long flags;
     int i;
     
-    for(i = 0; i < MK_MAX_BUTTONS; i++){
-        if(pad->gpio_maps[i] != -1){    // to avoid unused buttons
-            if((i==12) && (pad->hotkey_mode == HOTKEY_MODE_TOGGLE)){  //the hotkey
-                //we use the hotkey as a toggle (press to toggle data[i])
-                unsigned char hk_state;
-                int read;
-                if(pad->gpio_maps[i] < 0){
-                    read = GPIO_READ(pad->gpio_maps[i] * -1); //invert this signal
-                    if(read == 0){
-                        hk_state = 0;
-                    }else{
-                        hk_state = 1; //pressed
-                    }
-                }else{
-                    read = GPIO_READ(pad->gpio_maps[i]);
-                    if(read == 0){
-                        hk_state = 1; //pressed
-                    }else{
-                        hk_state = 0;
-                    }
-                }
-                
-                if(hk_state != hk_state_prev){ //the hotkey changed
-                    hk_state_prev = hk_state;
-                    
-                    //if it changed and it's now a 1, we enter pre-hotkey mode
-                    if(hk_state){
-                        if(hk_pre_mode){
-                            //the PWR btn itself is the hotkey
-                            data[12] = 1;   //turn on the hotkey
-                            hotkey_combo_btn = i;
-                        }else{
-                            hk_pre_mode = 1;
-                            hotkey_combo_btn = -1;
-                        }
-                    }else if(hotkey_combo_btn == i){  //the hotkey was just released, and the PWR btn itself is the hotkey
-                        data[12] = 0;   //turn off the hotkey
-                        hk_pre_mode = 0;
-                        hotkey_combo_btn = -1;
-                    }
-                }
-            }else{
-                //all other (non-hotkey) buttons just report their state to data[i]
-                //except when we are in hk_state
-                unsigned char prev_data = data[i];
-                if(pad->gpio_maps[i] < 0){ //invert this signal
-                    int read = GPIO_READ(pad->gpio_maps[i] * -1);
-                    if(read == 0){
-                        data[i] = 0;
-                    }else{data[i] = 1;}
-                }else{
-                    int read = GPIO_READ(pad->gpio_maps[i]);
-                    if(read == 0){
-                        data[i] = 1;
-                    }else{data[i] = 0;}
-                }
-                
-                if(prev_data != data[i]){ //the state of this button changed
-                    if(hk_pre_mode){
-                        if(data[i]){ //the button was just pressed
-                            data[12] = 1;   //turn on the hotkey
-                            hotkey_combo_btn = i;
-                        }else if(i == hotkey_combo_btn){   //the button was just released
-                            data[12] = 0;   //turn off the hotkey
-                            hk_pre_mode = 0;
-                            hotkey_combo_btn = -1;
-                        }
-                    }
-                }
-            }
-        }else{data[i] = 0;}
+    for(i = 0; i < MK_MAX_DEVICES; i++){
+        struct mk_turbo *turbo = &mk_turbos[i];
+        if(!turbo->dev){continue;}
+        hrtimer_cancel(&turbo->timer);
+        spin_lock_irqsave(&mk_turbo_lock, flags);
+        if(turbo->held & turbo->level){ //release what is still pressed
+            const struct mk_profile *prof = rcu_dereference_protected(mk_profile, lockdep_is_held(&mk_turbo_lock));
+            int j;
+            for(j = 4; j < MK_MAX_BUTTONS; j++){if(turbo->held & turbo->level & BIT(j)){input_report_key(turbo->dev, prof->keys[j - 4], 0);}}
+            input_sync(turbo->dev);
+        }
+        turbo->held = turbo->level = 0;
+        spin_unlock_irqrestore(&mk_turbo_lock, flags);
     }
 }
 
 
-static void mk_input_report(struct mk_pad * pad, unsigned char * data){
-    if(debug_mode>1){benchmark_time_start=(unsigned long)jiffies;} //benchmark, may be removed in the future
+static void mk_keys_release(const short *old, const short *keys){ //buttons remapped while their key is down, the new key is reported next poll, mk_turbo_lock held
+    int i, j;
     
-    struct input_dev * dev = pad->dev;
-    int j; //gpio maps loop
-    int16_t adc_val = 2048; //security if something goes wrong
+    for(i = 0; mk_base && i < MK_MAX_DEVICES; i++){
+        struct input_dev *dev = mk_base->pads[i].dev;
+        if(!dev){continue;}
+        for(j = 0; j < MK_MAX_BUTTONS - 4; j++){
+            if(old[j] != keys[j] && test_bit(old[j], dev->key)){input_report_key(dev, old[j], 0);}
+        }
+        input_sync(dev);
+    }
+}
+
+
+static void mk_profile_arm(struct mk_profile *prof){ //make prof active with its turbo and combos, keys already released, mk_turbo_lock held
+    int i, j;
+    
+    for(i = 0; mk_base && i < MK_MAX_DEVICES; i++){mk_base->pads[i].combo = (struct mk_combo_state){mk_base->pads[i].pressed, -1, 0, -1};} //other combo table
+    hk_state.turbo_armed = 0;
+    hk_state.turbo_off = 0;
+    for(j = 4; j < MK_MAX_BUTTONS; j++){if(prof->turbo_period_ns[j]){hk_state.turbo_armed |= BIT(j);}}
+    hk_state.action_armed = mk_combo_armed(prof->combos, prof->combo_count);
+    rcu_assign_pointer(mk_profile, prof);
+}
+
+
+static void mk_profile_set(struct mk_profile *prof){ //switch the active profile, mk_turbo_lock held
+    struct mk_profile *old = rcu_dereference_protected(mk_profile, lockdep_is_held(&mk_turbo_lock));
+    
+    if(prof == old){return;}
+    mk_keys_release(old->keys, prof->keys);
+    mk_profile_arm(prof);
+    if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Profile : %s\n", prof->name);}
+}
+
+
+static void mk_combo_report(struct mk_pad *pad){ //hotkey actions: key of the active combo, mk_turbo_lock held
+    struct mk_profile *prof = rcu_dereference_protected(mk_profile, lockdep_is_held(&mk_turbo_lock));
+    int active = mk_combo_update(prof->combos, prof->combo_count, &pad->combo, hk_state.action_btn, pad->pressed, jiffies_to_usecs(poll_refresh_time));
+    unsigned int code = active >= 0 ? prof->combos[active].code : 0;
+    
+    if(code == pad->combo_code){return;}
+    if(pad->combo_code && pad->combo_code < MK_COMBO_PROFILE){input_report_key(mk_combo_dev, pad->combo_code, 0);}
+    if(code >= MK_COMBO_PROFILE){ //profile switch, on press only
+        if(mk_profiles[code - MK_COMBO_PROFILE].name[0]){mk_profile_set(&mk_profiles[code - MK_COMBO_PROFILE]);}
+    }else if(code){input_report_key(mk_combo_dev, code, 1);}
+    input_sync(mk_combo_dev);
+    if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Hotkey action : key %u -> %u\n", pad->combo_code, code);}
+    pad->combo_code = code;
+}
+
+
+static void mk_combo_stop(void){ //polling stopped, release action keys
+    unsigned long flags;
+    int i;
+    
+    if(!mk_combo_dev || !mk_base){return;}
+    spin_lock_irqsave(&mk_turbo_lock, flags);
+    for(i = 0; i < MK_MAX_DEVICES; i++){
+        struct mk_pad *pad = &mk_base->pads[i];
+        if(pad->combo_code && pad->combo_code < MK_COMBO_PROFILE){input_report_key(mk_combo_dev, pad->combo_code, 0); input_sync(mk_combo_dev);}
+        pad->combo = (struct mk_combo_state){0, -1, 0, -1};
+        pad->combo_code = 0;
+    }
+    spin_unlock_irqrestore(&mk_turbo_lock, flags);
+}
+
+
+static void mk_input_report(struct mk_pad * pad, unsigned char * data){
+#if IS_ENABLED(CONFIG_MK_DEBUG)
+    if(static_branch_unlikely(&mk_bench_key)){benchmark_time_start=ktime_get_ns();}
+#endif
+    
+    struct input_dev * dev = pad->dev;
+    int j; //gpio maps loop
+    int16_t adc_val = 2048; //security if something goes wrong
+    int16_t adc_values[MK_ADC_MAX_AXES]; //x1,y1,x2,y2
+    unsigned int adc_active = 0; //axes out of deadzone
+    unsigned long flags;
+    struct mk_profile *prof;
+    
+    input_report_abs(dev, mk_dpad_abs[0], !data[2]-!data[3]); //DPAD is ABS_X, ABS_HAT0X if using analog
+    input_report_abs(dev, mk_dpad_abs[1], !data[0]-!data[1]); //DPAD is ABS_Y, ABS_HAT0Y if using analog
+    
+    if(static_branch_unlikely(&mk_analog_key)){
+        unsigned int poll_us = jiffies_to_usecs(poll_refresh_time); //smoothing time step
+        struct analog_abs_params_struct params[MK_ADC_MAX_AXES]; //active profile, snapshot
+        int16_t offsets[MK_ADC_MAX_AXES];
+        const int16_t *tables[MK_ADC_MAX_AXES];
+        
+        for(j = 0; j < 4; j++){pad->adc_raw[j] = MK_CAPTURE_ADC_NONE;} //capture
+        if(static_branch_unlikely(&mk_inject_key)){for(j = 0; j < 4; j++){adc_values[j] = pad->inject->last.adc[j];} //injected
+#if IS_ENABLED(CONFIG_MK_ADC_ADS1X15)
+        }else if(static_branch_unlikely(&mk_ads_rest_key) && mk_ads_rest_check()){ //comparator rest: chip axes keep their values, other chips read
+            struct mk_adc_axis axes[MK_ADC_MAX_AXES];
+            memcpy(axes, mk_adc_axes, sizeof(axes));
+            for(j = 0; j < 4; j++){if(ads_rest_axes & (1U << j)){axes[j].adc = NULL;}}
+            adc_wait_us = mk_adc_poll(axes, MK_ADC_MAX_AXES, adc_values);
+            for(j = 0; j < 4; j++){if(ads_rest_axes & (1U << j)){adc_values[j] = ads_rest_values[j];}}
+#endif
+        }else{adc_wait_us = mk_adc_poll(mk_adc_axes, MK_ADC_MAX_AXES, adc_values);} //all chips, conversions overlapped
+        
+        rcu_read_lock(); //response curves
+        spin_lock_irqsave(&mk_turbo_lock, flags); //calibration and curve of an axis changed together by absparams
+        prof = rcu_dereference_protected(mk_profile, lockdep_is_held(&mk_turbo_lock));
+        memcpy(params, prof->params, sizeof(params));
+        memcpy(offsets, prof->offset, sizeof(offsets));
+        for(j = 0; j < MK_ADC_MAX_AXES; j++){tables[j] = rcu_dereference(prof->curves[j].table);}
+        spin_unlock_irqrestore(&mk_turbo_lock, flags);
+        for(j = 0; j < mk_axis_report_count; j++){
+            const struct mk_axis_report *axis = &mk_axis_reports[j];
+            int n = axis->axis;
+            adc_val = adc_values[n];
+            if(adc_val<0){
+#if IS_ENABLED(CONFIG_MK_DEBUG)
+                if(static_branch_unlikely(&mk_debug_key)){printk("mk_arcade_joystick_rpi: DEBUG : failed to read analog %s, returned %i\n",mk_axis_names[n],adc_val);}
+#endif
+                continue;
+            }
+            pad->adc_raw[n] = adc_val >> axis->shift; //capture, 12bits
+            adc_val = mk_adc_filter(&adc_filters[n], adc_val); //median pre-filter on raw value
+            adc_val = mk_smooth(&adc_smooth[n], adc_val, poll_us); //adaptive smoothing
+            adc_val = mk_analog_process(adc_val,axis->reverse,axis->seen_min,axis->seen_max,&params[n],offsets[n],tables[n],axis->shift); //reverse, re-center and apply flat
+            if(adc_val!=0x7FF<<axis->shift){poll_activity=true; adc_active|=1U<<n;} //stick out of deadzone, adaptive polling
+            input_report_abs(dev, axis->code, adc_val);
+        }
+        rcu_read_unlock();
+        
+#if IS_ENABLED(CONFIG_MK_ADC_ADS1X15)
+        if(static_branch_unlikely(&mk_ads_rest_key)){mk_ads_rest_update(adc_values, adc_active);} //comparator rest once centered
+#endif
+    }
+    
+    spin_lock_irqsave(&mk_turbo_lock, flags); //no turbo edge in the middle of the frame
+    prof = rcu_dereference_protected(mk_profile, lockdep_is_held(&mk_turbo_lock)); //may have been switched since the axes
+    if(hk_state.turbo_armed || pad->turbo->held){mk_turbo_update(pad, data, prof, hk_state.turbo_armed & ~hk_state.turbo_off);}
+    for (j = 4; j < MK_MAX_BUTTONS; j++){
+        if(pad->gpio_maps[j] != -1 && !(pad->turbo->held & BIT(j))){input_report_key(dev, prof->keys[j - 4], data[j]);} //firing buttons reported by the turbo timer
+    }
+    
+    input_sync(dev);
+    if(static_branch_unlikely(&mk_combo_key)){mk_combo_report(pad);} //hotkey actions
+    spin_unlock_irqrestore(&mk_turbo_lock, flags);
+    
+#if IS_ENABLED(CONFIG_MK_FF_PWM)
+    //PWM force feedback, need to be here because i2c_smbus_write_byte_data mess with schedule_delayed_work
+    if(static_branch_unlikely(&mk_ff_pwm_key)){
+        if(!ff_strong_pwm_sent){ //pwm i2c not already sent
+            if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Feedback effect : PWM Strong : %d\n",ff_strong_pwm_value);}
+            i2c_smbus_write_byte_data(pca9633_client,(uint8_t)(ff_strong_pwm+2),(uint8_t)(ff_strong_pwm_value)); //send pwm to i2c
+            ff_strong_pwm_sent=true; //reset
+        }
+        
+        if(!ff_weak_pwm_sent){ //pwm i2c not already sent
+            if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Feedback effect : PWM Weak : %d\n",ff_weak_pwm_value);}
+            i2c_smbus_write_byte_data(pca9633_client,(uint8_t)(ff_weak_pwm+2),(uint8_t)(ff_weak_pwm_value)); //send pwm to i2c
+            ff_weak_pwm_sent=true; //reset
+        }
+    }
+#endif
+    
+#if IS_ENABLED(CONFIG_MK_DEBUG)
+    if(static_branch_unlikely(&mk_bench_key)){ //ns per tick of this function
+        u64 duration = ktime_get_ns() - benchmark_time_start;
+        if(duration>benchmark_time){benchmark_time=duration;} //longest
+        benchmark_total+=duration;
+        if(++benchmark_loop>=benchmark_maxloop){ //report benchmark and reset
+            printk("mk_arcade_joystick_rpi: DEBUG : Benchmark : %d updates : average %llu nsec, longest %llu nsec\n",benchmark_loop,div_u64(benchmark_total,benchmark_loop),benchmark_time);
+            benchmark_time=0; benchmark_total=0; benchmark_loop=0; //reset values
+        }
+    }
+#endif
+}
+
+
+static void mk_capture_push(struct mk_capture *cap, struct mk_pad *pad){ //capture: add last raw read to ring, work handler only
+    struct mk_capture_sample *sample;
+    unsigned int head = cap->head;
+    
+    if(!cap->ring || !test_bit(MK_CAPTURE_OPEN, &cap->flags)){return;} //nobody listening
+    if(head - smp_load_acquire(&cap->tail) >= cap->size){cap->overruns++; return;} //full, drop newest
+    sample = &cap->ring[head & (cap->size - 1)];
+    sample->time_ns = ktime_get_ns();
+    sample->level[0] = pad->level[0]; sample->level[1] = pad->level[1];
+    memcpy(sample->adc, pad->adc_raw, sizeof(sample->adc));
+    smp_store_release(&cap->head, head + 1); //publish sample
+    cap->samples++;
+    if(wq_has_sleeper(&cap->wait)){wake_up_interruptible(&cap->wait);}
+}
+
+
+static void mk_inject_pull(struct mk_inject *inj){ //injection: take next sample for this poll, work handler only
+    unsigned int tail = inj->tail;
+    
+    if(smp_load_acquire(&inj->head) == tail){inj->underruns++; return;} //empty, hold last sample
+    inj->last = inj->ring[tail & (MK_INJECT_SIZE - 1)];
+    smp_store_release(&inj->tail, tail + 1); //free slot
+    inj->samples++;
+    if(wq_has_sleeper(&inj->wait)){wake_up_interruptible(&inj->wait);}
+}
+
+
+static void mk_process_packet(struct mk *mk){
+    struct mk_pad *pad;
+    int i;
+    
+    for(i = 0; i < mk->total_pads; i++){
+        pad = &mk->pads[i];
+        if(static_branch_unlikely(&mk_inject_key)){mk_inject_pull(pad->inject);}
+        mk_gpio_read_packet(pad, data);     //data is now global
+        if(memcmp(pad->data_prev, data, MK_MAX_BUTTONS)){ //button changed since this pad's previous tick, adaptive polling
+            poll_activity=true;
+            memcpy(pad->data_prev, data, MK_MAX_BUTTONS);
+        }
+        mk_input_report(pad, data);
+        if(static_branch_unlikely(&mk_capture_key)){mk_capture_push(&mk_captures[i], pad);}
+    }
+}
+
+
+static void mk_poll_set_mode(bool idle){ //adaptive polling: switch between full and idle rate
+    unsigned long now=jiffies;
+    if(poll_idle){poll_time_idle+=now-poll_mode_start;}else{poll_time_full+=now-poll_mode_start;} //account time spent in previous mode
+    poll_mode_start=now;
+    if(poll_idle!=idle){
+        poll_idle=idle;
+        poll_mode_switches++;
+        if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Polling : %s rate\n", idle?"idle":"full");}
+    }
+    poll_refresh_time=idle?idle_refresh_time:MK_REFRESH_TIME;
+}
+
+
+static void mk_poll_update(void){ //adaptive polling: compute next delay
+    if(READ_ONCE(poll_activity)){
+        WRITE_ONCE(poll_activity,false);
+        poll_last_activity=jiffies;
+        if(pm_resume_pending){ //first event since resume
+            pm_resume_pending=false;
+            pm_resume_latency_us=ktime_us_delta(ktime_get(),pm_resume_time);
+            if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Resume to first event : %lld usec\n",pm_resume_latency_us);}
+        }
+        if(poll_idle){mk_poll_set_mode(false);} //snap back to full rate
+    }else if(idle_enable&&!poll_idle&&time_after(jiffies,poll_last_activity+idle_timeout)){
+        mk_poll_set_mode(true); //nothing happened for idle timeout, drop to idle rate
+    }
+}
+
+
+static void mk_poll_start(void){ //start polling at full rate
+    poll_idle=false; poll_refresh_time=MK_REFRESH_TIME;
+    poll_mode_start=jiffies; poll_last_activity=jiffies;
+    WRITE_ONCE(poll_running,true);
+    schedule_delayed_work(&mk_delayed_work, MK_REFRESH_TIME);
+}
+
+
+static void mk_poll_stop(void){ //stop polling
+    unsigned long flags;
+    int i;
+    
+    spin_lock_irqsave(&mk_poll_lock, flags); //wake irq in progress done, next ones see polling stopped
+    WRITE_ONCE(poll_running,false);
+    spin_unlock_irqrestore(&mk_poll_lock, flags);
+    cancel_delayed_work_sync(&mk_delayed_work);
+    mk_turbo_stop(); //no restart left, polling is over
+    mk_combo_stop();
+    mk_poll_set_mode(poll_idle); //account last polling period
+    if(static_branch_unlikely(&mk_inject_key)){ //injection writers waiting on a full queue, nothing drains it anymore
+        for(i = 0; i < mk_base->total_pads; i++){wake_up_interruptible(&mk_base->pads[i].inject->wait);}
+    }
+}
+
+
+static irqreturn_t mk_wake_irq(int irq, void *dev_id){ //adaptive polling and system wake: wake pin edge
+    unsigned long flags;
+    
+    WRITE_ONCE(poll_activity,true);
+    spin_lock_irqsave(&mk_poll_lock, flags); //not queued once mk_poll_stop cancelled the work
+    if(poll_running&&READ_ONCE(poll_idle)){mod_delayed_work(system_wq, &mk_delayed_work, 0);} //poll now
+    spin_unlock_irqrestore(&mk_poll_lock, flags);
+    return IRQ_HANDLED;
+}
+
+
+#if IS_ENABLED(CONFIG_MK_ADC_ADS1X15)
+static irqreturn_t mk_ads_alert_irq(int irq, void *dev_id){ //comparator rest: ADS1x15 ALERT, a resting stick moved
+    WRITE_ONCE(ads_alert,true);
+    return mk_wake_irq(irq, dev_id);
+}
+#endif
+
+
+#if IS_ENABLED(CONFIG_MK_FF_GPIO) || IS_ENABLED(CONFIG_MK_FF_PWM)
+static int mk_ff(struct input_dev *dev, void *data, struct ff_effect *effect){ //nns: handle force feedback effects
+    struct mk_ff_cmd cmd;
+    bool weak_enable=false, strong_pwm_reverse=false, weak_pwm_reverse=false;
+    
+    if(effect->type!=FF_RUMBLE){
+        if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Wrong force feedback effect\n");}
+        return 0;
+    }else{
+#if IS_ENABLED(CONFIG_MK_FF_GPIO)
+        weak_enable=ff_gpio_weak_pin!=-1;
+#endif
+#if IS_ENABLED(CONFIG_MK_FF_PWM)
+        weak_enable=weak_enable||ff_weak_pwm!=-1;
+        strong_pwm_reverse=ff_strong_pwm_reverse;
+        weak_pwm_reverse=ff_weak_pwm_reverse;
+#endif
+        mk_ff_rumble(&ff_state,effect->u.rumble.strong_magnitude,effect->u.rumble.weak_magnitude,effect->direction,weak_enable,strong_pwm_reverse,weak_pwm_reverse,&cmd);
+        
+        if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Feedback effect : Strong : %s\n",cmd.strong?"start":"stop");}
+#if IS_ENABLED(CONFIG_MK_FF_PWM)
+        if(pca9633_client!=NULL&&ff_strong_pwm!=-1){ //pwm
+            ff_strong_pwm_value=cmd.strong_pwm;
+            ff_strong_pwm_sent=false;
+        }
+#endif
+#if IS_ENABLED(CONFIG_MK_FF_GPIO)
+        if(ff_gpio_strong_pin!=-1){ //gpio
+            if(cmd.strong&&!ff_effect_strong_reverse){GpioOuputSet(ff_gpio_strong_pin); //set high
+            }else{GpioOuputClr(ff_gpio_strong_pin);} //reverse logic or stop, set low
+        }
+#endif
+        
+        if(cmd.weak!=-1){
+            if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Feedback effect : Weak : %s\n",cmd.weak?"start":"stop");}
+#if IS_ENABLED(CONFIG_MK_FF_PWM)
+            if(pca9633_client!=NULL&&ff_weak_pwm!=-1){ //pwm
+                ff_weak_pwm_value=cmd.weak_pwm;
+                ff_weak_pwm_sent=false;
+            }
+#endif
+#if IS_ENABLED(CONFIG_MK_FF_GPIO)
+            if(ff_gpio_weak_pin!=-1){ //gpio
+                if(cmd.weak&&!ff_effect_weak_reverse){GpioOuputSet(ff_gpio_weak_pin); //set high
+                }else{GpioOuputClr(ff_gpio_weak_pin);} //reverse logic or stop, set low
+            }
+#endif
+        }
+        
+#if IS_ENABLED(CONFIG_MK_FF_GPIO)
+        if(ff_dir_enable){ //direction is set for both strong and week motor at the same time
+            ff_effect_dir=effect->direction;
+            if(!cmd.dir){ //down
+                if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Feedback effect : Direction : Down (%d)\n",ff_effect_dir);}
+                if(ff_gpio_dir_reverse){GpioOuputSet(ff_gpio_dir_pin); //reverse logic, set high
+                }else{GpioOuputClr(ff_gpio_dir_pin);} //set low
+            }else{ //up
+                if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Feedback effect : Direction : Up (%d)\n",ff_effect_dir);}
+                if(ff_gpio_dir_reverse){GpioOuputClr(ff_gpio_dir_pin); //reverse logic, set low
+                }else{GpioOuputSet(ff_gpio_dir_pin);} //set high
+            }
+        }
+#endif
+        return 1;
+    }
+}
+#endif
+
+
+static void mk_work_handler(struct work_struct* work){
+    struct mk *mk = g_mk;
+    mk_process_packet(mk);
+    mk_poll_update();
+    if(READ_ONCE(poll_running)){schedule_delayed_work(&mk_delayed_work, poll_refresh_time);} //mk_poll_stop may be cancelling
+}
+
+
+static int mk_open(struct input_dev *dev){
+    struct mk *mk = input_get_drvdata(dev);
+    int err;
+    
+    err = mutex_lock_interruptible(&mk->mutex);
+    if(err){return err;}
+    if(!mk->used){
+        err = pm_runtime_resume_and_get(&mk_pdev->dev); //wake chips if autosuspended
+        if(err){mutex_unlock(&mk->mutex); return err;}
+        mk_poll_start(); //always start at full rate
+    }
+    mk->used++;
+    mutex_unlock(&mk->mutex);
+    return 0;
+}
+
+
+static void mk_close(struct input_dev *dev){
+    struct mk *mk = input_get_drvdata(dev);
+    
+    mutex_lock(&mk->mutex);
+    if(!--mk->used){
+        mk_poll_stop();
+        pm_runtime_mark_last_busy(&mk_pdev->dev);
+        pm_runtime_put_autosuspend(&mk_pdev->dev); //autosuspend chips once nobody listen
+    }
+    mutex_unlock(&mk->mutex);
+}
+
+
+static void mk_ff_off(void){ //stop all force feedback outputs
+#if IS_ENABLED(CONFIG_MK_FF_GPIO)
+    if(ff_enable){
+        if(ff_gpio_strong_pin!=-1){ //gpio strong
+            if(ff_effect_strong_reverse){GpioOuputSet(ff_gpio_strong_pin); //reverse logic, set high
+            }else{GpioOuputClr(ff_gpio_strong_pin);} //set low
+        }
+        if(ff_gpio_weak_pin!=-1){ //gpio weak
+            if(ff_effect_weak_reverse){GpioOuputSet(ff_gpio_weak_pin); //reverse logic, set high
+            }else{GpioOuputClr(ff_gpio_weak_pin);} //set low
+        }
+    }
+    
+    if(ff_dir_enable){
+        if(ff_gpio_dir_pin!=-1){ //gpio dir
+            if(ff_gpio_dir_reverse){GpioOuputSet(ff_gpio_dir_pin); //reverse logic, set high
+            }else{GpioOuputClr(ff_gpio_dir_pin);} //set low
+        }
+    }
+#endif
+    
+#if IS_ENABLED(CONFIG_MK_FF_PWM)
+    if(ff_pwm_enable && pca9633_client != NULL){
+        if(ff_strong_pwm!=-1){ //pwm strong
+            if(ff_strong_pwm_reverse){i2c_smbus_write_byte_data(pca9633_client,(uint8_t)(ff_strong_pwm+2),(uint8_t)0xFF); //send pwm to i2c, reverse logic, set 0xFF
+            }else{i2c_smbus_write_byte_data(pca9633_client,(uint8_t)(ff_strong_pwm+2),(uint8_t)0x00);} //send pwm to i2c, set 0x00
+        }
+        if(ff_weak_pwm!=-1){ //pwm weak
+            if(ff_weak_pwm_reverse){i2c_smbus_write_byte_data(pca9633_client,(uint8_t)(ff_weak_pwm+2),(uint8_t)0xFF); //send pwm to i2c, reverse logic, set 0xFF
+            }else{i2c_smbus_write_byte_data(pca9633_client,(uint8_t)(ff_weak_pwm+2),(uint8_t)0x00);} //send pwm to i2c, set 0x00
+        }
+    }
+    
+    ff_strong_pwm_sent=true; ff_weak_pwm_sent=true; //nothing pending
+#endif
+    
+#if IS_ENABLED(CONFIG_MK_FF_GPIO) || IS_ENABLED(CONFIG_MK_FF_PWM)
+    ff_state.strong_running=false; ff_state.weak_running=false; //reset
+#endif
+}
+
+
+static void mk_adc_suspend(void){ //converters to their lowest power state, polling stopped
+    int i;
+    
+#if IS_ENABLED(CONFIG_MK_ADC_ADS1X15)
+    if(ads_rest_adc && ((struct mk_ads1x15_priv *)ads_rest_adc->priv)->resting){ //no continuous conversions while suspended
+        mk_ads1x15_wake(ads_rest_adc);
+        ads_rest_since = jiffies;
+    }
+#endif
+    for(i=0;i<mk_adc_count;i++){
+#if IS_ENABLED(CONFIG_MK_ADC_ADS1X15)
+        if(mk_adcs[i].ops == &mk_adc_ads1015_ops || mk_adcs[i].ops == &mk_adc_ads1115_ops){ //single shot without start, powered down once a pending conversion ends
+            mk_i2c_write_word(mk_adcs[i].client, 0x01, MK_ADS1X15_CONFIG & ~0x8000);
+        }
+#endif
+#if IS_ENABLED(CONFIG_MK_ADC_ADS7830)
+        if(mk_adcs[i].ops == &mk_adc_ads7830_ops){mk_i2c_read_byte(mk_adcs[i].client, 0x80);} //PD 00, converter off after this conversion, next poll command powers it again
+#endif
+    }
+    //MCP3x08 stays in standby while its chip select is released, every spi message ends released
+#if IS_ENABLED(CONFIG_MK_ADC_IIO) && IS_ENABLED(CONFIG_IIO_BUFFER_CB)
+    if(iioadc_buffered){iio_channel_stop_all_cb(iioadc_buffer);} //no trigger, the iio driver can suspend its chip
+#endif
+}
+
+
+static void mk_adc_resume(void){ //i2c and spi converters power up on their next conversion
+#if IS_ENABLED(CONFIG_MK_ADC_IIO) && IS_ENABLED(CONFIG_IIO_BUFFER_CB)
+    if(iioadc_buffered && iio_channel_start_all_cb(iioadc_buffer)){
+        printk("mk_arcade_joystick_rpi: IIO ADC : buffered capture not restarted, reading on demand\n");
+        iioadc_buffered = false;
+    }
+#endif
+}
+
+
+static void mk_hw_suspend(void){ //stop rumble and power down chips
+    if(pm_hw_suspended){return;}
+    mk_ff_off();
+    mk_adc_suspend();
+#if IS_ENABLED(CONFIG_MK_FF_PWM)
+    if(ff_pwm_enable && pca9633_client != NULL){
+        pca9633_mode1=i2c_smbus_read_byte_data(pca9633_client,(uint8_t)0x00); //backup MODE1 register
+        if(pca9633_mode1>=0){i2c_smbus_write_byte_data(pca9633_client,(uint8_t)0x00,(uint8_t)(pca9633_mode1|0x10));} //SLEEP bit, oscillator off
+    }
+#endif
+    pm_hw_suspended=true;
+}
+
+
+static void mk_hw_resume(void){ //power up chips and restore their state
+    if(!pm_hw_suspended){return;}
+#if IS_ENABLED(CONFIG_MK_FF_PWM)
+    if(ff_pwm_enable && pca9633_client != NULL){
+        if(pca9633_mode1>=0){
+            i2c_smbus_write_byte_data(pca9633_client,(uint8_t)0x00,(uint8_t)pca9633_mode1); //restore MODE1 register
+            udelay(500); //oscillator need 500us to be up
+        }
+        i2c_smbus_write_byte_data(pca9633_client,(uint8_t)0x08,(uint8_t)pca9633_ledout); //restore LEDOUT register
+    }
+#endif
+    mk_ff_off(); //pwm registers may be lost if chip lost power
+    mk_adc_resume();
+    pm_hw_suspended=false;
+}
+
+
+static int mk_runtime_suspend(struct device *dev){ //no input client left
+    mk_hw_suspend();
+    pm_runtime_suspend_count++;
+    return 0;
+}
+
+
+static int mk_runtime_resume(struct device *dev){ //first input client opened
+    mk_hw_resume();
+    return 0;
+}
+
+
+static int mk_suspend(struct device *dev){ //system suspend
+    int i;
+    
+    mutex_lock(&g_mk->mutex);
+    if(g_mk->used){mk_poll_stop();}
+    mk_hw_suspend();
+    mutex_unlock(&g_mk->mutex);
+    
+    if(device_may_wakeup(dev)){
+        for(i=0;i<wake_irq_count;i++){
+            if(wake_irq_system[i]){enable_irq_wake(wake_irq[i]);}
+        }
+    }
+    pm_suspend_count++;
+    return 0;
+}
+
+
+static int mk_resume(struct device *dev){ //system resume
+    int i;
+    
+    if(device_may_wakeup(dev)){
+        for(i=0;i<wake_irq_count;i++){
+            if(wake_irq_system[i]){disable_irq_wake(wake_irq[i]);}
+        }
+    }
+    
+    mutex_lock(&g_mk->mutex);
+    if(!pm_runtime_status_suspended(dev)){mk_hw_resume();} //chips back to the runtime state they were suspended from, autosuspended ones wait for the next open
+    if(g_mk->used){ //restart polling if someone listen, calibration is kept as is
+        pm_resume_time=ktime_get();
+        pm_resume_pending=true;
+        mk_poll_start();
+    }
+    mutex_unlock(&g_mk->mutex);
+    return 0;
+}
+
+
+static const struct dev_pm_ops mk_pm_ops = {
+    SET_SYSTEM_SLEEP_PM_OPS(mk_suspend, mk_resume)
+    SET_RUNTIME_PM_OPS(mk_runtime_suspend, mk_runtime_resume, NULL)
+};
+
+static struct platform_driver mk_platform_driver = {
+    .driver = {
+        .name = "mk_arcade_joystick_rpi",
+        .pm = &mk_pm_ops,
+    },
+};
+
+
+static int mk_pin_to_irq(int pin, struct gpio_descs **descs){ //irq of a BCM pin, descs set if a line had to be requested for it
+    unsigned long flags = GPIO_ACTIVE_HIGH;
+    int i, j, err;
+    
+    *descs = NULL;
+    if(gpio_backend==GPIO_BACKEND_INJECT){return -ENODEV;} //no pins
+    if(gpio_backend==GPIO_BACKEND_GPIOLIB){ //use the already requested button line
+        for(i=0;i<MK_MAX_DEVICES;i++){
+            struct mk_pad *pad = &g_mk->pads[i];
+            if(!pad->gpiods){continue;}
+            for(j=0;j<pad->gpiods->ndescs;j++){
+                if(abs(pad->gpio_maps[pad->gpiod_map[j]])==pin){return gpiod_to_irq(pad->gpiods->desc[j]);}
+            }
+        }
+    }
+    *descs = mk_gpiod_get_array("wake", &pin, &flags, 1, GPIOD_ASIS); //chip found by label, whatever number gpiolib gave to GPIO0
+    if(IS_ERR(*descs)){err = PTR_ERR(*descs); *descs = NULL; return err;}
+    return gpiod_to_irq((*descs)->desc[0]);
+}
+
+
+static int mk_wake_pin_add(int pin, bool system_wake){ //request interrupt for a wake pin
+    struct gpio_descs *descs;
+    int i, irq, err;
+    
+    for(i=0;i<wake_irq_count;i++){ //pin already used, hotkey can be used for both
+        if(wake_pin[i]==pin){wake_irq_system[i]|=system_wake; return 0;}
+    }
+    if(wake_irq_count>=MK_WAKE_MAX){return -ENOSPC;}
+    
+    irq=mk_pin_to_irq(pin, &descs);
+    if(irq<0){
+        printk("mk_arcade_joystick_rpi: No irq for wake pin %d : %d\n", pin, irq);
+        if(descs){gpiod_put_array(descs);}
+        return irq;
+    }
+    err=request_irq(irq, mk_wake_irq, IRQF_TRIGGER_RISING|IRQF_TRIGGER_FALLING, "mk_arcade_joystick_rpi", mk_pdev);
+    if(err){
+        printk("mk_arcade_joystick_rpi: Failed to request irq %d for wake pin %d : %d\n", irq, pin, err);
+        if(descs){gpiod_put_array(descs);}
+        return err;
+    }
+    wake_pin[wake_irq_count]=pin;
+    wake_descs[wake_irq_count]=descs;
+    wake_irq[wake_irq_count]=irq;
+    wake_irq_system[wake_irq_count]=system_wake;
+    wake_irq_count++;
+    printk("mk_arcade_joystick_rpi: Wake pin %d (irq %d)%s\n", pin, irq, system_wake?" : system wake source":"");
+    return 0;
+}
+
+
+static int mk_pm_stats_show(struct seq_file *s, void *unused){ //power management statistics, debugfs
+    seq_printf(s, "runtime_status: %s\n", pm_hw_suspended?"suspended":"active");
+    seq_printf(s, "runtime_suspend_count: %u\n", pm_runtime_suspend_count);
+    seq_printf(s, "suspend_count: %u\n", pm_suspend_count);
+    seq_printf(s, "resume_latency_us: %lld\n", pm_resume_latency_us);
+    seq_printf(s, "wake_irqs: %d\n", wake_irq_count);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mk_pm_stats);
+
+
+static int mk_poll_stats_show(struct seq_file *s, void *unused){ //adaptive polling statistics, debugfs
+    u64 time_full=poll_time_full, time_idle=poll_time_idle;
+    if(poll_running){ //add current period
+        if(poll_idle){time_idle+=jiffies-poll_mode_start;}else{time_full+=jiffies-poll_mode_start;}
+    }
+    seq_printf(s, "rate_hz: %lu\n", poll_running?HZ/poll_refresh_time:0);
+    seq_printf(s, "mode: %s\n", !poll_running?"stopped":(poll_idle?"idle":"full"));
+    seq_printf(s, "time_full_ms: %u\n", jiffies_to_msecs(time_full));
+    seq_printf(s, "time_idle_ms: %u\n", jiffies_to_msecs(time_idle));
+    seq_printf(s, "mode_switches: %u\n", poll_mode_switches);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mk_poll_stats);
+
+
+static int mk_filter_stats_show(struct seq_file *s, void *unused){ //analog pre-filter and smoothing settings, latency and rejected outliers, debugfs
+    static const char *names[] = {"x1", "y1", "x2", "y2"};
+    unsigned long poll_us = jiffies_to_usecs(READ_ONCE(poll_refresh_time)); //current polling period
+    int i;
+    for(i=0;i<MK_ADC_MAX_AXES;i++){
+        int delay = adc_filters[i].median > 1 ? (adc_filters[i].median - 1) / 2 : 0; //polls a step is held back
+        seq_printf(s, "%s: median %d, oversample %d, delay_polls %d, delay_us %lu, rejected %u\n", names[i], max(adc_filters[i].median, 1), max(adc_oversample[i], 1), delay, delay * poll_us, adc_filters[i].rejected);
+        if(adc_smooth[i].mincutoff > 0){seq_printf(s, "%s: smooth %d,%d,%d, speed %d codes/s\n", names[i], adc_smooth[i].mincutoff, adc_smooth[i].beta, adc_smooth[i].dcutoff, READ_ONCE(adc_smooth[i].dx));}
+    }
+    seq_printf(s, "conversion_wait_us: %u\n", READ_ONCE(adc_wait_us)); //last poll, oversampling bursts included
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mk_filter_stats);
+
+
+static ssize_t mk_curve_read(struct file *filp, struct kobject *kobj, struct bin_attribute *attr, char *buf, loff_t off, size_t count){ //response curve of the edited profile: control points, little endian 16bits
+    int axis = (long)attr->private;
+    uint8_t data[MK_CURVE_POINTS * 2];
+    struct mk_curve *curve;
+    int i;
+    
+    if(off >= sizeof(data)){return 0;}
+    if(count > sizeof(data) - off){count = sizeof(data) - off;}
+    mutex_lock(&mk_profile_mutex);
+    curve = &mk_profiles[mk_profile_edit].curves[axis];
+    for(i = 0; i < MK_CURVE_POINTS; i++){data[2*i] = curve->points[i] & 0xFF; data[2*i+1] = curve->points[i] >> 8;}
+    mutex_unlock(&mk_profile_mutex);
+    memcpy(buf, data + off, count);
+    return count;
+}
+
+
+static ssize_t mk_curve_write(struct file *filp, struct kobject *kobj, struct bin_attribute *attr, char *buf, loff_t off, size_t count){ //response curve: all control points in one write, expanded with the calibration of the axis in the edited profile
+    int axis = (long)attr->private;
+    uint16_t points[MK_CURVE_POINTS], linear[MK_CURVE_POINTS];
+    int16_t *table = NULL, *old;
+    struct mk_profile *prof;
+    int i;
+    
+    if(off != 0 || count != MK_CURVE_POINTS * 2){return -EINVAL;}
+    for(i = 0; i < MK_CURVE_POINTS; i++){points[i] = (uint8_t)buf[2*i] | ((uint8_t)buf[2*i+1] << 8);}
+    if(mk_curve_check(points)){return -EINVAL;}
+    mk_curve_linear(linear);
+    if(memcmp(points, linear, sizeof(points))){ //linear curve is the plain calibration, no table
+        table = kmalloc(MK_CURVE_SIZE * sizeof(int16_t), GFP_KERNEL);
+        if(!table){return -ENOMEM;}
+    }
+    
+    mutex_lock(&mk_profile_mutex);
+    prof = &mk_profiles[mk_profile_edit];
+    if(table){mk_curve_build(points, table, &prof->params[axis], prof->offset[axis]);}
+    memcpy(prof->curves[axis].points, points, sizeof(points));
+    old = rcu_replace_pointer(prof->curves[axis].table, table, lockdep_is_held(&mk_profile_mutex));
+    mutex_unlock(&mk_profile_mutex);
+    synchronize_rcu(); //polling done with the old table
+    kfree(old);
+    if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : %s curve for axis %d\n", table ? "new" : "linear", axis);}
+    return count;
+}
+
+static ssize_t turbo_show(struct device *dev, struct device_attribute *attr, char *buf){ //turbo buttons of the edited profile: name, rate, duty, enabled
+    uint32_t period[MK_MAX_BUTTONS], on[MK_MAX_BUTTONS];
+    unsigned long flags, off = 0;
+    struct mk_profile *prof;
+    int j, len = 0;
+    
+    mutex_lock(&mk_profile_mutex);
+    prof = &mk_profiles[mk_profile_edit];
+    spin_lock_irqsave(&mk_turbo_lock, flags);
+    memcpy(period, prof->turbo_period_ns, sizeof(period));
+    memcpy(on, prof->turbo_on_ns, sizeof(on));
+    if(prof == rcu_access_pointer(mk_profile)){off = hk_state.turbo_off;} //toggled by combos in the active profile only
+    spin_unlock_irqrestore(&mk_turbo_lock, flags);
+    mutex_unlock(&mk_profile_mutex);
+    for(j = 4; j < MK_MAX_BUTTONS; j++){
+        if(!period[j]){continue;}
+        len += sysfs_emit_at(buf, len, "%s %u %u %s\n", mk_arcade_gpio_btn_names[j - 4], (uint32_t)(NSEC_PER_SEC / period[j]), on[j] / (period[j] / 100), (off & BIT(j)) ? "off" : "on");
+    }
+    return len;
+}
+
+
+static ssize_t turbo_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count){ //"<BTN_*> <Hz> [<duty %>]", 0 Hz removes the turbo
+    char name[16];
+    unsigned int rate, duty = 50;
+    unsigned long flags;
+    struct mk_profile *prof;
+    int j, n;
+    
+    n = sscanf(buf, "%15s %u %u", name, &rate, &duty);
+    if(n < 2 || rate > MK_TURBO_MAX_RATE || duty < 1 || duty > 99){return -EINVAL;}
+    for(j = 4; j < MK_MAX_BUTTONS && strcmp(name, mk_arcade_gpio_btn_names[j - 4]); j++){}
+    if(j == MK_MAX_BUTTONS || j == HOTKEY_BUTTON){return -EINVAL;}
+    
+    mutex_lock(&mk_profile_mutex);
+    prof = &mk_profiles[mk_profile_edit];
+    spin_lock_irqsave(&mk_turbo_lock, flags);
+    prof->turbo_period_ns[j] = rate ? NSEC_PER_SEC / rate : 0;
+    prof->turbo_on_ns[j] = rate ? prof->turbo_period_ns[j] / 100 * duty : 0;
+    if(prof == rcu_access_pointer(mk_profile)){ //armed now
+        if(rate){hk_state.turbo_armed |= BIT(j);}else{hk_state.turbo_armed &= ~BIT(j);}
+    }
+    spin_unlock_irqrestore(&mk_turbo_lock, flags);
+    mutex_unlock(&mk_profile_mutex);
+    if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : turbo %s %u Hz %u%%\n", name, rate, duty);}
+    return count;
+}
+static DEVICE_ATTR_RW(turbo);
+
+
+static const char *mk_button_name(int j){return j < 4 ? mk_arcade_dpad_names[j] : mk_arcade_gpio_btn_names[j - 4];} //data[] index to sysfs name
+
+
+static int mk_button_lookup(const char *name){ //sysfs name to data[] index, -1 if unknown
+    int j;
+    for(j = 0; j < MK_MAX_BUTTONS; j++){if(!strcmp(name, mk_button_name(j))){return j;}}
+    return -1;
+}
+
+
+static bool mk_combo_code_valid(unsigned int code){ //key declared by the hotkeys device or profile switch
+    if(code >= MK_COMBO_PROFILE){return code < MK_COMBO_PROFILE + MK_MAX_PROFILES;}
+    return code > 0 && code <= KEY_MAX && (!mk_combo_dev || test_bit(code, mk_combo_dev->keybit));
+}
+
+
+static ssize_t combos_show(struct device *dev, struct device_attribute *attr, char *buf){ //hotkey actions of the edited profile: button, key code, hold msec
+    struct mk_combo combos[MK_MAX_COMBOS];
+    unsigned long flags;
+    struct mk_profile *prof;
+    int i, count, len = 0;
+    
+    mutex_lock(&mk_profile_mutex);
+    prof = &mk_profiles[mk_profile_edit];
+    spin_lock_irqsave(&mk_turbo_lock, flags);
+    count = prof->combo_count;
+    memcpy(combos, prof->combos, sizeof(combos));
+    spin_unlock_irqrestore(&mk_turbo_lock, flags);
+    mutex_unlock(&mk_profile_mutex);
+    for(i = 0; i < count; i++){len += sysfs_emit_at(buf, len, "%s %u %u\n", mk_button_name(combos[i].btn), combos[i].code, combos[i].hold_ms);}
+    return len;
+}
+
+
+static ssize_t combos_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count){ //"<button> <key code> [<hold msec>]", code 0 removes the combo
+    char name[16];
+    unsigned int code, hold = 0;
+    unsigned long flags;
+    struct mk_profile *prof;
+    int i, j, n, err = 0;
+    
+    n = sscanf(buf, "%15s %u %u", name, &code, &hold);
+    j = n >= 2 ? mk_button_lookup(name) : -1;
+    if(j < 0 || hold > MK_COMBO_MAX_HOLD || (!hold && j == HOTKEY_BUTTON)){return -EINVAL;}
+    if(code && !mk_combo_code_valid(code)){return -EINVAL;}
+    
+    mutex_lock(&mk_profile_mutex);
+    prof = &mk_profiles[mk_profile_edit];
+    spin_lock_irqsave(&mk_turbo_lock, flags);
+    for(i = 0; i < prof->combo_count && (prof->combos[i].btn != j || !prof->combos[i].hold_ms != !hold); i++){} //same button and kind
+    if(code){
+        if(i == MK_MAX_COMBOS){err = -ENOSPC;
+        }else{
+            prof->combos[i] = (struct mk_combo){j, hold, code};
+            if(i == prof->combo_count){prof->combo_count++;}
+        }
+    }else if(i < prof->combo_count){prof->combos[i] = prof->combos[--prof->combo_count];}
+    if(prof == rcu_access_pointer(mk_profile)){
+        hk_state.action_armed = mk_combo_armed(prof->combos, prof->combo_count);
+        for(i = 0; i < MK_MAX_DEVICES; i++){mk_base->pads[i].combo = (struct mk_combo_state){mk_base->pads[i].pressed, -1, 0, -1};} //indexes changed, held key released next poll
+    }
+    spin_unlock_irqrestore(&mk_turbo_lock, flags);
+    mutex_unlock(&mk_profile_mutex);
+    if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Hotkey action %s %u %u ms\n", name, code, hold);}
+    return err ? err : count;
+}
+static DEVICE_ATTR_RW(combos);
+
+
+static int __init mk_combo_init(void){ //hotkeys input device, combos of the combo parameter in the default profile
+    struct mk_profile *prof = &mk_profiles[0];
+    struct input_dev *dev;
+    unsigned long flags;
+    int i, err;
+    
+    for(i = 0; i + 2 < combo_cfg.nargs && prof->combo_count < MK_MAX_COMBOS; i += 3){
+        int btn = combo_cfg.params[i], code = combo_cfg.params[i+1], hold = combo_cfg.params[i+2];
+        if(btn < 0 || btn >= MK_MAX_BUTTONS || !mk_combo_code_valid(code) || hold < 0 || hold > MK_COMBO_MAX_HOLD || (!hold && btn == HOTKEY_BUTTON)){
+            printk("mk_arcade_joystick_rpi: Hotkey actions : invalid combo %d,%d,%d\n", btn, code, hold);
+            continue;
+        }
+        prof->combos[prof->combo_count++] = (struct mk_combo){btn, hold, code};
+        if(hold){printk("mk_arcade_joystick_rpi: Hotkey actions : %s held %d ms : key %d\n", mk_button_name(btn), hold, code);
+        }else{printk("mk_arcade_joystick_rpi: Hotkey actions : hotkey + %s : key %d\n", mk_button_name(btn), code);}
+    }
+    
+    dev = input_allocate_device();
+    if(!dev){return -ENOMEM;}
+    dev->name = "GPIO Controller Hotkeys";
+    dev->phys = "input/hotkeys";
+    dev->id.bustype = BUS_PARPORT;
+    dev->id.vendor = 0x0001;
+    dev->id.product = MK_MAX;
+    dev->id.version = 0x0100;
+    dev->dev.parent = &mk_pdev->dev;
+    input_set_drvdata(dev, mk_base);
+    dev->open = mk_open; //a daemon listening only to actions keeps polling running
+    dev->close = mk_close;
+    dev->evbit[0] = BIT_MASK(EV_KEY);
+    for(i = 0; i < ARRAY_SIZE(mk_combo_keys); i++){__set_bit(mk_combo_keys[i], dev->keybit);}
+    for(i = 0; i < prof->combo_count; i++){if(prof->combos[i].code <= KEY_MAX){__set_bit(prof->combos[i].code, dev->keybit);}}
+    
+    err = input_register_device(dev);
+    if(err){input_free_device(dev); return err;}
+    spin_lock_irqsave(&mk_turbo_lock, flags);
+    hk_state.action_armed = mk_combo_armed(prof->combos, prof->combo_count);
+    mk_combo_dev = dev;
+    spin_unlock_irqrestore(&mk_turbo_lock, flags);
+    static_branch_enable(&mk_combo_key);
+    if(device_create_file(&mk_pdev->dev, &dev_attr_combos)){printk("mk_arcade_joystick_rpi: Hotkey actions : sysfs failed\n");}
+    return 0;
+}
+
+
+static int mk_profile_lookup(const char *name){ //profile number or name to index, -1 if unknown, mk_profile_mutex held
+    int i;
+    if(!kstrtoint(name, 0, &i)){return i >= 0 && i < MK_MAX_PROFILES ? i : -1;}
+    for(i = 0; i < MK_MAX_PROFILES; i++){if(mk_profiles[i].name[0] && !strcmp(name, mk_profiles[i].name)){return i;}}
+    return -1;
+}
+
+
+static ssize_t profile_show(struct device *dev, struct device_attribute *attr, char *buf){ //profiles: number, name, active and edited marks
+    struct mk_profile *active;
+    int i, len = 0;
+    
+    mutex_lock(&mk_profile_mutex);
+    active = rcu_access_pointer(mk_profile);
+    for(i = 0; i < MK_MAX_PROFILES; i++){
+        if(!mk_profiles[i].name[0]){continue;}
+        len += sysfs_emit_at(buf, len, "%d %s%s%s\n", i, mk_profiles[i].name, &mk_profiles[i] == active ? " active" : "", i == mk_profile_edit ? " edit" : "");
+    }
+    mutex_unlock(&mk_profile_mutex);
+    return len;
+}
+
+
+static ssize_t profile_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count){ //"<number|name>", switch the active profile
+    char name[16];
+    unsigned long flags;
+    int i;
+    
+    if(sscanf(buf, "%15s", name) != 1){return -EINVAL;}
+    mutex_lock(&mk_profile_mutex);
+    i = mk_profile_lookup(name);
+    if(i < 0 || !mk_profiles[i].name[0]){mutex_unlock(&mk_profile_mutex); return -EINVAL;}
+    spin_lock_irqsave(&mk_turbo_lock, flags);
+    mk_profile_set(&mk_profiles[i]);
+    spin_unlock_irqrestore(&mk_turbo_lock, flags);
+    mutex_unlock(&mk_profile_mutex);
+    return count;
+}
+static DEVICE_ATTR_RW(profile);
+
+
+static ssize_t profile_edit_show(struct device *dev, struct device_attribute *attr, char *buf){
+    int len;
+    mutex_lock(&mk_profile_mutex);
+    len = sysfs_emit(buf, "%d %s\n", mk_profile_edit, mk_profiles[mk_profile_edit].name);
+    mutex_unlock(&mk_profile_mutex);
+    return len;
+}
+
+
+static ssize_t profile_edit_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count){ //"<number> [<name>]", an unused profile starts as a copy of the active one
+    char name[16] = "";
+    struct mk_profile *prof, *src;
+    unsigned long flags;
+    int i, n, axis, err = 0;
+    
+    if(sscanf(buf, "%d %15s", &n, name) < 1 || n < 0 || n >= MK_MAX_PROFILES){return -EINVAL;}
+    mutex_lock(&mk_profile_mutex);
+    prof = &mk_profiles[n];
+    if(!prof->name[0]){ //new profile, not switchable until named
+        src = rcu_dereference_protected(mk_profile, lockdep_is_held(&mk_profile_mutex));
+        spin_lock_irqsave(&mk_turbo_lock, flags);
+        *prof = *src;
+        prof->name[0] = 0;
+        spin_unlock_irqrestore(&mk_turbo_lock, flags);
+        for(axis = 0; axis < MK_ADC_MAX_AXES; axis++){ //own copy of the tables
+            int16_t *table = rcu_dereference_protected(src->curves[axis].table, lockdep_is_held(&mk_profile_mutex));
+            if(table){
+                table = kmemdup(table, MK_CURVE_SIZE * sizeof(int16_t), GFP_KERNEL);
+                if(!table){mk_curve_linear(prof->curves[axis].points); err = -ENOMEM;}
+            }
+            RCU_INIT_POINTER(prof->curves[axis].table, table);
+        }
+        if(!name[0]){snprintf(name, sizeof(name), "profile%d", n);}
+    }
+    if(name[0]){ //rename
+        for(i = 0; i < MK_MAX_PROFILES; i++){if(i != n && !strcmp(name, mk_profiles[i].name)){err = -EEXIST;}}
+        if(err != -EEXIST){
+            spin_lock_irqsave(&mk_turbo_lock, flags);
+            strscpy(prof->name, name, sizeof(prof->name));
+            spin_unlock_irqrestore(&mk_turbo_lock, flags);
+        }
+    }
+    if(prof->name[0]){mk_profile_edit = n;}
+    mutex_unlock(&mk_profile_mutex);
+    if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Profile %d %s edited\n", n, prof->name);}
+    return err ? err : count;
+}
+static DEVICE_ATTR_RW(profile_edit);
+
+
+static ssize_t keymap_show(struct device *dev, struct device_attribute *attr, char *buf){ //buttons of the edited profile: button, key reported
+    short keys[MK_MAX_BUTTONS - 4];
+    int i, k, len = 0;
+    
+    mutex_lock(&mk_profile_mutex);
+    memcpy(keys, mk_profiles[mk_profile_edit].keys, sizeof(keys));
+    mutex_unlock(&mk_profile_mutex);
+    for(i = 0; i < MK_MAX_BUTTONS - 4; i++){
+        for(k = 0; k < MK_MAX_BUTTONS - 4 && mk_arcade_gpio_btn[k] != keys[i]; k++){}
+        len += sysfs_emit_at(buf, len, "%s %s\n", mk_arcade_gpio_btn_names[i], mk_arcade_gpio_btn_names[k]);
+    }
+    return len;
+}
+
+
+static ssize_t keymap_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count){ //"<BTN_* button> <BTN_* key>", key must be declared by the pads
+    char name[16], key[16];
+    short keys[MK_MAX_BUTTONS - 4];
+    struct mk_profile *prof;
+    unsigned long flags;
+    int i, j, k;
+    
+    if(sscanf(buf, "%15s %15s", name, key) != 2){return -EINVAL;}
+    for(j = 0; j < MK_MAX_BUTTONS - 4 && strcmp(name, mk_arcade_gpio_btn_names[j]); j++){}
+    for(k = 0; k < MK_MAX_BUTTONS - 4 && strcmp(key, mk_arcade_gpio_btn_names[k]); k++){}
+    if(j == MK_MAX_BUTTONS - 4 || k == MK_MAX_BUTTONS - 4){return -EINVAL;}
+    for(i = 0; i < MK_MAX_DEVICES; i++){ //input devices are not re-created, their key set is fixed
+        if(mk_base->pads[i].dev && !test_bit(mk_arcade_gpio_btn[k], mk_base->pads[i].dev->keybit)){return -EINVAL;}
+    }
+    
+    mutex_lock(&mk_profile_mutex);
+    prof = &mk_profiles[mk_profile_edit];
+    spin_lock_irqsave(&mk_turbo_lock, flags);
+    memcpy(keys, prof->keys, sizeof(keys));
+    prof->keys[j] = mk_arcade_gpio_btn[k];
+    if(prof == rcu_access_pointer(mk_profile)){mk_keys_release(keys, prof->keys);}
+    spin_unlock_irqrestore(&mk_turbo_lock, flags);
+    mutex_unlock(&mk_profile_mutex);
+    return count;
+}
+static DEVICE_ATTR_RW(keymap);
+
+
+static ssize_t absparams_show(struct device *dev, struct device_attribute *attr, char *buf){ //calibration of the edited profile: axis, min, max, flat
+    struct analog_abs_params_struct params[MK_ADC_MAX_AXES];
+    bool enabled[] = {x1_enable, y1_enable, x2_enable, y2_enable};
+    int i, len = 0;
+    
+    mutex_lock(&mk_profile_mutex);
+    memcpy(params, mk_profiles[mk_profile_edit].params, sizeof(params));
+    mutex_unlock(&mk_profile_mutex);
+    for(i = 0; i < MK_ADC_MAX_AXES; i++){
+        if(enabled[i]){len += sysfs_emit_at(buf, len, "%s %d %d %d\n", mk_axis_names[i], params[i].min, params[i].max, params[i].flat);}
+    }
+    return len;
+}
+
+
+static ssize_t absparams_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count){ //"<axis> <min> <max> <flat>", curve table rebuilt with it
+    char name[16];
+    int axis, min, max, flat;
+    struct analog_abs_params_struct params;
+    struct mk_profile *prof;
+    int16_t *table = NULL, *old = NULL, offset;
+    unsigned long flags;
+    
+    if(sscanf(buf, "%15s %d %d %d", name, &min, &max, &flat) != 4){return -EINVAL;}
+    for(axis = 0; axis < MK_ADC_MAX_AXES && strcmp(name, mk_axis_names[axis]); axis++){}
+    if(axis == MK_ADC_MAX_AXES || min < 0 || max > 4095 || min >= max || flat < 0 || flat > 2047){return -EINVAL;}
+    
+    mutex_lock(&mk_profile_mutex);
+    prof = &mk_profiles[mk_profile_edit];
+    if(rcu_access_pointer(prof->curves[axis].table)){ //curve expanded with the calibration
+        table = kmalloc(MK_CURVE_SIZE * sizeof(int16_t), GFP_KERNEL);
+        if(!table){mutex_unlock(&mk_profile_mutex); return -ENOMEM;}
+    }
+    params = (struct analog_abs_params_struct){min, max, prof->params[axis].fuzz, flat};
+    offset = auto_center ? prof->offset[axis] : ((max - min) / 2 + min) - 2047; //same as the xNparams center
+    if(table){mk_curve_build(prof->curves[axis].points, table, &params, offset);}
+    spin_lock_irqsave(&mk_turbo_lock, flags); //polling reads the axis in one piece
+    prof->params[axis] = params;
+    prof->offset[axis] = offset;
+    if(table){old = rcu_replace_pointer(prof->curves[axis].table, table, lockdep_is_held(&mk_profile_mutex));}
+    spin_unlock_irqrestore(&mk_turbo_lock, flags);
+    mutex_unlock(&mk_profile_mutex);
+    if(old){synchronize_rcu(); kfree(old);} //polling done with the old table
+    return count;
+}
+static DEVICE_ATTR_RW(absparams);
+
+
+static struct attribute *mk_profile_attrs[] = {&dev_attr_profile.attr, &dev_attr_profile_edit.attr, &dev_attr_keymap.attr, &dev_attr_absparams.attr, NULL};
+static const struct attribute_group mk_profile_group = {.attrs = mk_profile_attrs};
+
+
+static void __init mk_hotpath_init(void){ //static keys and axis table of the settings known before probe
+    bool enabled[] = {x1_enable, y1_enable, x2_enable, y2_enable}, reverse[] = {x1_reverse, y1_reverse, x2_reverse, y2_reverse};
+    uint16_t *seen_min[] = {&x1_min, &y1_min, &x2_min, &y2_min}, *seen_max[] = {&x1_max, &y1_max, &x2_max, &y2_max};
+    static const unsigned int codes[] = {ABS_X, ABS_Y, ABS_RX, ABS_RY};
+    int i;
+    
+    for(i = 0; i < MK_ADC_MAX_AXES; i++){
+        if(!enabled[i]){continue;}
+        mk_axis_reports[mk_axis_report_count++] = (struct mk_axis_report){i, codes[i], reverse[i], seen_min[i], seen_max[i], mk_adc_axes[i].shift};
+        adc_filters[i].shift = adc_smooth[i].shift = mk_adc_axes[i].shift; //thresholds and speed in 12bits units
+    }
+    if(x1_enable){mk_dpad_abs[0] = ABS_HAT0X;}
+    if(y1_enable){mk_dpad_abs[1] = ABS_HAT0Y;}
+    if(mk_axis_report_count){static_branch_enable(&mk_analog_key);}
+    if(gpio_backend==GPIO_BACKEND_INJECT){static_branch_enable(&mk_inject_key);}
+#if IS_ENABLED(CONFIG_MK_FF_PWM)
+    if(pca9633_client){static_branch_enable(&mk_ff_pwm_key);}
+#endif
+#if IS_ENABLED(CONFIG_MK_DEBUG)
+    if(debug_mode>0){static_branch_enable(&mk_debug_key);}
+    if(debug_mode>1){static_branch_enable(&mk_bench_key);}
+#endif
+}
+
+
+static void __init mk_profile_init(void){ //default profile from the module parameters, active until switched
+    struct mk_profile *prof = &mk_profiles[0];
+    int i;
+    
+    strscpy(prof->name, "default", sizeof(prof->name));
+    for(i = 0; i < MK_MAX_BUTTONS - 4; i++){prof->keys[i] = mk_arcade_gpio_btn[i];}
+    prof->params[0] = x1_analog_abs_params; prof->offset[0] = x1_offset;
+    prof->params[1] = y1_analog_abs_params; prof->offset[1] = y1_offset;
+    prof->params[2] = x2_analog_abs_params; prof->offset[2] = x2_offset;
+    prof->params[3] = y2_analog_abs_params; prof->offset[3] = y2_offset;
+    for(i = 0; i < MK_ADC_MAX_AXES; i++){mk_curve_linear(prof->curves[i].points);}
+    RCU_INIT_POINTER(mk_profile, prof);
+}
+
+
+static const char *mk_config_profile(struct mk_profile *prof, const struct mk_config_profile *cfg){ //config blob profile to driver profile, NULL if done, tables allocated even on error
+    struct analog_abs_params_struct *params[] = {&x1_analog_abs_params, &y1_analog_abs_params, &x2_analog_abs_params, &y2_analog_abs_params};
+    int16_t offsets[] = {x1_offset, y1_offset, x2_offset, y2_offset};
+    uint16_t linear[MK_CURVE_POINTS];
+    int i, j;
+    
+    strscpy(prof->name, cfg->name, sizeof(prof->name));
+    for(j = 0; j < MK_MAX_BUTTONS - 4; j++){
+        for(i = 0; i < MK_MAX_DEVICES; i++){ //input devices are not re-created, their key set is fixed
+            if(mk_base->pads[i].dev && !test_bit(cfg->keys[j], mk_base->pads[i].dev->keybit)){return "key not declared by the pads";}
+        }
+        prof->keys[j] = cfg->keys[j];
+    }
+    for(j = 4; j < MK_MAX_BUTTONS; j++){
+        if(!cfg->turbo_rate[j]){continue;}
+        prof->turbo_period_ns[j] = NSEC_PER_SEC / cfg->turbo_rate[j];
+        prof->turbo_on_ns[j] = prof->turbo_period_ns[j] / 100 * cfg->turbo_duty[j];
+    }
+    if(cfg->combo_count && !mk_combo_dev){return "hotkey actions need the combo parameter";}
+    for(j = 0; j < cfg->combo_count; j++){
+        if(!mk_combo_code_valid(cfg->combos[j].code)){return "combo key not declared by the hotkeys device";}
+        prof->combos[j] = (struct mk_combo){cfg->combos[j].btn, cfg->combos[j].hold_ms, cfg->combos[j].code};
+    }
+    prof->combo_count = cfg->combo_count;
+    
+    mk_curve_linear(linear);
+    for(i = 0; i < MK_ADC_MAX_AXES; i++){
+        const struct mk_config_axis *axis = &cfg->axis[i];
+        int16_t *table;
+        prof->params[i] = *params[i];
+        prof->offset[i] = offsets[i];
+        if(axis->max){ //same as absparams
+            prof->params[i] = (struct analog_abs_params_struct){axis->min, axis->max, axis->fuzz, axis->flat};
+            if(!auto_center){prof->offset[i] = ((axis->max - axis->min) / 2 + axis->min) - 2047;}
+        }
+        memcpy(prof->curves[i].points, axis->curve, sizeof(linear));
+        if(!memcmp(axis->curve, linear, sizeof(linear))){continue;}
+        table = kmalloc(MK_CURVE_SIZE * sizeof(int16_t), GFP_KERNEL);
+        if(!table){return "out of memory";}
+        mk_curve_build(prof->curves[i].points, table, &prof->params[i], prof->offset[i]);
+        RCU_INIT_POINTER(prof->curves[i].table, table);
+    }
+    return NULL;
+}
+
+
+static void mk_profiles_free(struct mk_profile *profiles){ //curve tables and the array itself, unreachable by polling
+    int i;
+    
+    for(i = 0; i < MK_MAX_PROFILES * MK_ADC_MAX_AXES; i++){kfree(rcu_dereference_protected(profiles[i / MK_ADC_MAX_AXES].curves[i % MK_ADC_MAX_AXES].table, 1));}
+    if(profiles != mk_profiles_default){kfree(profiles);}
+}
+
+
+static void mk_config_loaded(const struct firmware *fw, void *context){ //config blob: every profile replaced at once, profile 0 active
+    const struct mk_config_header *header;
+    const struct mk_config_profile *cfg;
+    struct mk_profile *profiles = NULL, *old;
+    unsigned long flags;
+    const char *err;
+    int i;
+    
+    if(!fw){printk("mk_arcade_joystick_rpi: Config : %s not found\n", MK_CONFIG_FILE); return;}
+    err = mk_config_check(fw->data, fw->size);
+    if(!err){
+        header = (const struct mk_config_header *)fw->data;
+        cfg = (const struct mk_config_profile *)(fw->data + sizeof(*header));
+        profiles = kcalloc(MK_MAX_PROFILES, sizeof(*profiles), GFP_KERNEL); //unused ones have no name
+        err = profiles ? NULL : "out of memory";
+        for(i = 0; !err && i < header->profile_count; i++){err = mk_config_profile(&profiles[i], &cfg[i]);}
+    }
+    if(err){ //profiles kept
+        printk("mk_arcade_joystick_rpi: Config : %s : %s\n", MK_CONFIG_FILE, err);
+        if(profiles){mk_profiles_free(profiles);}
+        release_firmware(fw);
+        return;
+    }
+    
+    mutex_lock(&mk_profile_mutex);
+    spin_lock_irqsave(&mk_turbo_lock, flags);
+    mk_keys_release(rcu_dereference_protected(mk_profile, lockdep_is_held(&mk_turbo_lock))->keys, profiles[0].keys);
+    old = mk_profiles;
+    mk_profiles = profiles;
+    mk_profile_arm(&profiles[0]); //rcu_assign_pointer, profiles and tables filled before polling can see them
+    mk_profile_edit = 0;
+    printk("mk_arcade_joystick_rpi: Config : %s : %d profiles, %s active\n", MK_CONFIG_FILE, header->profile_count, profiles[0].name);
+    spin_unlock_irqrestore(&mk_turbo_lock, flags);
+    mutex_unlock(&mk_profile_mutex);
+    synchronize_rcu(); //polling done with the old profiles
+    mk_profiles_free(old);
+    release_firmware(fw);
+}
+
+
+#define MK_CURVE_ATTR(n, axis) {.attr = {.name = "curve_" #n, .mode = 0644}, .size = MK_CURVE_POINTS * 2, .read = mk_curve_read, .write = mk_curve_write, .private = (void *)(long)axis}
+static struct bin_attribute mk_curve_attrs[] = {MK_CURVE_ATTR(x1, 0), MK_CURVE_ATTR(y1, 1), MK_CURVE_ATTR(x2, 2), MK_CURVE_ATTR(y2, 3)};
+static struct bin_attribute *mk_curve_bin_attrs[] = {&mk_curve_attrs[0], &mk_curve_attrs[1], &mk_curve_attrs[2], &mk_curve_attrs[3], NULL};
+static const struct attribute_group mk_curve_group = {.bin_attrs = mk_curve_bin_attrs};
+
+
+static int mk_capture_open(struct inode *inode, struct file *file){ //capture: single reader per pad
+    struct mk_capture *cap = container_of(file->private_data, struct mk_capture, misc);
+    
+    if(test_and_set_bit(MK_CAPTURE_OPEN, &cap->flags)){return -EBUSY;}
+    smp_store_release(&cap->tail, READ_ONCE(cap->head)); //start from now
+    cap->header_pending = true;
+    return nonseekable_open(inode, file);
+}
+
+
+static int mk_capture_release(struct inode *inode, struct file *file){
+    struct mk_capture *cap = container_of(file->private_data, struct mk_capture, misc);
+    
+    clear_bit(MK_CAPTURE_OPEN, &cap->flags);
+    if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Capture pad%d : %llu samples, %llu overruns\n", cap->pad, cap->samples, cap->overruns);}
+    return 0;
+}
+
+
+static ssize_t mk_capture_read(struct file *file, char __user *buf, size_t count, loff_t *ppos){ //capture: header once, then whole samples
+    struct mk_capture *cap = container_of(file->private_data, struct mk_capture, misc);
+    unsigned int head, tail, n, first;
     
-    if(x1_enable){input_report_abs(dev, ABS_HAT0X, !data[2]-!data[3]); //if using analog, DPAD is ABS_HAT0X
-    }else{input_report_abs(dev, ABS_X, !data[2]-!data[3]);} //DPAD is ABS_X
-    
-    if(y1_enable){input_report_abs(dev, ABS_HAT0Y, !data[0]-!data[1]); //if using analog, DPAD is ABS_HAT0Y
-    }else{input_report_abs(dev, ABS_Y, !data[0]-!data[1]);} //DPAD is ABS_Y
-    
-    if(x1_enable){ //if using analog for x1
-        if(ads1015_enable){adc_val = ADS1015_read(i2c_client_x1,0); //ads1015
-        }else{adc_val = i2c_smbus_read_word_swapped(i2c_client_x1,0);} //mcp3021
-        if(adc_val>=0){
-            if(x1_reverse){adc_val = abs(4096-adc_val);} //nns: reverse 12bits value
-            if(adc_val < x1_min){x1_min = adc_val;} //update x1 analog min value
-            if(adc_val > x1_max){x1_max = adc_val;} //update x1 analog max value
-            adc_val = ADC_OffsetCenter(4096,adc_val,x1_analog_abs_params.min,x1_analog_abs_params.max,x1_offset); //re-center adc value
-            adc_val = ADC_Deadzone(adc_val,0x000,0xFFF,x1_analog_abs_params.flat); //apply flat value to adc value
-            input_report_abs(dev, ABS_X, adc_val);
-        }else if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : failed to read analog X1, returned %i\n",adc_val);} //nns: debug
-    }
-    
-    if(y1_enable){ //if using analog for y1
-        if(ads1015_enable){adc_val = ADS1015_read(i2c_client_x1,1); //ads1015
-        }else{adc_val = i2c_smbus_read_word_swapped(i2c_client_y1,0);} //mcp3021
-        if(adc_val>=0){
-            if(y1_reverse){adc_val = abs(4096-adc_val);} //nns: reverse 12bits value
-            if(adc_val < y1_min){y1_min = adc_val;} //update y1 analog min value
-            if(adc_val > y1_max){y1_max = adc_val;} //update y1 analog max value
-            adc_val = ADC_OffsetCenter(4096,adc_val,y1_analog_abs_params.min,y1_analog_abs_params.max,y1_offset); //re-center adc value
-            adc_val = ADC_Deadzone(adc_val,0x000,0xFFF,y1_analog_abs_params.flat); //apply flat value to adc value
-            input_report_abs(dev, ABS_Y, adc_val);
-        }else if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : failed to read analog Y1, returned %i\n",adc_val);} //nns: debug
-    }
-    
-    if(x2_enable){ //if using analog for x2
-        if(ads1015_enable){adc_val = ADS1015_read(i2c_client_x1,2); //ads1015
-        }else{adc_val = i2c_smbus_read_word_swapped(i2c_client_x2,0);} //mcp3021
-        if(adc_val>=0){
-            if(x2_reverse){adc_val = abs(4096-adc_val);} //nns: reverse 12bits value
-            if(adc_val < x2_min){x2_min = adc_val;} //update x2 analog min value
-            if(adc_val > x2_max){x2_max = adc_val;} //update x2 analog max value
-            adc_val = ADC_OffsetCenter(4096,adc_val,x2_analog_abs_params.min,x2_analog_abs_params.max,x2_offset); //re-center adc value
-            adc_val = ADC_Deadzone(adc_val,0x000,0xFFF,x2_analog_abs_params.flat); //apply flat value to adc value
-            input_report_abs(dev, ABS_RX, adc_val);
-        }else if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : failed to read analog X2, returned %i\n",adc_val);} //nns: debug
-    }
-    
-    if(y2_enable){ //if using analog for x2
-        if(ads1015_enable){adc_val = ADS1015_read(i2c_client_x1,3); //ads1015
-        }else{adc_val = i2c_smbus_read_word_swapped(i2c_client_y2,0);} //mcp3021
-        if(adc_val>=0){
-            if(y2_reverse){adc_val = abs(4096-adc_val);} //nns: reverse 12bits value
-            if(adc_val < y2_min){y2_min = adc_val;} //update y2 analog min value
-            if(adc_val > y2_max){y2_max = adc_val;} //update y2 analog max value
-            adc_val = ADC_OffsetCenter(4096,adc_val,y2_analog_abs_params.min,y2_analog_abs_params.max,y2_offset); //re-center adc value
-            adc_val = ADC_Deadzone(adc_val,0x000,0xFFF,y2_analog_abs_params.flat); //apply flat value to adc value
-            input_report_abs(dev, ABS_RY, adc_val);
-        }else if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : failed to read analog Y2, returned %i\n",adc_val);} //nns: debug
+    if(cap->header_pending){
+        struct mk_capture_header header = {MK_CAPTURE_MAGIC, MK_CAPTURE_VERSION, sizeof(struct mk_capture_sample), gpio_backend==GPIO_BACKEND_GPIOLIB?MK_CAPTURE_FLAG_GPIOLIB:0, cap->pad, HZ/poll_refresh_time};
+        if(gpio_backend==GPIO_BACKEND_INJECT){header.flags = mk_injects[cap->pad].stream_flags;} //levels as injected
+        if(count < sizeof(header)){return -EINVAL;}
+        if(copy_to_user(buf, &header, sizeof(header))){return -EFAULT;}
+        cap->header_pending = false;
+        return sizeof(header);
     }
+    if(count < sizeof(struct mk_capture_sample)){return -EINVAL;}
     
-    for (j = 4; j < MK_MAX_BUTTONS; j++){
-        if(pad->gpio_maps[j] != -1){input_report_key(dev, mk_arcade_gpio_btn[j - 4], data[j]);}
+    tail = cap->tail;
+    while((head = smp_load_acquire(&cap->head)) == tail){ //empty
+        if(file->f_flags & O_NONBLOCK){return -EAGAIN;}
+        if(wait_event_interruptible(cap->wait, smp_load_acquire(&cap->head) != tail)){return -ERESTARTSYS;}
     }
     
-    input_sync(dev);
+    n = min_t(unsigned int, head - tail, count / sizeof(struct mk_capture_sample));
+    first = min_t(unsigned int, n, cap->size - (tail & (cap->size - 1))); //samples before ring end
+    if(copy_to_user(buf, &cap->ring[tail & (cap->size - 1)], first * sizeof(struct mk_capture_sample))){return -EFAULT;}
+    if(n > first && copy_to_user(buf + first * sizeof(struct mk_capture_sample), cap->ring, (n - first) * sizeof(struct mk_capture_sample))){return -EFAULT;}
+    smp_store_release(&cap->tail, tail + n); //free slots
+    return n * sizeof(struct mk_capture_sample);
+}
+
+
+static __poll_t mk_capture_poll(struct file *file, poll_table *wait){
+    struct mk_capture *cap = container_of(file->private_data, struct mk_capture, misc);
     
-    //PWM force feedback, need to be here because i2c_smbus_write_byte_data mess with schedule_delayed_work
-    if(!ff_strong_pwm_sent){ //pwm i2c not already sent
-        if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Feedback effect : PWM Strong : %d\n",ff_strong_pwm_value);}
-        i2c_smbus_write_byte_data(pca9633_client,(uint8_t)(ff_strong_pwm+2),(uint8_t)(ff_strong_pwm_value)); //send pwm to i2c
-        ff_strong_pwm_sent=true; //reset
-    }
-    
-    if(!ff_weak_pwm_sent){ //pwm i2c not already sent
-        if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Feedback effect : PWM Weak : %d\n",ff_weak_pwm_value);}
-        i2c_smbus_write_byte_data(pca9633_client,(uint8_t)(ff_weak_pwm+2),(uint8_t)(ff_weak_pwm_value)); //send pwm to i2c
-        ff_weak_pwm_sent=true; //reset
-    }
-    
-    if(debug_mode>1){ //may be removed in the future
-        if(jiffies_last<(unsigned long)jiffies){ //no jiffies rollover
-            benchmark_loop++;
-            benchmark_tmp=benchmark_time_start-(unsigned long)jiffies; //current loop duration
-            if(benchmark_tmp>benchmark_time){benchmark_time=benchmark_tmp;} //backup duration
-            if(benchmark_loop>benchmark_maxloop){ //report benchmark and reset
-                if(benchmark_time>0){printk("mk_arcade_joystick_rpi: DEBUG : Benchmark : Longest loop over %d updates : %d jiffies (%d msec)\n",benchmark_maxloop,benchmark_time,jiffies_to_msecs(benchmark_time)); //over 0 jiffies result
-                }else{printk("mk_arcade_joystick_rpi: DEBUG : Benchmark : under 1 jiffies (%d msec) over %d updates\n",jiffies_to_msecs(1),benchmark_maxloop);} //sub 1 jiffies result
-                benchmark_time=0; benchmark_loop=0; //reset values
-            }
-        }
-        jiffies_last=(unsigned long)jiffies; //backup jiffies value to check for rollover
-    }
+    poll_wait(file, &cap->wait, wait);
+    if(cap->header_pending || smp_load_acquire(&cap->head) != cap->tail){return EPOLLIN | EPOLLRDNORM;}
+    return 0;
 }
 
 
-static void mk_process_packet(struct mk *mk){
-    struct mk_pad *pad;
-    int i;
+static const struct file_operations mk_capture_fops = {
+    .owner = THIS_MODULE,
+    .open = mk_capture_open,
+    .release = mk_capture_release,
+    .read = mk_capture_read,
+    .poll = mk_capture_poll,
+};
+
+
+static int __init mk_capture_add(int idx, int size){ //capture: allocate ring and register /dev/mk_arcade_captureN
+    struct mk_capture *cap = &mk_captures[idx];
+    int err;
     
-    for(i = 0; i < mk->total_pads; i++){
-        pad = &mk->pads[i];
-        mk_gpio_read_packet(pad, data);     //data is now global
-        mk_input_report(pad, data);
+    cap->pad = idx;
+    cap->size = roundup_pow_of_two(min(size, MK_CAPTURE_MAX_SIZE));
+    cap->ring = vzalloc(cap->size * sizeof(struct mk_capture_sample));
+    if(!cap->ring){return -ENOMEM;}
+    init_waitqueue_head(&cap->wait);
+    snprintf(cap->name, sizeof(cap->name), "mk_arcade_capture%d", idx);
+    cap->misc.minor = MISC_DYNAMIC_MINOR;
+    cap->misc.name = cap->name;
+    cap->misc.fops = &mk_capture_fops;
+    cap->misc.parent = &mk_pdev->dev;
+    err = misc_register(&cap->misc);
+    if(err){vfree(cap->ring); cap->ring = NULL; return err;}
+    printk("mk_arcade_joystick_rpi: Capture : /dev/%s, %u samples\n", cap->name, cap->size);
+    return 0;
+}
+
+
+static int mk_capture_stats_show(struct seq_file *s, void *unused){ //capture statistics, debugfs
+    int i;
+    for(i=0;i<MK_MAX_DEVICES;i++){
+        struct mk_capture *cap = &mk_captures[i];
+        if(!cap->ring){continue;}
+        seq_printf(s, "pad%d: size %u, reader %s, samples %llu, overruns %llu\n", i, cap->size, test_bit(MK_CAPTURE_OPEN, &cap->flags)?"open":"none", cap->samples, cap->overruns);
     }
+    return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(mk_capture_stats);
 
 
-static int mk_ff(struct input_dev *dev, void *data, struct ff_effect *effect){ //nns: handle force feedback effects
-    if(effect->type!=FF_RUMBLE){
-        if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Wrong force feedback effect\n");}
-        return 0;
-    }else{
-        if(effect->u.rumble.strong_magnitude!=0&&!ff_effect_strong_running){ //run strong
-            if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Feedback effect : Strong : start\n");}
-            if(pca9633_client!=NULL&&ff_strong_pwm!=-1){ //pwm
-                ff_strong_pwm_value=abs(effect->u.rumble.strong_magnitude/256);
-                if(ff_strong_pwm_reverse){ff_strong_pwm_value=abs(255-ff_strong_pwm_value);} //reverse logic
-                ff_strong_pwm_sent=false;
-            }
-            if(ff_gpio_strong_pin!=-1){ //gpio
-                if(ff_effect_strong_reverse){GpioOuputClr(ff_gpio_strong_pin); //reverse logic, set low
-                }else{GpioOuputSet(ff_gpio_strong_pin);} //set high
-            }
-            ff_effect_strong_running=true; //running
-        }else{ //stop strong
-            if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Feedback effect : Strong : stop\n");}
-            if(pca9633_client!=NULL&&ff_strong_pwm!=-1){ //pwm
-                if(ff_strong_pwm_reverse){ff_strong_pwm_value=255;}else{ff_strong_pwm_value=0;}
-                ff_strong_pwm_sent=false;
+static int mk_inject_open(struct inode *inode, struct file *file){ //injection: single writer per pad
+    struct mk_inject *inj = container_of(file->private_data, struct mk_inject, misc);
+    
+    if(test_and_set_bit(MK_INJECT_OPEN, &inj->flags)){return -EBUSY;}
+    inj->header_checked = false;
+    inj->partial_len = 0;
+    return nonseekable_open(inode, file);
+}
+
+
+static int mk_inject_release(struct inode *inode, struct file *file){
+    struct mk_inject *inj = container_of(file->private_data, struct mk_inject, misc);
+    
+    clear_bit(MK_INJECT_OPEN, &inj->flags); //queued samples are still played
+    if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Inject pad%d : %llu samples, %llu underruns\n", inj->pad, inj->samples, inj->underruns);}
+    return 0;
+}
+
+
+static ssize_t mk_inject_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos){ //injection: optional capture header, then samples, any write size
+    struct mk_inject *inj = container_of(file->private_data, struct mk_inject, misc);
+    size_t done = 0, need, take;
+    
+    for(;;){
+        if(inj->header_checked && inj->partial_len == sizeof(struct mk_capture_sample)){ //complete sample, queue it
+            unsigned int head = inj->head;
+            while(head - smp_load_acquire(&inj->tail) >= MK_INJECT_SIZE){ //full, wait for the work handler
+                if(done){return done;}
+                if(!READ_ONCE(poll_running)){return -ENODEV;} //joystick not open, the queue never drains
+                if(file->f_flags & O_NONBLOCK){return -EAGAIN;}
+                if(wait_event_interruptible(inj->wait, head - smp_load_acquire(&inj->tail) < MK_INJECT_SIZE || !READ_ONCE(poll_running))){return -ERESTARTSYS;}
             }
-            if(ff_gpio_strong_pin!=-1){GpioOuputClr(ff_gpio_strong_pin);} //set gpio output low
-            ff_effect_strong_running=false; //reset
+            memcpy(&inj->ring[head & (MK_INJECT_SIZE - 1)], inj->partial, sizeof(struct mk_capture_sample));
+            smp_store_release(&inj->head, head + 1); //publish sample
+            inj->partial_len = 0;
         }
+        if(done == count){return done;}
         
-        if(ff_gpio_weak_pin!=-1||ff_weak_pwm!=-1){
-            if(effect->u.rumble.weak_magnitude!=0&&!ff_effect_weak_running){ //run weak
-                if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Feedback effect : Weak : start\n");}
-                if(pca9633_client!=NULL&&ff_weak_pwm!=-1){ //pwm
-                    ff_weak_pwm_value=abs(effect->u.rumble.weak_magnitude/256);
-                    if(ff_weak_pwm_reverse){ff_weak_pwm_value=abs(255-ff_weak_pwm_value);} //reverse logic
-                    ff_weak_pwm_sent=false;
-                }
-                if(ff_gpio_weak_pin!=-1){ //gpio
-                    if(ff_effect_weak_reverse){GpioOuputClr(ff_gpio_weak_pin); //reverse logic, set low
-                    }else{GpioOuputSet(ff_gpio_weak_pin);} //set high
-                }
-                ff_effect_weak_running=true; //running
-            }else{ //stop weak
-                if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Feedback effect : Weak : stop\n");}
-                if(pca9633_client!=NULL&&ff_weak_pwm!=-1){ //pwm
-                    if(ff_strong_pwm_reverse){ff_weak_pwm_value=255;}else{ff_weak_pwm_value=0;}
-                    ff_weak_pwm_sent=false;
-                }
-                if(ff_gpio_weak_pin!=-1){GpioOuputClr(ff_gpio_weak_pin);} //set gpio output low
-                ff_effect_weak_running=false; //reset
-            }
-        }
+        if(inj->header_checked){need = sizeof(struct mk_capture_sample);
+        }else if(inj->partial_len < sizeof(u32)){need = sizeof(u32); //magic
+        }else{need = sizeof(struct mk_capture_header);}
+        take = min(need - inj->partial_len, count - done);
+        if(copy_from_user(inj->partial + inj->partial_len, buf + done, take)){return done ? done : -EFAULT;}
+        inj->partial_len += take;
+        done += take;
+        if(inj->partial_len < need || inj->header_checked){continue;}
         
-        if(ff_dir_enable){ //direction is set for both strong and week motor at the same time
-            ff_effect_dir=effect->direction; //https://elixir.bootlin.com/linux/latest/source/include/uapi/linux/input.h#L443
-            if(ff_effect_dir<16384||ff_effect_dir>49152){ //assume value under left/over right as down
-                if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Feedback effect : Direction : Down (%d)\n",ff_effect_dir);}
-                if(ff_gpio_dir_reverse){GpioOuputSet(ff_gpio_dir_pin); //reverse logic, set high
-                }else{GpioOuputClr(ff_gpio_dir_pin);} //set low
-            }else{ //assume as up
-                if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : Feedback effect : Direction : Up (%d)\n",ff_effect_dir);}
-                if(ff_gpio_dir_reverse){GpioOuputClr(ff_gpio_dir_pin); //reverse logic, set low
-                }else{GpioOuputSet(ff_gpio_dir_pin);} //set high
-            }
+        if(need == sizeof(u32)){ //stream start, capture header or raw samples
+            u32 magic;
+            memcpy(&magic, inj->partial, sizeof(magic));
+            if(magic != MK_CAPTURE_MAGIC){inj->header_checked = true;} //no header, bytes belong to the first sample
+        }else{
+            struct mk_capture_header header;
+            memcpy(&header, inj->partial, sizeof(header));
+            inj->partial_len = 0;
+            if(header.version != MK_CAPTURE_VERSION || header.sample_size != sizeof(struct mk_capture_sample)){return -EINVAL;}
+            inj->stream_flags = header.flags;
+            inj->header_checked = true;
         }
-        return 1;
     }
 }
 
 
-static void mk_work_handler(struct work_struct* work){
-    struct mk *mk = g_mk;
-    mk_process_packet(mk);
-    schedule_delayed_work(&mk_delayed_work, MK_REFRESH_TIME);
-}
+static const struct file_operations mk_inject_fops = {
+    .owner = THIS_MODULE,
+    .open = mk_inject_open,
+    .release = mk_inject_release,
+    .write = mk_inject_write,
+};
 
 
-static int mk_open(struct input_dev *dev){
-    struct mk *mk = input_get_drvdata(dev);
+static int __init mk_inject_add(int idx){ //injection: register /dev/mk_arcade_injectN, ring set up with the pad
+    struct mk_inject *inj = &mk_injects[idx];
     int err;
     
-    err = mutex_lock_interruptible(&mk->mutex);
+    snprintf(inj->name, sizeof(inj->name), "mk_arcade_inject%d", idx);
+    inj->misc.minor = MISC_DYNAMIC_MINOR;
+    inj->misc.name = inj->name;
+    inj->misc.fops = &mk_inject_fops;
+    inj->misc.parent = &mk_pdev->dev;
+    inj->misc.mode = 0200;
+    err = misc_register(&inj->misc);
     if(err){return err;}
-    if(!mk->used++){schedule_delayed_work(&mk_delayed_work, MK_REFRESH_TIME);}
-    mutex_unlock(&mk->mutex);
+    printk("mk_arcade_joystick_rpi: Inject : /dev/%s\n", inj->name);
     return 0;
 }
 
 
-static void mk_close(struct input_dev *dev){
-    struct mk *mk = input_get_drvdata(dev);
-    
-    mutex_lock(&mk->mutex);
-    if(!--mk->used){cancel_delayed_work_sync(&mk_delayed_work);}
-    mutex_unlock(&mk->mutex);
+static int mk_inject_stats_show(struct seq_file *s, void *unused){ //injection statistics, debugfs
+    int i;
+    for(i=0;i<MK_MAX_DEVICES;i++){
+        struct mk_inject *inj = &mk_injects[i];
+        if(!inj->misc.this_device){continue;}
+        seq_printf(s, "pad%d: writer %s, queued %u, samples %llu, underruns %llu\n", i, test_bit(MK_INJECT_OPEN, &inj->flags)?"open":"none", READ_ONCE(inj->head)-READ_ONCE(inj->tail), inj->samples, inj->underruns);
+    }
+    return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(mk_inject_stats);
 
 
 static int __init mk_setup_pad(struct mk *mk, int idx, int pad_type_arg){
@@ -899,6 +2900,12 @@ static int __init mk_setup_pad(struct mk *mk, int idx, int pad_type_arg){
     pad->type = pad_type;
     snprintf(pad->phys, sizeof (pad->phys), "input%d", idx);
     
+    pad->turbo = &mk_turbos[idx]; //autofire, idle until a turbo button is held
+    hrtimer_init(&pad->turbo->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    pad->turbo->timer.function = mk_turbo_timer;
+    pad->turbo->dev = input_dev;
+    pad->combo = (struct mk_combo_state){0, -1, 0, -1}; //hotkey actions
+    
     if(debug_mode>0){pr_err("Running in Debug mode %d\n", debug_mode);}
     
     input_dev->name = mk_names[pad_type];
@@ -910,6 +2917,8 @@ static int __init mk_setup_pad(struct mk *mk, int idx, int pad_type_arg){
     
     input_set_drvdata(input_dev, mk);
     
+    input_dev->dev.parent = &mk_pdev->dev;
+    
     input_dev->open = mk_open;
     input_dev->close = mk_close;
     
@@ -938,52 +2947,88 @@ static int __init mk_setup_pad(struct mk *mk, int idx, int pad_type_arg){
     
     if(x1_enable){ //if using analog, then DPAD is ABS_HAT0X
         input_set_abs_params(input_dev, ABS_HAT0X, -1, 1, 0, 0);
-        input_set_abs_params(input_dev, ABS_X, 0x000, 0xFFF, x1_analog_abs_params.fuzz, x1_analog_abs_params.flat); //nns: parameters for center offcenter values
+        input_set_abs_params(input_dev, ABS_X, 0x000, (0x1000<<mk_adc_axes[0].shift)-1, x1_analog_abs_params.fuzz<<mk_adc_axes[0].shift, x1_analog_abs_params.flat<<mk_adc_axes[0].shift); //nns: parameters for center offcenter values, axis resolution
     }else{
         input_set_abs_params(input_dev, ABS_X, -1, 1, 0, 0);
     }
     
     if(y1_enable){ //if using analog, then DPAD is ABS_HAT0Y
         input_set_abs_params(input_dev, ABS_HAT0Y, -1, 1, 0, 0);
-        input_set_abs_params(input_dev, ABS_Y, 0x000, 0xFFF, y1_analog_abs_params.fuzz, y1_analog_abs_params.flat); //nns: parameters for center offcenter values
+        input_set_abs_params(input_dev, ABS_Y, 0x000, (0x1000<<mk_adc_axes[1].shift)-1, y1_analog_abs_params.fuzz<<mk_adc_axes[1].shift, y1_analog_abs_params.flat<<mk_adc_axes[1].shift); //nns: parameters for center offcenter values, axis resolution
     }else{
         input_set_abs_params(input_dev, ABS_Y, -1, 1, 0, 0);
     }
     
-    if(x2_enable){input_set_abs_params(input_dev, ABS_RX, 0x000, 0xFFF, x2_analog_abs_params.fuzz, x2_analog_abs_params.flat);} //nns: parameters for center offcenter values
-    if(y2_enable){input_set_abs_params(input_dev, ABS_RY, 0x000, 0xFFF, y2_analog_abs_params.fuzz, y2_analog_abs_params.flat);} //nns: parameters for center offcenter values
+    if(x2_enable){input_set_abs_params(input_dev, ABS_RX, 0x000, (0x1000<<mk_adc_axes[2].shift)-1, x2_analog_abs_params.fuzz<<mk_adc_axes[2].shift, x2_analog_abs_params.flat<<mk_adc_axes[2].shift);} //nns: parameters for center offcenter values, axis resolution
+    if(y2_enable){input_set_abs_params(input_dev, ABS_RY, 0x000, (0x1000<<mk_adc_axes[3].shift)-1, y2_analog_abs_params.fuzz<<mk_adc_axes[3].shift, y2_analog_abs_params.flat<<mk_adc_axes[3].shift);} //nns: parameters for center offcenter values, axis resolution
     
     for (i = 0; i < MK_MAX_BUTTONS - 4; i++){
         if(pad->gpio_maps[i+4] != -1){__set_bit(mk_arcade_gpio_btn[i], input_dev->keybit);}
     }
     
     // initialize gpio
-    for (i = 0; i < MK_MAX_BUTTONS; i++){
-        if(pad->gpio_maps[i] != -1){    // to avoid unused buttons
-            if(pad->gpio_maps[i] < 0){
-                setGpioAsInput(pad->gpio_maps[i] * -1);
-            }else{
-                setGpioAsInput(pad->gpio_maps[i]);
+    if(gpio_backend==GPIO_BACKEND_GPIOLIB){ //all buttons of the pad requested as one array
+        static const char *con_ids[] = {"pad0", "pad1"};
+        int pins[MK_MAX_BUTTONS], count = 0;
+        unsigned long flags[MK_MAX_BUTTONS];
+        for (i = 0; i < MK_MAX_BUTTONS; i++){
+            if(pad->gpio_maps[i] != -1){    // to avoid unused buttons
+                pins[count] = abs(pad->gpio_maps[i]);
+                if(pad->gpio_maps[i] < 0){flags[count] = GPIO_ACTIVE_HIGH; //inverted signal, no pullup
+                }else{flags[count] = GPIO_ACTIVE_LOW | GPIO_PULL_UP;} //pressed when low
+                pad->gpiod_map[count] = i;
+                count++;
+            }
+        }
+        if(count > 0){
+            pad->gpiods = mk_gpiod_get_array(con_ids[idx], pins, flags, count, GPIOD_IN);
+            if(IS_ERR(pad->gpiods)){
+                err = PTR_ERR(pad->gpiods);
+                pad->gpiods = NULL;
+                pr_err("Failed to get GPIO lines for pad%d : %d\n", idx, err);
+                goto err_free_dev;
+            }
+        }
+    }else if(gpio_backend==GPIO_BACKEND_INJECT){ //nothing pressed and no analog value until the first sample
+        pad->inject = &mk_injects[idx];
+        pad->inject->pad = idx;
+        memset(pad->inject->last.level, 0xFF, sizeof(pad->inject->last.level));
+        for(i = 0; i < 4; i++){pad->inject->last.adc[i] = MK_CAPTURE_ADC_NONE;}
+        init_waitqueue_head(&pad->inject->wait);
+    }else{
+        for (i = 0; i < MK_MAX_BUTTONS; i++){
+            if(pad->gpio_maps[i] != -1){    // to avoid unused buttons
+                if(pad->gpio_maps[i] < 0){
+                    setGpioAsInput(pad->gpio_maps[i] * -1);
+                }else{
+                    setGpioAsInput(pad->gpio_maps[i]);
+                }
             }
         }
+        
+        uint32_t pullUpMaskLow, pullUpMaskHigh;
+        getPullUpMask(pad->gpio_maps, &pullUpMaskLow, &pullUpMaskHigh);
+        
+        setGpioPullUps(pullUpMaskLow, pullUpMaskHigh);
     }
-    
-    uint32_t pullUpMaskLow, pullUpMaskHigh;
-    getPullUpMask(pad->gpio_maps, &pullUpMaskLow, &pullUpMaskHigh);
-    
-    setGpioPullUps(pullUpMaskLow, pullUpMaskHigh);
     printk("mk_arcade_joystick_rpi: GPIO configured for pad%d\n", idx);
     
+#if IS_ENABLED(CONFIG_MK_FF_GPIO) || IS_ENABLED(CONFIG_MK_FF_PWM)
     if(ff_enable||ff_pwm_enable){ //nns: force feedback support
         int ff_err;
         input_set_capability(pad->dev, EV_FF, FF_RUMBLE);
         ff_err=input_ff_create_memless(pad->dev, NULL, mk_ff);
         if(ff_err){
             printk("mk_arcade_joystick_rpi: Failed to create force feedback device : %d",ff_err);
+#if IS_ENABLED(CONFIG_MK_FF_GPIO)
             ff_enable=false;
+#endif
+#if IS_ENABLED(CONFIG_MK_FF_PWM)
             ff_pwm_enable=false;
+#endif
         }else{
             printk("mk_arcade_joystick_rpi: Force feedback device created");
+#if IS_ENABLED(CONFIG_MK_FF_GPIO)
             if(ff_enable){
                 printk("mk_arcade_joystick_rpi: Force feedback : Strong GPIO pin : %d\n", ff_gpio_strong_pin);
                 if(ff_effect_strong_reverse){printk("mk_arcade_joystick_rpi: Force feedback : Strong GPIO pin use reverse logic\n");}
@@ -1000,15 +3045,17 @@ static int __init mk_setup_pad(struct mk *mk, int idx, int pad_type_arg){
                     setGpioAsInput(ff_gpio_dir_pin); setGpioAsOuput(ff_gpio_dir_pin); //set pin as output, need to be set as input first
                 }
             }
+#endif
         }
     }
+#endif
     
     err = input_register_device(pad->dev);
     if(err){goto err_free_dev;}
     
     return 0;
     
-    err_free_dev: input_free_device(pad->dev); pad->dev = NULL; return err;
+    err_free_dev: input_free_device(pad->dev); pad->dev = NULL; pad->turbo->dev = NULL; return err;
 }
 
 
@@ -1045,7 +3092,10 @@ static struct mk __init *mk_probe(int *pads, int n_pads){
     
     return mk;
     
-    err_unreg_devs: while(--i >= 0){if(mk->pads[i].dev){input_unregister_device(mk->pads[i].dev);}}
+    err_unreg_devs: while(--i >= 0){
+        if(mk->pads[i].dev){input_unregister_device(mk->pads[i].dev);}
+        if(mk->pads[i].gpiods){gpiod_put_array(mk->pads[i].gpiods);}
+    }
     err_free_mk: kfree(mk);
     err_out: return ERR_PTR(err);
 }
@@ -1058,6 +3108,7 @@ static void mk_remove(struct mk *mk){
         if(mk->pads[i].dev){
             input_unregister_device(mk->pads[i].dev);
         }
+        if(mk->pads[i].gpiods){gpiod_put_array(mk->pads[i].gpiods);}
     }
     
     kfree(mk);
@@ -1067,27 +3118,68 @@ static void mk_remove(struct mk *mk){
 static int __init mk_init(void){
     pr_err("Freeplay Button Driver\n");
     
-    /* Set up gpio pointer for direct register access */
-    if((gpio = ioremap(GPIO_BASE, 0xB0)) == NULL){
-        pr_err("io remap failed\n");
-        return -EBUSY;
-    }
+    if(gpio_backend_cfg.nargs > 0 && gpio_backend_cfg.backend[0] == GPIO_BACKEND_GPIOLIB){gpio_backend=GPIO_BACKEND_GPIOLIB;}
+    if(gpio_backend_cfg.nargs > 0 && gpio_backend_cfg.backend[0] == GPIO_BACKEND_INJECT){gpio_backend=GPIO_BACKEND_INJECT;}
+    
+    if(gpio_backend==GPIO_BACKEND_RAW){
+        /* Set up gpio pointer for direct register access */
+        if((gpio = ioremap(GPIO_BASE, 0xB0)) == NULL){
+            pr_err("io remap failed\n");
+            return -EBUSY;
+        }
+    }else if(gpio_backend==GPIO_BACKEND_GPIOLIB){printk("mk_arcade_joystick_rpi: Using gpiolib backend\n");
+    }else{printk("mk_arcade_joystick_rpi: Using injection backend, no hardware access\n");}
     
+#if IS_ENABLED(CONFIG_MK_DEBUG)
     if(debug_config_cfg.nargs > 0){ //if hkmode was not defined
         if(debug_config_cfg.debug[0]>0){debug_mode=abs(debug_config_cfg.debug[0]);} //enable debug mode
     }
+#endif
+    
+    if(idle_cfg.nargs > 0 && idle_cfg.params[0] > 0){ //adaptive polling
+        idle_enable=true;
+        idle_timeout=msecs_to_jiffies(idle_cfg.params[0]); //idle timeout
+        if(idle_cfg.nargs < 2 || idle_cfg.params[1] <= 0){idle_cfg.params[1]=IDLE_DEFAULT_RATE;} //idle rate
+        idle_refresh_time=HZ/idle_cfg.params[1];
+        if(idle_refresh_time<MK_REFRESH_TIME){idle_refresh_time=MK_REFRESH_TIME;} //never faster than full rate
+        printk("mk_arcade_joystick_rpi: Adaptive polling : idle after %d msec, %lu Hz\n", idle_cfg.params[0], HZ/idle_refresh_time);
+    }
+    
+    { //analog pre-filter and smoothing, before the first conversion
+        static const char *names[] = {"X1", "Y1", "X2", "Y2"};
+        struct filter_axis_config *filter_cfg[] = {&filter_x1_cfg, &filter_y1_cfg, &filter_x2_cfg, &filter_y2_cfg};
+        struct smooth_axis_config *smooth_cfg[] = {&smooth_x1_cfg, &smooth_y1_cfg, &smooth_x2_cfg, &smooth_y2_cfg};
+        int i;
+        for(i=0;i<MK_ADC_MAX_AXES;i++){
+            if(filter_cfg[i]->nargs == 0){continue;}
+            adc_filters[i].median = clamp(filter_cfg[i]->params[0], 1, MK_FILTER_MEDIAN_MAX) | 1; //odd window
+            if(filter_cfg[i]->nargs > 1){adc_oversample[i] = clamp(filter_cfg[i]->params[1], 1, MK_FILTER_OVERSAMPLE_MAX);}
+            printk("mk_arcade_joystick_rpi: %s filter : median of %d, %d conversions per poll\n", names[i], adc_filters[i].median, max(adc_oversample[i], 1));
+            adc_filter_enable=true;
+        }
+        for(i=0;i<MK_ADC_MAX_AXES;i++){ //adaptive smoothing
+            if(smooth_cfg[i]->nargs == 0 || smooth_cfg[i]->params[0] <= 0){continue;}
+            adc_smooth[i].mincutoff = min(smooth_cfg[i]->params[0], MK_SMOOTH_CUTOFF_MAX);
+            adc_smooth[i].beta = smooth_cfg[i]->nargs > 1 ? clamp(smooth_cfg[i]->params[1], 0, 10000) : SMOOTH_DEFAULT_BETA;
+            adc_smooth[i].dcutoff = smooth_cfg[i]->nargs > 2 ? clamp(smooth_cfg[i]->params[2], 1, MK_SMOOTH_CUTOFF_MAX) : SMOOTH_DEFAULT_DCUTOFF;
+            printk("mk_arcade_joystick_rpi: %s smoothing : %d.%02d Hz at rest, beta %d, speed cutoff %d.%02d Hz\n", names[i], adc_smooth[i].mincutoff / 100, adc_smooth[i].mincutoff % 100, adc_smooth[i].beta, adc_smooth[i].dcutoff / 100, adc_smooth[i].dcutoff % 100);
+            adc_filter_enable=true;
+        }
+    }
     
     if(hkmode_cfg.nargs == 0){ //if hkmode was not defined
         hkmode_cfg.mode[0] = HOTKEY_MODE_TOGGLE; //default to HOTKEY_MODE_TOGGLE if not set
     }
     
-    if(i2cbus_cfg.nargs == 0){ //if i2cbus addr was not defined
+    if(i2cbus_cfg.nargs == 0 || gpio_backend==GPIO_BACKEND_INJECT){ //if i2cbus addr was not defined, injection never touch the bus
         i2cbus_cfg.busnum[0] = -1; //default to not using i2c
     }
     
+#if IS_ENABLED(CONFIG_MK_ADC_ADS1X15)
     if(ads1015_cfg.nargs == 0){ //nns: if ads1015 addr was not defined
         ads1015_cfg.address[0] = 0; //default to not using it
     }
+#endif
     
     if(analog_x1_cfg.nargs == 0){ //if analog input i2c addr was not defined
         analog_x1_cfg.address[0] = -1; //default to not using it, nns: -1 to avoid using it if ads1015 used
@@ -1125,6 +3217,7 @@ static int __init mk_init(void){
         if(analog_y2_direction_cfg.dir[0]<0){y2_reverse=true;} //nns:direction reversed
     }
     
+#if IS_ENABLED(CONFIG_MK_FF_GPIO)
     if(ff_cfg.nargs > 0){ //nns: force feedback support
         ff_enable=true;
         ff_gpio_strong_pin=abs(ff_cfg.pins[0]); //ff strong pin
@@ -1135,6 +3228,14 @@ static int __init mk_init(void){
         }
     }
     
+    if(ffdir_cfg.nargs > 0){ //nns: force feedback direction support
+        ff_dir_enable=true;
+        ff_gpio_dir_pin=abs(ffdir_cfg.pins[0]); //ff direction pin
+        if(ffdir_cfg.pins[0]<0){ff_gpio_dir_reverse=true;} //ff direction reverse logic
+    }
+#endif
+    
+#if IS_ENABLED(CONFIG_MK_FF_PWM)
     if(ffpwm_cfg.nargs > 1){ //nns: pwm force feedback support
         ff_pwm_enable=true;
         ff_strong_pwm=abs(ffpwm_cfg.params[1]); //ff strong pwm output
@@ -1144,12 +3245,7 @@ static int __init mk_init(void){
             if(ffpwm_cfg.params[2]<0){ff_weak_pwm_reverse=true;} //ff weak pwm reverse logic
         }
     }
-    
-    if(ffdir_cfg.nargs > 0){ //nns: force feedback direction support
-        ff_dir_enable=true;
-        ff_gpio_dir_pin=abs(ffdir_cfg.pins[0]); //ff direction pin
-        if(ffdir_cfg.pins[0]<0){ff_gpio_dir_reverse=true;} //ff direction reverse logic
-    }
+#endif
     
     x1_analog_abs_params.min = ABS_PARAMS_DEFAULT_X_MIN; //x1 analog default min value for input_set_abs_params
     x1_analog_abs_params.max = ABS_PARAMS_DEFAULT_X_MAX; //x1 analog default max value for input_set_abs_params
@@ -1200,6 +3296,56 @@ static int __init mk_init(void){
     }
     
     
+    { //platform device first, also the consumer of iio channels
+        int err;
+        err = platform_driver_register(&mk_platform_driver); //pm callbacks
+        if(err){return err;}
+        mk_pdev = platform_device_register_simple("mk_arcade_joystick_rpi", -1, NULL, 0);
+        if(IS_ERR(mk_pdev)){platform_driver_unregister(&mk_platform_driver); return PTR_ERR(mk_pdev);}
+    }
+    
+#if IS_ENABLED(CONFIG_MK_ADC_SPI)
+    if(spiadc_cfg.nargs >= 3 && gpio_backend!=GPIO_BACKEND_INJECT){ //SPI ADC, replaces I2C ADCs
+        int analog_addr[] = {analog_x1_cfg.address[0], analog_y1_cfg.address[0], analog_x2_cfg.address[0], analog_y2_cfg.address[0]};
+        
+        snprintf(spiadc_name, sizeof(spiadc_name), "spi%d.%d", spiadc_cfg.params[0], spiadc_cfg.params[1]);
+        if(spiadc_cfg.params[2] == MK_SPIADC_MCP3008 || spiadc_cfg.params[2] == MK_SPIADC_MCP3208){spiadc_type = spiadc_cfg.params[2];}
+        if(spiadc_cfg.nargs > 3 && spiadc_cfg.params[3] > 0){spiadc_speed = spiadc_cfg.params[3];}
+        spiadc_tx = kzalloc(4*MK_SPIADC_FRAME, GFP_KERNEL);
+        spiadc_rx = kzalloc(4*MK_SPIADC_FRAME, GFP_KERNEL);
+        if(spiadc_type && !spi_register_driver(&mk_spiadc_driver)){spiadc_registered = true;} //declared device probed before it returns
+        if(!spiadc_type){printk("mk_arcade_joystick_rpi: SPI ADC : unknown chip %d (3008 or 3208)\n", spiadc_cfg.params[2]);
+        }else if(!spiadc_registered){printk("mk_arcade_joystick_rpi: SPI ADC : driver registration failed\n");
+        }else if(!spiadc_dev){printk("mk_arcade_joystick_rpi: SPI ADC : %s not declared for this driver, load the mk-arcade-spiadc overlay\n", spiadc_name);
+        }else if(spiadc_tx && spiadc_rx){
+            struct mk_adc *adc = &mk_adcs[mk_adc_count++];
+            *adc = (struct mk_adc){&mk_adc_spi_ops, spiadc_dev, NULL};
+            spiadc_enable=true;
+            printk("mk_arcade_joystick_rpi: SPI ADC : MCP%d on %s, %u Hz\n", spiadc_type, spiadc_name, spiadc_speed);
+            
+            x1_enable = mk_adc_axis_init(0, adc, analog_addr[0], x1_reverse, &x1_offset);
+            y1_enable = mk_adc_axis_init(1, adc, analog_addr[1], y1_reverse, &y1_offset);
+            x2_enable = mk_adc_axis_init(2, adc, analog_addr[2], x2_reverse, &x2_offset);
+            y2_enable = mk_adc_axis_init(3, adc, analog_addr[3], y2_reverse, &y2_offset);
+        }
+        if(!spiadc_enable){mk_spiadc_exit();} //nothing usable, release the device
+    }
+#endif
+    
+#if IS_ENABLED(CONFIG_MK_ADC_IIO)
+    if(iioadc_cfg.nargs >= 1 && !spiadc_enable && gpio_backend!=GPIO_BACKEND_INJECT){ //IIO ADC, replaces I2C ADCs, the iio driver owns the bus
+        int analog_addr[] = {analog_x1_cfg.address[0], analog_y1_cfg.address[0], analog_x2_cfg.address[0], analog_y2_cfg.address[0]};
+        struct mk_adc *adc = mk_iioadc_init(&mk_pdev->dev, iioadc_cfg.params[0], analog_addr);
+        if(adc){
+            x1_enable = mk_adc_axis_init(0, adc, analog_addr[0], x1_reverse, &x1_offset);
+            y1_enable = mk_adc_axis_init(1, adc, analog_addr[1], y1_reverse, &y1_offset);
+            x2_enable = mk_adc_axis_init(2, adc, analog_addr[2], x2_reverse, &x2_offset);
+            y2_enable = mk_adc_axis_init(3, adc, analog_addr[3], y2_reverse, &y2_offset);
+            mk_iioadc_start(); //centers read on demand, then the trigger takes over
+        }
+    }
+#endif
+    
     if(i2cbus_cfg.busnum[0] >= 0){
         int rm;
         int retry;
@@ -1219,202 +3365,70 @@ static int __init mk_init(void){
         }
         
         if(i2c_dev){
-            int16_t value = 0;
             i2c_dev->timeout=1; //try to set i2c timeout to 10ms (1=10ms)
             
             //https://github.com/torvalds/linux/blob/master/drivers/i2c/i2c-dev.c:482
             printk("mk_arcade_joystick_rpi: I2C bus %d opened\n", i2cbus_cfg.busnum[0]);
             printk("mk_arcade_joystick_rpi: I2C bus timeout set to %d ms\n", (i2c_dev->timeout)*10);
             
-            if(ads1015_cfg.address[0] > 0){ //nns: add ads1015 support
-                i2c_client_x1 = i2c_new_ADS1015(i2c_dev, ads1015_cfg.address[0]);
-                if(i2c_client_x1){ads1015_enable=true;}
-            }
-            
-            if(auto_center){printk("mk_arcade_joystick_rpi: Analog auto center enable\n");
-            }else{printk("mk_arcade_joystick_rpi: Analog auto center disable\n");}
-            
-            if(!ads1015_enable&&ads1015_cfg.address[0]==0){ //use MCP3021
-                if(analog_x1_cfg.address[0] > 0){
-                    i2c_client_x1 = i2c_new_MCP3021(i2c_dev, analog_x1_cfg.address[0]);
-                    if(i2c_client_x1){
-                        printk("mk_arcade_joystick_rpi: X1 assigned to I2C address 0x%02X\n", analog_x1_cfg.address[0]);
-                        value = i2c_smbus_read_word_swapped(i2c_client_x1, 0);
-                        if(value & 0x8000){
-                            printk("mk_arcade_joystick_rpi: X1 chip not found\n");
-                            i2c_unregister_device(i2c_client_x1);
-                            i2c_client_x1 = NULL;
-                        }else{
-                            if(x1_reverse){ //nns: reverse direction
-                                printk("mk_arcade_joystick_rpi: X1 direction reversed\n");
-                                value = 4096-value; //nns: reverse 12bits value
-                            }
-                            
-                            if(value >= 0){x1_offset = value-2047;} //nns: center offset
-                            printk("mk_arcade_joystick_rpi: X1 initial value : %d (0x%04X)\n", value, value);
-                            x1_enable = true;
-                        }
-                    }
-                }
-                
-                if(analog_y1_cfg.address[0] > 0){
-                    i2c_client_y1 = i2c_new_MCP3021(i2c_dev, analog_y1_cfg.address[0]);
-                    if(i2c_client_y1){
-                        printk("mk_arcade_joystick_rpi: Y1 assigned to I2C address 0x%02X\n", analog_y1_cfg.address[0]);
-                        value = i2c_smbus_read_word_swapped(i2c_client_y1, 0);
-                        if(value & 0x8000){
-                            printk("mk_arcade_joystick_rpi: Y1 chip not found\n");
-                            i2c_unregister_device(i2c_client_y1);
-                            i2c_client_y1 = NULL;
-                        }else{
-                            if(y1_reverse){ //nns: reverse direction
-                                printk("mk_arcade_joystick_rpi: Y1 direction reversed\n");
-                                value = 4096-value; //nns: reverse 12bits value
-                            }
-                            
-                            if(value >= 0){y1_offset = value-2047;} //nns: center offset
-                            printk("mk_arcade_joystick_rpi: Y1 initial value : %d (0x%04X)\n", value, value);
-                            y1_enable = true;
-                        }
-                    }
-                }
-                
-                if(analog_x2_cfg.address[0] > 0){
-                    i2c_client_x2 = i2c_new_MCP3021(i2c_dev, analog_x2_cfg.address[0]);
-                    if(i2c_client_x2){
-                        printk("mk_arcade_joystick_rpi: X2 assigned to I2C address 0x%02X\n", analog_x2_cfg.address[0]);
-                        value = i2c_smbus_read_word_swapped(i2c_client_x2, 0);
-                        if(value & 0x8000){
-                            printk("mk_arcade_joystick_rpi: X2 chip not found\n");
-                            i2c_unregister_device(i2c_client_x2);
-                            i2c_client_x2 = NULL;
-                        }else{
-                            if(x2_reverse){ //nns: reverse direction
-                                printk("mk_arcade_joystick_rpi: X2 direction reversed\n");
-                                value = 4096-value; //nns: reverse 12bits value
-                            }
-                            
-                            if(value >= 0){x2_offset = value-2047;} //nns: center offset
-                            printk("mk_arcade_joystick_rpi: X2 initial value : %d (0x%04X)\n", value, value);
-                            x2_enable = true;
-                        }
-                    }
-                }
-                
-                if(analog_y2_cfg.address[0] > 0){
-                    i2c_client_y2 = i2c_new_MCP3021(i2c_dev, analog_y2_cfg.address[0]);
-                    if(i2c_client_y2){
-                        printk("mk_arcade_joystick_rpi: Y2 assigned to I2C address 0x%02X\n", analog_y2_cfg.address[0]);
-                        value = i2c_smbus_read_word_swapped(i2c_client_y2, 0);
-                        if(value & 0x8000){
-                            printk("mk_arcade_joystick_rpi: Y2 chip not found\n");
-                            i2c_unregister_device(i2c_client_y2);
-                            i2c_client_y2 = NULL;
-                        }else{
-                            if(y2_reverse){ //nns: reverse direction
-                                printk("mk_arcade_joystick_rpi: Y2 direction reversed\n");
-                                value = 4096-value; //nns: reverse 12bits value
-                            }
-                            
-                            if(value >= 0){y2_offset = value-2047;} //nns: center offset
-                            printk("mk_arcade_joystick_rpi: Y2 initial value : %d (0x%04X)\n", value, value);
-                            y2_enable = true;
-                        }
-                    }
-                }
-            }else if(ads1015_enable){ //use ads1015
-                printk("mk_arcade_joystick_rpi: ADS1015 I2C address 0x%02X\n", ads1015_cfg.address[0]);
-                
-                if(analog_x1_cfg.address[0] >= 0 && analog_x1_cfg.address[0] < 4){
-                    ads1015_lookup[0]=analog_x1_cfg.address[0];
-                    value = ADS1015_read(i2c_client_x1,0);
-                    if(value>=0){
-                        printk("mk_arcade_joystick_rpi: X1 assigned to AIN%d\n", analog_x1_cfg.address[0]);
-                        if(x1_reverse){ //nns: reverse direction
-                            printk("mk_arcade_joystick_rpi: X1 direction reversed\n");
-                            value = 4096-value; //nns: reverse 12bits value
-                        }
-                        x1_offset = value-2047; //nns: center offset
-                        printk("mk_arcade_joystick_rpi: X1 initial value : %d (0x%04X)\n", value, value);
-                        x1_enable = true;
-                    }else{
-                        printk("mk_arcade_joystick_rpi: X1 failed, disabled\n");
-                        if(debug_mode>0){printk("mk_arcade_joystick_rpi: DEBUG : returned %i\n",value);}
-                        ads1015_lookup[0]=-1;
-                    }
-                }
-                
-                if(analog_y1_cfg.address[0] >= 0 && analog_y1_cfg.address[0] < 4){
-                    ads1015_lookup[1]=analog_y1_cfg.address[0];
-                    value = ADS1015_read(i2c_client_x1,1);
-                    if(value>=0){
-                        printk("mk_arcade_joystick_rpi: Y1 assigned to AIN%d\n", analog_y1_cfg.address[0]);
-                        if(y1_reverse){ //nns: reverse direction
-                            printk("mk_arcade_joystick_rpi: Y1 direction reversed\n");
-                            value = 4096-value; //nns: reverse 12bits value
-                        }
-                        y1_offset = value-2047; //nns: center offset
-                        printk("mk_arcade_joystick_rpi: Y1 initial value : %d (0x%04X)\n", value, value);
-                        y1_enable = true;
-                    }else{
-                        printk("mk_arcade_joystick_rpi: Y1 failed, disabled\n");
-                        if(debug_mode>0){printk("mk_arcade_joystick_rpi: returned %i\n",value);}
-                        ads1015_lookup[1]=-1;
-                    }
-                }
+            if(!spiadc_enable && !iioadc_enable){ //I2C ADCs, unless analog is on spi or iio
+                const struct mk_adc_ops *ops = NULL;
+                int address = 0;
+#if IS_ENABLED(CONFIG_MK_ADC_ADS1X15)
+                bool ads1x15 = true;
+                if(ads1015_cfg.address[0] > 0){ops = &mk_adc_ads1015_ops; address = ads1015_cfg.address[0]; //nns: add ads1015 support
+                }else if(ads1115_cfg.address[0] > 0){ops = &mk_adc_ads1115_ops; address = ads1115_cfg.address[0];
+                }else{ads1x15 = false;}
+#endif
+#if IS_ENABLED(CONFIG_MK_ADC_ADS7830)
+                if(!ops && ads7830_cfg.address[0] > 0){ops = &mk_adc_ads7830_ops; address = ads7830_cfg.address[0];}
+#endif
                 
-                if(analog_x2_cfg.address[0] >= 0 && analog_x2_cfg.address[0] < 4){
-                    ads1015_lookup[2]=analog_x2_cfg.address[0];
-                    value = ADS1015_read(i2c_client_x1,2);
-                    if(value>=0){
-                        printk("mk_arcade_joystick_rpi: X2 assigned to AIN%d\n", analog_x2_cfg.address[0]);
-                        if(x2_reverse){ //nns: reverse direction
-                            printk("mk_arcade_joystick_rpi: X2 direction reversed\n");
-                            value = 4096-value; //nns: reverse 12bits value
+                if(ops){ //multi channel chip, axis address is the channel
+                    struct mk_adc *adc = mk_adc_new_i2c(i2c_dev, ops, address);
+#if IS_ENABLED(CONFIG_MK_ADC_ADS1X15)
+                    if(adc && ads1x15){ //ADS1x15 full scale and rate, before the first conversion
+                        static const char *names[] = {"X1", "Y1", "X2", "Y2"};
+                        struct ads_axis_config *ads_cfg[] = {&ads_x1_cfg, &ads_y1_cfg, &ads_x2_cfg, &ads_y2_cfg};
+                        int analog_addr[] = {analog_x1_cfg.address[0], analog_y1_cfg.address[0], analog_x2_cfg.address[0], analog_y2_cfg.address[0]};
+                        int i, rate;
+                        adc->priv = &ads1x15_priv; //zero config is the default one, codes kept for the comparator
+                        for(i=0;i<4;i++){
+                            if(ads_cfg[i]->nargs == 0 || analog_addr[i] < 0 || analog_addr[i] > 3){continue;}
+                            rate = mk_ads1x15_setup(&ads1x15_priv, analog_addr[i], ops == &mk_adc_ads1115_ops, ads_cfg[i]->params[0], ads_cfg[i]->nargs > 1 ? ads_cfg[i]->params[1] : INT_MAX, ads_cfg[i]->nargs > 2 ? ads_cfg[i]->params[2] : ADS_DEFAULT_SUPPLY);
+                            if(rate < 0){printk("mk_arcade_joystick_rpi: %s : no +-%d mV full scale, default kept\n", names[i], ads_cfg[i]->params[0]); continue;}
+                            printk("mk_arcade_joystick_rpi: %s : +-%d mV, %d SPS, %u us per conversion\n", names[i], ads_cfg[i]->params[0], rate, ads1x15_priv.conv_us[analog_addr[i]]);
                         }
-                        x2_offset = value-2047; //nns: center offset
-                        printk("mk_arcade_joystick_rpi: X2 initial value : %d (0x%04X)\n", value, value);
-                        x2_enable = true;
-                    }else{
-                        printk("mk_arcade_joystick_rpi: X2 failed, disabled\n");
-                        if(debug_mode>0){printk("mk_arcade_joystick_rpi: returned %i\n",value);}
-                        ads1015_lookup[2]=-1;
                     }
-                }
-                
-                if(analog_y2_cfg.address[0] >= 0 && analog_y2_cfg.address[0] < 4){
-                    ads1015_lookup[3]=analog_y2_cfg.address[0];
-                    value = ADS1015_read(i2c_client_x1,3);
-                    if(value>=0){
-                        printk("mk_arcade_joystick_rpi: Y2 assigned to AIN%d\n", analog_y2_cfg.address[0]);
-                        if(y2_reverse){ //nns: reverse direction
-                            printk("mk_arcade_joystick_rpi: Y2 direction reversed\n");
-                            value = 4096-value; //nns: reverse 12bits value
+#endif
+                    x1_enable = mk_adc_axis_init(0, adc, analog_x1_cfg.address[0], x1_reverse, &x1_offset);
+                    y1_enable = mk_adc_axis_init(1, adc, analog_y1_cfg.address[0], y1_reverse, &y1_offset);
+                    x2_enable = mk_adc_axis_init(2, adc, analog_x2_cfg.address[0], x2_reverse, &x2_offset);
+                    y2_enable = mk_adc_axis_init(3, adc, analog_y2_cfg.address[0], y2_reverse, &y2_offset);
+#if IS_ENABLED(CONFIG_MK_ADC_ADS1X15)
+                    if(adc && ads1x15 && ads_rest_cfg.nargs > 0){ //comparator rest, ALERT irq requested with the wake pins
+                        int i;
+                        for(i=0;i<4;i++){
+                            if(mk_adc_axes[i].adc != adc){continue;}
+                            ads_rest_axes |= 1U << i;
+                            ads_rest_channels |= 1U << mk_adc_axes[i].channel;
                         }
-                        y2_offset = value-2047; //nns: center offset
-                        printk("mk_arcade_joystick_rpi: Y2 initial value : %d (0x%04X)\n", value, value);
-                        y2_enable = true;
-                    }else{
-                        printk("mk_arcade_joystick_rpi: Y2 failed, disabled\n");
-                        if(debug_mode>0){printk("mk_arcade_joystick_rpi: returned %i\n",value);}
-                        ads1015_lookup[3]=-1;
+                        if(ads_rest_axes){ads_rest_adc = adc;}
                     }
+#endif
+#if IS_ENABLED(CONFIG_MK_ADC_MCP3021)
+                }else{ //one MCP3021 per axis
+                    if(analog_x1_cfg.address[0] > 0){x1_enable = mk_adc_axis_init(0, mk_adc_new_i2c(i2c_dev, &mk_adc_mcp3021_ops, analog_x1_cfg.address[0]), 0, x1_reverse, &x1_offset);}
+                    if(analog_y1_cfg.address[0] > 0){y1_enable = mk_adc_axis_init(1, mk_adc_new_i2c(i2c_dev, &mk_adc_mcp3021_ops, analog_y1_cfg.address[0]), 0, y1_reverse, &y1_offset);}
+                    if(analog_x2_cfg.address[0] > 0){x2_enable = mk_adc_axis_init(2, mk_adc_new_i2c(i2c_dev, &mk_adc_mcp3021_ops, analog_x2_cfg.address[0]), 0, x2_reverse, &x2_offset);}
+                    if(analog_y2_cfg.address[0] > 0){y2_enable = mk_adc_axis_init(3, mk_adc_new_i2c(i2c_dev, &mk_adc_mcp3021_ops, analog_y2_cfg.address[0]), 0, y2_reverse, &y2_offset);}
+#endif
                 }
             }
             
-            if(!auto_center){ //nns: if auto center disable, reset all offset
-                if(x1_enable){x1_offset=(((x1_analog_abs_params.max-x1_analog_abs_params.min)/2)+x1_analog_abs_params.min)-2047;} //nns: compute offset based on min and max
-                if(y1_enable){y1_offset=(((y1_analog_abs_params.max-y1_analog_abs_params.min)/2)+y1_analog_abs_params.min)-2047;} //nns: compute offset based on min and max
-                if(x2_enable){x2_offset=(((x2_analog_abs_params.max-x2_analog_abs_params.min)/2)+x2_analog_abs_params.min)-2047;} //nns: compute offset based on min and max
-                if(y2_enable){y2_offset=(((y2_analog_abs_params.max-y2_analog_abs_params.min)/2)+y2_analog_abs_params.min)-2047;} //nns: compute offset based on min and max
-            }
-            
-            if(x1_enable){printk("mk_arcade_joystick_rpi: X1 offset : %d\n", x1_offset);}
-            if(y1_enable){printk("mk_arcade_joystick_rpi: Y1 offset : %d\n", y1_offset);}
-            if(x2_enable){printk("mk_arcade_joystick_rpi: X2 offset : %d\n", x2_offset);}
-            if(y2_enable){printk("mk_arcade_joystick_rpi: Y2 offset : %d\n", y2_offset);}
-            
+#if IS_ENABLED(CONFIG_MK_FF_PWM)
             if(ff_pwm_enable){ //nns: add PCA9633 support for force feedback
+                int16_t value;
                 pca9633_client = i2c_new_PCA9633(i2c_dev, ffpwm_cfg.params[0]);
                 if(pca9633_client){
                     printk("mk_arcade_joystick_rpi: PCA9633 assigned to I2C address 0x%02X\n", ffpwm_cfg.params[0]);
@@ -1457,86 +3471,241 @@ static int __init mk_init(void){
                     ff_pwm_enable=false;
                 }
             }
+#endif
         }else{
             printk("mk_arcade_joystick_rpi ERROR: I2C bus %d NOT opened (make sure that I2C is enabled and loaded before this driver)\n", i2cbus_cfg.busnum[0]);
         }
     }else{
+#if IS_ENABLED(CONFIG_MK_FF_PWM)
         ff_pwm_enable=false; //nns: disable pwm force feedback is no I2C bus set
+#endif
+    }
+    
+    if(x1_enable||y1_enable||x2_enable||y2_enable){
+        if(auto_center){printk("mk_arcade_joystick_rpi: Analog auto center enable\n");
+        }else{ //nns: if auto center disable, reset all offset
+            printk("mk_arcade_joystick_rpi: Analog auto center disable\n");
+            if(x1_enable){x1_offset=(((x1_analog_abs_params.max-x1_analog_abs_params.min)/2)+x1_analog_abs_params.min)-2047;} //nns: compute offset based on min and max
+            if(y1_enable){y1_offset=(((y1_analog_abs_params.max-y1_analog_abs_params.min)/2)+y1_analog_abs_params.min)-2047;} //nns: compute offset based on min and max
+            if(x2_enable){x2_offset=(((x2_analog_abs_params.max-x2_analog_abs_params.min)/2)+x2_analog_abs_params.min)-2047;} //nns: compute offset based on min and max
+            if(y2_enable){y2_offset=(((y2_analog_abs_params.max-y2_analog_abs_params.min)/2)+y2_analog_abs_params.min)-2047;} //nns: compute offset based on min and max
+        }
+        
+        if(x1_enable){printk("mk_arcade_joystick_rpi: X1 offset : %d\n", x1_offset);}
+        if(y1_enable){printk("mk_arcade_joystick_rpi: Y1 offset : %d\n", y1_offset);}
+        if(x2_enable){printk("mk_arcade_joystick_rpi: X2 offset : %d\n", x2_offset);}
+        if(y2_enable){printk("mk_arcade_joystick_rpi: Y2 offset : %d\n", y2_offset);}
+    }
+    
+    if(gpio_backend==GPIO_BACKEND_INJECT){ //injection: axes with an address set are fed from samples, offset from min and max
+        if(analog_x1_cfg.address[0] >= 0){x1_enable = true; x1_offset=(((x1_analog_abs_params.max-x1_analog_abs_params.min)/2)+x1_analog_abs_params.min)-2047;}
+        if(analog_y1_cfg.address[0] >= 0){y1_enable = true; y1_offset=(((y1_analog_abs_params.max-y1_analog_abs_params.min)/2)+y1_analog_abs_params.min)-2047;}
+        if(analog_x2_cfg.address[0] >= 0){x2_enable = true; x2_offset=(((x2_analog_abs_params.max-x2_analog_abs_params.min)/2)+x2_analog_abs_params.min)-2047;}
+        if(analog_y2_cfg.address[0] >= 0){y2_enable = true; y2_offset=(((y2_analog_abs_params.max-y2_analog_abs_params.min)/2)+y2_analog_abs_params.min)-2047;}
+        if(x1_enable){printk("mk_arcade_joystick_rpi: X1 injected, offset : %d\n", x1_offset);}
+        if(y1_enable){printk("mk_arcade_joystick_rpi: Y1 injected, offset : %d\n", y1_offset);}
+        if(x2_enable){printk("mk_arcade_joystick_rpi: X2 injected, offset : %d\n", x2_offset);}
+        if(y2_enable){printk("mk_arcade_joystick_rpi: Y2 injected, offset : %d\n", y2_offset);}
     }
     
     
+    mk_profile_init();
+    mk_hotpath_init();
+    
     if(mk_cfg.nargs < 1){
         pr_err("at least one device must be specified\n");
+        mk_iioadc_exit();
+        mk_spiadc_exit();
+        platform_device_unregister(mk_pdev);
+        platform_driver_unregister(&mk_platform_driver);
         return -EINVAL;
     }else{
+        pm_runtime_set_active(&mk_pdev->dev); //chips are powered at this point
+        pm_runtime_set_autosuspend_delay(&mk_pdev->dev, MK_AUTOSUSPEND_DELAY);
+        pm_runtime_use_autosuspend(&mk_pdev->dev);
+        pm_runtime_enable(&mk_pdev->dev);
+        
         mk_base = mk_probe(mk_cfg.args, mk_cfg.nargs); //jump
-        if(IS_ERR(mk_base)){return -ENODEV;}
+        if(IS_ERR(mk_base)){
+            pm_runtime_disable(&mk_pdev->dev);
+            mk_iioadc_exit();
+            mk_spiadc_exit();
+            platform_device_unregister(mk_pdev);
+            platform_driver_unregister(&mk_platform_driver);
+            return -ENODEV;
+        }
+        
+        pm_runtime_get_noresume(&mk_pdev->dev);
+        pm_runtime_put_autosuspend(&mk_pdev->dev); //autosuspend until first input client
+    }
+    
+    if(idle_enable){ //adaptive polling wake pins
+        int i;
+        for(i=0;i<idle_wake_cfg.nargs;i++){mk_wake_pin_add(abs(idle_wake_cfg.pins[i]), false);}
+    }
+    
+    if(wake_cfg.nargs > 0){ //system wake pins
+        int i;
+        for(i=0;i<wake_cfg.nargs;i++){mk_wake_pin_add(abs(wake_cfg.pins[i]), true);}
+    }else if(mk_base->pads[0].dev){ //default to hotkey and start pins
+        if(mk_base->pads[0].gpio_maps[12]!=-1){mk_wake_pin_add(abs(mk_base->pads[0].gpio_maps[12]), true);}
+        if(mk_base->pads[0].gpio_maps[4]!=-1){mk_wake_pin_add(abs(mk_base->pads[0].gpio_maps[4]), true);}
+    }
+    device_init_wakeup(&mk_pdev->dev, wake_irq_count>0);
+    
+    if(device_create_file(&mk_pdev->dev, &dev_attr_turbo)){printk("mk_arcade_joystick_rpi: Turbo : sysfs failed\n");} //turbo buttons, none until written
+    if(device_add_group(&mk_pdev->dev, &mk_profile_group)){printk("mk_arcade_joystick_rpi: Profiles : sysfs failed\n");} //default profile only until edited
+    
+    if(combo_cfg.nargs > 0){ //hotkey actions
+        int err = mk_combo_init();
+        if(err){printk("mk_arcade_joystick_rpi: Hotkey actions : input device failed : %d\n", err);}
+    }
+    
+    if(fwconfig_cfg.nargs > 0 && fwconfig_cfg.enable[0] > 0){ //config blob, never waits for the root filesystem
+        int err = request_firmware_nowait(THIS_MODULE, FW_ACTION_UEVENT, MK_CONFIG_FILE, &mk_pdev->dev, GFP_KERNEL, NULL, mk_config_loaded);
+        if(err){printk("mk_arcade_joystick_rpi: Config : request failed : %d\n", err);}
+    }
+    
+    if(x1_enable||y1_enable||x2_enable||y2_enable||gpio_backend==GPIO_BACKEND_INJECT){ //response curves, linear until written
+        int err = device_add_group(&mk_pdev->dev, &mk_curve_group);
+        if(err){printk("mk_arcade_joystick_rpi: Response curves : sysfs failed : %d\n", err);}else{mk_curve_enable=true;}
+    }
+    
+#if IS_ENABLED(CONFIG_MK_ADC_ADS1X15)
+    if(ads_rest_adc){ //ADS1x15 comparator rest, ALERT is open drain active low
+        int err, irq = mk_pin_to_irq(abs(ads_rest_cfg.params[0]), &ads_rest_descs);
+        err = irq < 0 ? irq : request_irq(irq, mk_ads_alert_irq, IRQF_TRIGGER_FALLING, "mk_arcade_joystick_rpi", mk_pdev);
+        if(err){
+            printk("mk_arcade_joystick_rpi: ADS rest : no irq for ALERT pin %d : %d, disabled\n", abs(ads_rest_cfg.params[0]), err);
+            if(ads_rest_descs){gpiod_put_array(ads_rest_descs); ads_rest_descs = NULL;}
+            ads_rest_adc = NULL;
+        }else{
+            ads_rest_irq = irq;
+            ads_rest_timeout = msecs_to_jiffies(ads_rest_cfg.nargs > 1 && ads_rest_cfg.params[1] > 0 ? ads_rest_cfg.params[1] : ADS_REST_DEFAULT_TIME);
+            if(ads_rest_cfg.nargs > 2 && ads_rest_cfg.params[2] > 0){ads_rest_window = min(ads_rest_cfg.params[2], 1024);}
+            ads_rest_since = jiffies;
+            static_branch_enable(&mk_ads_rest_key);
+            printk("mk_arcade_joystick_rpi: ADS rest : ALERT pin %d (irq %d), after %u ms, window +-%d\n", abs(ads_rest_cfg.params[0]), irq, jiffies_to_msecs(ads_rest_timeout), ads_rest_window);
+        }
+    }
+#endif
+    
+    if(capture_cfg.nargs > 0 && capture_cfg.size[0] > 0){ //raw sample capture
+        int i, err;
+        for(i=0;i<MK_MAX_DEVICES;i++){
+            if(!mk_base->pads[i].dev){continue;}
+            err = mk_capture_add(i, capture_cfg.size[0]);
+            if(err){printk("mk_arcade_joystick_rpi: Capture : pad%d failed : %d\n", i, err);}else{capture_enable=true;}
+        }
+        if(capture_enable){static_branch_enable(&mk_capture_key);}
+    }
+    
+    if(gpio_backend==GPIO_BACKEND_INJECT){ //raw sample injection
+        int i, err;
+        for(i=0;i<MK_MAX_DEVICES;i++){
+            if(!mk_base->pads[i].dev){continue;}
+            err = mk_inject_add(i);
+            if(err){printk("mk_arcade_joystick_rpi: Inject : pad%d failed : %d\n", i, err);}else{inject_enable=true;}
+        }
     }
     
+    mk_debugfs_dir=debugfs_create_dir("mk_arcade_joystick_rpi", NULL);
+    debugfs_create_file("poll_stats", 0444, mk_debugfs_dir, NULL, &mk_poll_stats_fops);
+    debugfs_create_file("pm_stats", 0444, mk_debugfs_dir, NULL, &mk_pm_stats_fops);
+    if(capture_enable){debugfs_create_file("capture_stats", 0444, mk_debugfs_dir, NULL, &mk_capture_stats_fops);}
+    if(inject_enable){debugfs_create_file("inject_stats", 0444, mk_debugfs_dir, NULL, &mk_inject_stats_fops);}
+#if IS_ENABLED(CONFIG_MK_ADC_IIO)
+    if(iioadc_enable){debugfs_create_file("iio_stats", 0444, mk_debugfs_dir, NULL, &mk_iio_stats_fops);}
+#endif
+    if(adc_filter_enable){debugfs_create_file("filter_stats", 0444, mk_debugfs_dir, NULL, &mk_filter_stats_fops);}
+#if IS_ENABLED(CONFIG_MK_ADC_ADS1X15)
+    if(ads_rest_adc){debugfs_create_file("ads_rest_stats", 0444, mk_debugfs_dir, NULL, &mk_ads_rest_stats_fops);}
+#endif
+    
     return 0;
 }
 
 static void __exit mk_exit(void){
+    int i;
+    
+    debugfs_remove_recursive(mk_debugfs_dir);
+    if(mk_curve_enable){device_remove_group(&mk_pdev->dev, &mk_curve_group);}
+    device_remove_file(&mk_pdev->dev, &dev_attr_turbo);
+    device_remove_group(&mk_pdev->dev, &mk_profile_group);
+    if(mk_combo_dev){ //before pads, closing it may stop polling
+        device_remove_file(&mk_pdev->dev, &dev_attr_combos);
+        static_branch_disable(&mk_combo_key);
+        spin_lock_irq(&mk_turbo_lock); spin_unlock_irq(&mk_turbo_lock); //report in progress done
+        input_unregister_device(mk_combo_dev);
+    }
+    device_init_wakeup(&mk_pdev->dev, false);
+    for(i=0;i<wake_irq_count;i++){
+        free_irq(wake_irq[i], mk_pdev);
+        if(wake_descs[i]){gpiod_put_array(wake_descs[i]);}
+    }
+#if IS_ENABLED(CONFIG_MK_ADC_ADS1X15)
+    if(ads_rest_irq>=0){free_irq(ads_rest_irq, mk_pdev);}
+    if(ads_rest_descs){gpiod_put_array(ads_rest_descs);}
+#endif
+    
+    for(i=0;i<MK_MAX_DEVICES;i++){ //capture and injection devices, open files keep the module
+        if(mk_captures[i].ring){misc_deregister(&mk_captures[i].misc);}
+        if(mk_injects[i].misc.this_device){misc_deregister(&mk_injects[i].misc);}
+    }
+    
     if(mk_base){mk_remove(mk_base);}
     
+    for(i=0;i<MK_MAX_DEVICES;i++){vfree(mk_captures[i].ring);} //polling stopped
+    mk_profiles_free(mk_profiles); //response curves, polling stopped
+    
+    pm_runtime_dont_use_autosuspend(&mk_pdev->dev);
+    pm_runtime_disable(&mk_pdev->dev);
+    mk_hw_resume(); //chips may be autosuspended
+#if IS_ENABLED(CONFIG_MK_ADC_ADS1X15)
+    if(ads_rest_adc && ((struct mk_ads1x15_priv *)ads_rest_adc->priv)->resting){mk_ads1x15_wake(ads_rest_adc);} //comparator off, chip powered down
+#endif
+    
     printk("mk_arcade_joystick_rpi: Exiting\n");
     
-    if(ads1015_enable && i2c_client_x1 != NULL){i2c_unregister_device(i2c_client_x1);} //nns: add ads1015 support
+    for(i=0;i<mk_adc_count;i++){ //adc chips
+        if(!mk_adcs[i].ops->read_all){i2c_unregister_device(mk_adcs[i].client);} //i2c chips, spi and iio ones read all channels at once
+    }
+    mk_iioadc_exit(); //iio adc
+    mk_spiadc_exit(); //spi adc
     
     if(x1_enable){
-        if(!ads1015_enable && i2c_client_x1 != NULL){i2c_unregister_device(i2c_client_x1);}
         printk("mk_arcade_joystick_rpi: X1 limits : min: %d (0x%04X), max: %d (0x%04X) : x1params=%d,%d,%d,%d\n", x1_min, x1_min, x1_max, x1_max   ,x1_min,x1_max,x1_analog_abs_params.fuzz,x1_analog_abs_params.flat); //nns: add config format
     }
     
     if(y1_enable){
-        if(!ads1015_enable && i2c_client_y1 != NULL){i2c_unregister_device(i2c_client_y1);}
         printk("mk_arcade_joystick_rpi: Y1 limits : min: %d (0x%04X), max: %d (0x%04X) : y1params=%d,%d,%d,%d\n", y1_min, y1_min, y1_max, y1_max   ,y1_min,y1_max,y1_analog_abs_params.fuzz,y1_analog_abs_params.flat); //nns: add config format
     }
     
     if(x2_enable){
-        if(!ads1015_enable && i2c_client_x2 != NULL){i2c_unregister_device(i2c_client_x2);}
         printk("mk_arcade_joystick_rpi: X2 limits : min: %d (0x%04X), max: %d (0x%04X) : x2params=%d,%d,%d,%d\n", x2_min, x2_min, x2_max, x2_max   ,x2_min,x2_max,x2_analog_abs_params.fuzz,x2_analog_abs_params.flat); //nns: add config format
     }
     
     if(y2_enable){
-        if(!ads1015_enable && i2c_client_y2 != NULL){i2c_unregister_device(i2c_client_y2);}
         printk("mk_arcade_joystick_rpi: Y2 limits : min: %d (0x%04X), max: %d (0x%04X) : y2params=%d,%d,%d,%d\n", y2_min, y2_min, y2_max, y2_max   ,y2_min,y2_max,y2_analog_abs_params.fuzz,y2_analog_abs_params.flat); //nns: add config format
     }
     
     //nns: force feedback
-    if(ff_enable){
-        if(ff_gpio_strong_pin!=-1){ //gpio strong
-            if(ff_effect_strong_reverse){GpioOuputSet(ff_gpio_strong_pin); //reverse logic, set high
-            }else{GpioOuputClr(ff_gpio_strong_pin);} //set low
-        }
-        if(ff_gpio_weak_pin!=-1){ //gpio weak
-            if(ff_effect_weak_reverse){GpioOuputSet(ff_gpio_weak_pin); //reverse logic, set high
-            }else{GpioOuputClr(ff_gpio_weak_pin);} //set low
-        }
-    }
-    
-    if(ff_dir_enable){
-        if(ff_gpio_dir_pin!=-1){ //gpio dir
-            if(ff_gpio_dir_reverse){GpioOuputSet(ff_gpio_dir_pin); //reverse logic, set high
-            }else{GpioOuputClr(ff_gpio_dir_pin);} //set low
-        }
-    }
+    mk_ff_off();
     
+#if IS_ENABLED(CONFIG_MK_FF_PWM)
     if(ff_pwm_enable && pca9633_client != NULL){ //nns: add PCA9633 support
-        if(ff_strong_pwm!=-1){ //pwm strong
-            if(ff_strong_pwm_reverse){i2c_smbus_write_byte_data(pca9633_client,(uint8_t)(ff_strong_pwm+2),(uint8_t)0xFF); //send pwm to i2c, reverse logic, set 0xFF
-            }else{i2c_smbus_write_byte_data(pca9633_client,(uint8_t)(ff_strong_pwm+2),(uint8_t)0x00);} //send pwm to i2c, set 0x00
-        }
-        if(ff_weak_pwm!=-1){ //pwm weak
-            if(ff_weak_pwm_reverse){i2c_smbus_write_byte_data(pca9633_client,(uint8_t)(ff_weak_pwm+2),(uint8_t)0xFF); //send pwm to i2c, reverse logic, set 0xFF
-            }else{i2c_smbus_write_byte_data(pca9633_client,(uint8_t)(ff_weak_pwm+2),(uint8_t)0x00);} //send pwm to i2c, set 0x00
-        }
         i2c_smbus_write_byte_data(pca9633_client,(uint8_t)0x08,(uint8_t)pca9633_ledout_backup); //send ledout to i2c
         i2c_unregister_device(pca9633_client);
         printk("mk_arcade_joystick_rpi: PCA9633 LEDOUT restored : 0x%02X\n",pca9633_ledout_backup);
     }
+#endif
+    
+    for(i=0;i<gpiod_out_count;i++){gpiod_put_array(gpiod_out_descs[i]);} //gpiolib backend: force feedback lines
+    
+    platform_device_unregister(mk_pdev);
+    platform_driver_unregister(&mk_platform_driver);
     
-    iounmap(gpio);
+    if(gpio_backend==GPIO_BACKEND_RAW){iounmap(gpio);}
 }
 
 module_init(mk_init);
@@ -0,0 +1,778 @@
+/*
+ *  Arcade Joystick Driver for RaspberryPi, core logic
+ *
+ *  Button decoding, hotkey handling, ADC chips and read scheduling, analog
+ *  calibration and force feedback decisions, shared by the kernel module and
+ *  the userspace simulation harness in tests/. Nothing in here may use a
+ *  kernel API directly: the includer provides mk_i2c_read_word(),
+ *  mk_i2c_write_word(), mk_i2c_read_byte() and mk_udelay(), or defines
+ *  MK_CORE_NO_I2C when only the capture format is needed.
+ */
+
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef MK_ARCADE_JOYSTICK_RPI_CORE_H
+#define MK_ARCADE_JOYSTICK_RPI_CORE_H
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#endif
+
+// Build options, the Makefile defines CONFIG_MK_OPTIONS then one CONFIG_MK_* per part kept; everything is built without it
+#ifndef CONFIG_MK_OPTIONS
+#define CONFIG_MK_ADC_MCP3021 1 //MCP3021 i2c ADC
+#define CONFIG_MK_ADC_ADS1X15 1 //ADS1015/ADS1115 i2c ADC, comparator rest
+#define CONFIG_MK_ADC_ADS7830 1 //ADS7830 i2c ADC
+#define CONFIG_MK_ADC_SPI 1 //MCP3008/MCP3208 spi ADC
+#define CONFIG_MK_ADC_IIO 1 //IIO channels, also needs CONFIG_IIO
+#define CONFIG_MK_FF_GPIO 1 //rumble motors on gpio
+#define CONFIG_MK_FF_PWM 1 //rumble motors on PCA9633 pwm
+#define CONFIG_MK_DEBUG 1 //debug= output and debug=2 benchmark
+#endif
+
+#define MK_MAX_BUTTONS  21 //13
+
+// Hotkey
+#define HOTKEY_MODE_UNDEFINED   0
+#define HOTKEY_MODE_NORMAL      1
+#define HOTKEY_MODE_TOGGLE      2
+#define HOTKEY_BUTTON           12 //data[] index of the hotkey (BTN_MODE)
+
+struct mk_hotkey { //toggle hotkey state machine
+    unsigned char state_prev; //last hotkey pin state, 0xFF before first read
+    unsigned char pre_mode; //hotkey pressed, waiting for a combo button
+    int combo_btn; //button used with the hotkey, -1 if none
+    unsigned long turbo_armed; //buttons with a turbo rate, their combo toggles turbo instead of reaching userspace
+    unsigned long turbo_off; //armed buttons switched off by a combo
+    int hidden_btn; //button of a turbo or action combo, hidden until released, -1 if none
+    unsigned long action_armed; //buttons with a combo action, their hotkey combo emits the action key instead
+    int action_btn; //button of the action combo held, -1 if none
+};
+
+#define MK_MAX_COMBOS 8
+#define MK_COMBO_MAX_HOLD 10000 //msec
+#define MK_COMBO_PROFILE 0x1000 //combo codes from here switch to profile code - MK_COMBO_PROFILE, no key sent
+#define MK_TURBO_MAX_RATE 60 //Hz, a press and a release every frame
+#define MK_MAX_PROFILES 4
+struct mk_combo { //action key of the hotkeys input device
+    int btn; //data[] index
+    unsigned int hold_ms; //0 for a hotkey combo (toggle mode), else the button held alone that long
+    unsigned int code; //KEY_*
+};
+
+struct mk_combo_state { //action lookup, one per pad
+    unsigned long pressed; //buttons at last lookup
+    int pending; //long press combo waiting for its hold time, -1 if none
+    unsigned int held_us; //time the pending button has been held
+    int active; //combo whose key is down, -1 if none
+};
+
+
+// Analog
+struct analog_abs_params_struct {int min, max, fuzz, flat;};
+
+struct mk_adc;
+
+struct mk_adc_ops { //one converter chip type
+    const char *name; //also the i2c device name
+    int channels; //single-ended inputs
+    int resolution; //bits of the values returned, scaled to the axis resolution by the scheduler
+    unsigned int conv_us; //default wait between start() and read()
+    int (*start)(struct mk_adc *adc, int channel); //start a conversion, returns the wait in usec, NULL if read() converts by itself
+    int (*read)(struct mk_adc *adc, int channel); //value, negative on error
+    int (*read_all)(struct mk_adc *adc, const int *channels, int16_t *values, int count); //all channels in one transfer, NULL if not supported
+};
+
+struct mk_adc { //one converter chip instance
+    const struct mk_adc_ops *ops;
+    void *client; //bus handle, i2c_client or spi_device
+    void *priv; //backend data
+};
+
+struct mk_adc_axis { //where an axis is read
+    struct mk_adc *adc; //NULL if the axis is not used
+    int channel;
+    int oversample; //conversions averaged per poll, 0 or 1 for a single one
+    int shift; //axis bits over 12, values and reported range are 4096 << shift wide
+};
+
+#define MK_ADC_MAX_AXES 4 //x1,y1,x2,y2
+#define MK_AXIS_BITS_MAX 15 //int16_t axis values, ADS1115 single-ended codes have 15bits
+
+static inline int mk_adc_axis_shift(const struct mk_adc *adc){ //resolution kept for an axis on adc, calibration parameters stay 12bits
+    int bits = adc ? adc->ops->resolution : 12;
+    if(bits > MK_AXIS_BITS_MAX){bits = MK_AXIS_BITS_MAX;}
+    return bits > 12 ? bits - 12 : 0;
+}
+
+// Analog pre-filter, median of the last raw values of an axis, before calibration
+#define MK_FILTER_MEDIAN_MAX 5 //longest median window
+#define MK_FILTER_OVERSAMPLE_MAX 16 //most conversions per poll
+#define MK_FILTER_OUTLIER 128 //raw sample this far from the median counts as rejected, 12bits units
+struct mk_adc_filter {
+    int median; //window, odd, 1 or less disables the filter
+    int pos; //next ring slot
+    int count; //values in the ring, up to median
+    int16_t ring[MK_FILTER_MEDIAN_MAX];
+    unsigned int rejected; //outliers replaced by the median
+    int shift; //axis bits over 12
+};
+
+// Adaptive smoothing, 1 euro filter: low cutoff while the stick is still, raised with its speed
+#define MK_SMOOTH_CUTOFF_MAX 10000 //centiHz, 100Hz, no smoothing left at full polling rate
+#define MK_SMOOTH_DT_MIN 1000 //usec, dt bounds keep the fixed point in range
+#define MK_SMOOTH_DT_MAX 100000
+struct mk_smooth {
+    int mincutoff; //centiHz at rest, 0 disables the filter
+    int beta; //centiHz added per 100 codes/s of speed
+    int dcutoff; //centiHz, speed estimate low-pass
+    bool started; //first value taken as is
+    int32_t x; //filtered value, axis resolution Q8
+    int32_t dx; //filtered speed, 12bits codes/s
+    int shift; //axis bits over 12
+};
+
+
+#if defined(CONFIG_MK_FF_GPIO) || defined(CONFIG_MK_FF_PWM)
+// Force feedback
+struct mk_ff_state { //rumble motors state
+    bool strong_running; //rumble strong running
+    bool weak_running; //rumble weak running
+};
+
+struct mk_ff_cmd { //outputs to apply after a rumble effect
+    int strong; //1:start, 0:stop
+    int weak; //1:start, 0:stop, -1:no weak motor
+    int strong_pwm; //PCA9633 pwm value for strong motor
+    int weak_pwm; //PCA9633 pwm value for weak motor
+    int dir; //1:up, 0:down
+};
+#endif
+
+
+// Capture, binary format of /dev/mk_arcade_captureN: one header then samples, host endianness
+#define MK_CAPTURE_MAGIC        0x50434B4D //"MKCP"
+#define MK_CAPTURE_VERSION      1
+#define MK_CAPTURE_FLAG_GPIOLIB 0x1 //level[0] is the pressed bitmap, not GPLEV0
+#define MK_CAPTURE_ADC_NONE     ((int16_t)0x8000) //axis disabled or read failed
+
+struct mk_capture_header { //16 bytes, sent once per open
+    uint32_t magic; //MK_CAPTURE_MAGIC
+    uint16_t version; //MK_CAPTURE_VERSION
+    uint16_t sample_size; //sizeof(struct mk_capture_sample)
+    uint32_t flags; //MK_CAPTURE_FLAG_*
+    uint16_t pad; //pad index
+    uint16_t poll_hz; //polling rate at open
+};
+
+struct mk_capture_sample { //24 bytes, one per poll
+    uint64_t time_ns; //monotonic time of the poll
+    uint32_t level[2]; //raw GPLEV0 and GPLEV1
+    int16_t adc[4]; //raw 12bits x1,y1,x2,y2, before calibration
+};
+
+
+/* GPIO */
+
+static inline unsigned long mk_levels_to_pressed(const int *gpio_maps, uint32_t level0, uint32_t level1){ //GPLEV0/GPLEV1 to pressed bitmap, bit per button
+    unsigned long pressed = 0;
+    int i;
+
+    for(i = 0; i < MK_MAX_BUTTONS; i++){
+        int pin = gpio_maps[i], level;
+        if(pin == -1){continue;} //unused button
+        if(abs(pin) < 32){level = (level0 >> abs(pin)) & 1;}else{level = (level1 >> (abs(pin) - 32)) & 1;}
+        if(pin < 0){ //invert this signal
+            if(level){pressed |= 1UL<<i;}
+        }else if(!level){pressed |= 1UL<<i;}
+    }
+    return pressed;
+}
+
+
+static inline void mk_buttons_decode(const int *gpio_maps, int hotkey_mode, struct mk_hotkey *hk, unsigned long pressed, unsigned char *data){ //pressed bitmap to button states, handle hotkey toggle
+    int i;
+
+    for(i = 0; i < MK_MAX_BUTTONS; i++){
+        if(gpio_maps[i] != -1){    // to avoid unused buttons
+            if((i==HOTKEY_BUTTON) && (hotkey_mode == HOTKEY_MODE_TOGGLE)){  //the hotkey
+                //we use the hotkey as a toggle (press to toggle data[i])
+                unsigned char hk_state = (pressed >> i) & 1;
+
+                if(hk_state != hk->state_prev){ //the hotkey changed
+                    hk->state_prev = hk_state;
+
+                    //if it changed and it's now a 1, we enter pre-hotkey mode
+                    if(hk_state){
+                        if(hk->pre_mode){
+                            //the PWR btn itself is the hotkey
+                            data[HOTKEY_BUTTON] = 1;   //turn on the hotkey
+                            hk->combo_btn = i;
+                        }else{
+                            hk->pre_mode = 1;
+                            hk->combo_btn = -1;
+                        }
+                    }else if(hk->combo_btn == i){  //the hotkey was just released, and the PWR btn itself is the hotkey
+                        data[HOTKEY_BUTTON] = 0;   //turn off the hotkey
+                        hk->pre_mode = 0;
+                        hk->combo_btn = -1;
+                    }
+                }
+            }else if(i == hk->hidden_btn){ //turbo toggled or action emitted by this combo, button hidden until released
+                data[i] = 0;
+                if(!((pressed >> i) & 1)){
+                    hk->pre_mode = 0;
+                    hk->hidden_btn = -1;
+                    hk->action_btn = -1;
+                }
+            }else{
+                //all other (non-hotkey) buttons just report their state to data[i]
+                //except when we are in hk_state
+                unsigned char prev_data = data[i];
+                data[i] = (pressed >> i) & 1;
+
+                if(prev_data != data[i]){ //the state of this button changed
+                    if(hk->pre_mode){
+                        if(data[i] && hotkey_mode == HOTKEY_MODE_TOGGLE && (((hk->action_armed | hk->turbo_armed) >> i) & 1) && hk->combo_btn == -1){ //action or turbo combo
+                            if((hk->action_armed >> i) & 1){hk->action_btn = i;}else{hk->turbo_off ^= 1UL << i;}
+                            hk->hidden_btn = i;
+                            data[i] = 0;
+                        }else if(data[i]){ //the button was just pressed
+                            data[HOTKEY_BUTTON] = 1;   //turn on the hotkey
+                            hk->combo_btn = i;
+                        }else if(i == hk->combo_btn){   //the button was just released
+                            data[HOTKEY_BUTTON] = 0;   //turn off the hotkey
+                            hk->pre_mode = 0;
+                            hk->combo_btn = -1;
+                        }
+                    }
+                }
+            }
+        }else{data[i] = 0;}
+    }
+}
+
+
+static inline unsigned long mk_combo_armed(const struct mk_combo *combos, int count){ //buttons of hotkey combos, for mk_hotkey.action_armed
+    unsigned long armed = 0;
+    int i;
+
+    for(i = 0; i < count; i++){if(!combos[i].hold_ms){armed |= 1UL << combos[i].btn;}}
+    return armed;
+}
+
+
+static inline int mk_combo_update(const struct mk_combo *combos, int count, struct mk_combo_state *st, int action_btn, unsigned long pressed, unsigned int dt_us){ //combo whose key is down, -1 if none
+    int i;
+
+    if(pressed != st->pressed){ //table lookup on button change only
+        st->pressed = pressed;
+        st->pending = -1;
+        st->held_us = 0;
+        if(st->active >= 0 && !((pressed >> combos[st->active].btn) & 1)){st->active = -1;} //action button released
+        if(st->active >= 0){return st->active;}
+        for(i = 0; i < count; i++){
+            if(!combos[i].hold_ms && combos[i].btn == action_btn){st->active = i; break;} //hotkey combo, seen by mk_buttons_decode
+            if(combos[i].hold_ms && pressed == 1UL << combos[i].btn){st->pending = i; break;} //button alone, wait for its hold time
+        }
+    }else if(st->pending >= 0){
+        st->held_us += dt_us;
+        if(st->held_us >= combos[st->pending].hold_ms * 1000){
+            st->active = st->pending;
+            st->pending = -1;
+        }
+    }
+    return st->active;
+}
+
+
+/* ANALOG */
+
+static inline int16_t ADC_OffsetCenter(uint16_t adc_resolution,uint16_t adc_value,uint16_t adc_min,uint16_t adc_max,int16_t adc_offset){
+    int16_t adc_center; int16_t range; int32_t ratio; int32_t corrected_value; //used variables, value past the calibration may not fit 16bits on a 15bits axis
+    adc_center=adc_resolution/2; //center value, 2048 for 12bits
+    if(adc_value<(adc_center+adc_offset)){ //value under center offset
+        range=(adc_center+adc_offset)-adc_min;
+        if(range!=0){ //to avoid divide by 0
+            ratio=10000*adc_center/range; //float workaround
+            corrected_value=(adc_value-adc_min)*ratio/10000;
+        }else{corrected_value=adc_value;} //range=0, setting problems?
+    }else{ //value over center offset
+        range=adc_max-(adc_center+adc_offset);
+        if(range!=0){ //to avoid divide by 0
+            ratio=10000*adc_center/range; //float workaround
+            corrected_value=adc_center+(adc_value-(adc_center+adc_offset))*ratio/10000;
+        }else{corrected_value=adc_value;} //range=0, setting problems?
+    }
+
+    if(corrected_value<1){corrected_value=1;}else if(corrected_value>adc_resolution-2){corrected_value=adc_resolution-2;} //constrain computed value to the axis range (4094 for 12bits) + fix for Reicast overflow
+    return corrected_value;
+}
+
+
+static inline int16_t ADC_Deadzone(uint16_t adc_value,uint16_t min,uint16_t max,uint16_t flat){
+    int16_t adc_center; //used variables
+    adc_center=(max+min)/2; //center value, 2048 for 12bits
+    if(adc_value>adc_center-flat&&adc_value<adc_center+flat){adc_value=adc_center;} //apply flat value to adc value
+    return adc_value;
+}
+
+
+static inline int16_t mk_curve_lookup(const int16_t *table, int value, int shift); //below with the curves
+
+static inline int16_t mk_analog_process(int16_t adc_val, bool reverse, uint16_t *seen_min, uint16_t *seen_max, const struct analog_abs_params_struct *params, int16_t offset, const int16_t *curve, int shift){ //raw value to reported value, both 4096 << shift wide, 12bits parameters, curve table replaces calibration if not NULL
+    if(reverse){ //nns: reverse value, computed in int: raw 0 gives 4096 << shift, not a 16bits value on a 15bits axis
+        int reversed = abs((4096<<shift)-adc_val);
+        adc_val = reversed > (4096<<shift)-1 ? (4096<<shift)-1 : reversed;
+    }
+    if(adc_val >> shift < *seen_min){*seen_min = adc_val >> shift;} //update analog min value, 12bits like xNparams
+    if(adc_val >> shift > *seen_max){*seen_max = adc_val >> shift;} //update analog max value
+    if(curve){return mk_curve_lookup(curve, adc_val, shift);} //calibration, flat and response curve in one lookup
+    adc_val = ADC_OffsetCenter(4096<<shift,adc_val,params->min<<shift,params->max<<shift,offset*(1<<shift)); //re-center adc value
+    adc_val = ADC_Deadzone(adc_val,0x000,0xFFE<<shift,params->flat<<shift); //apply flat value to adc value, center 0x7FF << shift like the curve tables
+    return adc_val;
+}
+
+
+// Response curve, control points every 128 codes of the calibrated value, expanded to a table of the raw value
+#define MK_CURVE_POINTS 33 //0,128,...,4096
+#define MK_CURVE_SIZE 4096 //table entries, one per raw 12bits value
+
+static inline int mk_curve_check(const uint16_t *points){ //0 if every point is in the 12bits range, 4096 allowed for an exact identity
+    int i;
+    for(i = 0; i < MK_CURVE_POINTS; i++){if(points[i] > 4096){return -1;}}
+    return 0;
+}
+
+static inline int16_t mk_curve_point(const uint16_t *points, int value){ //linear interpolation between control points
+    int i = value >> 7, frac = value & 127;
+    return points[i] + (((points[i + 1] - points[i]) * frac + 64) >> 7);
+}
+
+static inline void mk_curve_build(const uint16_t *points, int16_t *table, const struct analog_abs_params_struct *params, int16_t offset){ //raw value to reported value: calibration, flat, then curve
+    int value;
+    for(value = 0; value < MK_CURVE_SIZE; value++){
+        int16_t v = ADC_Deadzone(ADC_OffsetCenter(4096,value,params->min,params->max,offset),0x000,0xFFF,params->flat);
+        v = mk_curve_point(points, v);
+        table[value] = v < 1 ? 1 : (v > 4094 ? 4094 : v); //same bounds as ADC_OffsetCenter
+    }
+}
+
+static inline int16_t mk_curve_lookup(const int16_t *table, int value, int shift){ //12bits raw indexed table, interpolated for wider axes
+    int i = value >> shift, frac = value & ((1 << shift) - 1);
+    if(i >= MK_CURVE_SIZE - 1){return table[MK_CURVE_SIZE - 1] << shift;}
+    return (table[i] << shift) + (table[i + 1] - table[i]) * frac;
+}
+
+static inline void mk_curve_linear(uint16_t *points){ //identity curve
+    int i;
+    for(i = 0; i < MK_CURVE_POINTS; i++){points[i] = i * 128;}
+}
+
+
+// Config blob, binary format of the firmware file: header then profiles, host endianness (little endian on the Pi)
+#define MK_CONFIG_MAGIC     0x46434B4D //"MKCF"
+#define MK_CONFIG_VERSION   1
+#define MK_CONFIG_FILE      "mk_arcade_joystick_rpi.bin" //in /lib/firmware
+#define MK_CONFIG_KEY_MAX   0x2ff //KEY_MAX
+
+struct mk_config_header { //16 bytes
+    uint32_t magic; //MK_CONFIG_MAGIC
+    uint16_t version; //MK_CONFIG_VERSION
+    uint16_t profile_count; //1..MK_MAX_PROFILES, profile 0 active once loaded
+    uint32_t size; //whole blob
+    uint32_t crc; //mk_config_crc32 of the profiles
+};
+
+struct mk_config_axis { //74 bytes
+    uint16_t min, max, fuzz, flat; //max 0 keeps the calibration of the module parameters
+    uint16_t curve[MK_CURVE_POINTS]; //response curve, linear for none
+};
+
+struct mk_config_combo { //6 bytes
+    uint16_t btn; //data[] index
+    uint16_t hold_ms; //0 for a hotkey combo
+    uint16_t code; //KEY_* or MK_COMBO_PROFILE + n
+};
+
+struct mk_config_profile { //438 bytes
+    char name[16]; //NUL terminated, not empty
+    uint16_t keys[MK_MAX_BUTTONS-4]; //key code reported by start, select, a ... (BTN_*)
+    uint8_t turbo_rate[MK_MAX_BUTTONS]; //Hz, 0 if the button has no turbo
+    uint8_t turbo_duty[MK_MAX_BUTTONS]; //pressed part of a period in %
+    struct mk_config_axis axis[4]; //x1,y1,x2,y2
+    uint16_t combo_count;
+    struct mk_config_combo combos[MK_MAX_COMBOS];
+};
+
+static inline uint32_t mk_config_crc32(const uint8_t *data, size_t len){ //CRC-32 (IEEE), same as zlib crc32
+    uint32_t crc = 0xFFFFFFFF;
+    int i;
+    while(len--){
+        crc ^= *data++;
+        for(i = 0; i < 8; i++){crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));}
+    }
+    return ~crc;
+}
+
+static inline const char *mk_config_check(const uint8_t *data, size_t size){ //NULL if the blob is usable, else why it is not
+    const struct mk_config_header *header = (const struct mk_config_header *)data;
+    const struct mk_config_profile *profiles = (const struct mk_config_profile *)(data + sizeof(*header));
+    int i, j;
+
+    if(size < sizeof(*header) || header->magic != MK_CONFIG_MAGIC){return "not a config blob";}
+    if(header->version != MK_CONFIG_VERSION){return "unsupported version";}
+    if(header->profile_count < 1 || header->profile_count > MK_MAX_PROFILES){return "bad profile count";}
+    if(header->size != size || size != sizeof(*header) + header->profile_count * sizeof(*profiles)){return "bad size";}
+    if(header->crc != mk_config_crc32(data + sizeof(*header), size - sizeof(*header))){return "bad checksum";}
+    for(i = 0; i < header->profile_count; i++){
+        const struct mk_config_profile *prof = &profiles[i];
+        if(!prof->name[0] || prof->name[sizeof(prof->name) - 1]){return "bad profile name";}
+        for(j = 0; j < i; j++){
+            const char *a = prof->name, *b = profiles[j].name;
+            while(*a && *a == *b){a++; b++;}
+            if(*a == *b){return "duplicate profile name";}
+        }
+        for(j = 0; j < MK_MAX_BUTTONS - 4; j++){if(!prof->keys[j] || prof->keys[j] > MK_CONFIG_KEY_MAX){return "bad key";}}
+        for(j = 0; j < MK_MAX_BUTTONS; j++){
+            if(!prof->turbo_rate[j]){continue;}
+            if(j < 4 || j == HOTKEY_BUTTON || prof->turbo_rate[j] > MK_TURBO_MAX_RATE || prof->turbo_duty[j] < 1 || prof->turbo_duty[j] > 99){return "bad turbo";}
+        }
+        for(j = 0; j < 4; j++){
+            const struct mk_config_axis *axis = &prof->axis[j];
+            if(axis->max && (axis->min >= axis->max || axis->max > 4095 || axis->flat > 2047)){return "bad axis calibration";}
+            if(mk_curve_check(axis->curve)){return "bad curve";}
+        }
+        if(prof->combo_count > MK_MAX_COMBOS){return "too many combos";}
+        for(j = 0; j < prof->combo_count; j++){
+            const struct mk_config_combo *combo = &prof->combos[j];
+            if(combo->btn >= MK_MAX_BUTTONS || combo->hold_ms > MK_COMBO_MAX_HOLD || (!combo->hold_ms && combo->btn == HOTKEY_BUTTON)){return "bad combo";}
+            if(combo->code >= MK_COMBO_PROFILE ? combo->code >= MK_COMBO_PROFILE + header->profile_count : (!combo->code || combo->code > MK_CONFIG_KEY_MAX)){return "bad combo code";}
+        }
+    }
+    return NULL;
+}
+
+
+#ifdef CONFIG_MK_ADC_SPI
+// SPI ADC, MCP3008/MCP3208 single-ended conversion, one 3 bytes frame per channel (mode 0)
+#define MK_SPIADC_MCP3008   3008 //10bits, 8 channels
+#define MK_SPIADC_MCP3208   3208 //12bits, 8 channels
+#define MK_SPIADC_FRAME     3 //bytes per conversion, chip select released between frames
+
+static inline void mk_mcp3x08_frame(int type, int channel, uint8_t *tx){ //command frame for a conversion of channel
+    if(type == MK_SPIADC_MCP3208){ //start, single-ended, D2 | D1, D0 | don't care
+        tx[0] = 0x06 | ((channel >> 2) & 1);
+        tx[1] = (channel & 3) << 6;
+    }else{ //start | single-ended, D2..D0 | don't care
+        tx[0] = 0x01;
+        tx[1] = (0x08 | (channel & 7)) << 4;
+    }
+    tx[2] = 0;
+}
+
+static inline int16_t mk_mcp3x08_value(int type, const uint8_t *rx){ //12bits value from answer frame
+    if(type == MK_SPIADC_MCP3208){return ((rx[1] & 0x0F) << 8) | rx[2];}
+    return (((rx[1] & 0x03) << 8) | rx[2]) << 2; //10bits scaled to the 12bits axis model
+}
+#endif
+
+
+static inline int16_t mk_adc_filter(struct mk_adc_filter *filter, int16_t value){ //median of the last window values, step delayed by (window-1)/2 polls, errors skip the ring
+    int16_t sorted[MK_FILTER_MEDIAN_MAX], median;
+    int i, j;
+    if(value < 0 || filter->median < 3){return value;}
+    filter->ring[filter->pos] = value;
+    filter->pos = (filter->pos + 1) % filter->median;
+    if(filter->count < filter->median){filter->count++;}
+    for(i = 0; i < filter->count; i++){ //insertion sort, five values at most
+        int16_t v = filter->ring[i];
+        for(j = i; j > 0 && sorted[j - 1] > v; j--){sorted[j] = sorted[j - 1];}
+        sorted[j] = v;
+    }
+    median = sorted[(filter->count - 1) / 2];
+    if(abs(value - median) > MK_FILTER_OUTLIER << filter->shift){filter->rejected++;}
+    return median;
+}
+
+
+static inline int32_t mk_smooth_alpha(uint32_t cutoff, uint32_t dt_us){ //Q16 low-pass weight of a new sample, w/(1+w) with w=2*pi*cutoff*dt
+    uint32_t w = ((uint64_t)cutoff * dt_us * 17271) >> 22; //2*pi/100/1e6 in Q16 is 17271/2^22, cutoff in centiHz
+    return 65536 - (int32_t)(0xFFFFFFFFU / (65536U + w));
+}
+
+static inline int16_t mk_smooth(struct mk_smooth *smooth, int16_t value, unsigned int dt_us){ //1 euro filter on an axis value, integer only, errors pass through
+    int32_t diff, speed, cutoff;
+    if(value < 0 || smooth->mincutoff <= 0){return value;}
+    if(!smooth->started){smooth->x = value << 8; smooth->dx = 0; smooth->started = true; return value;}
+    if(dt_us < MK_SMOOTH_DT_MIN){dt_us = MK_SMOOTH_DT_MIN;}else if(dt_us > MK_SMOOTH_DT_MAX){dt_us = MK_SMOOTH_DT_MAX;}
+    diff = (value << 8) - smooth->x;
+    speed = ((diff >> smooth->shift) * 1000 / (int32_t)dt_us) * 1000 / 256; //12bits codes/s, Q8 per msec first to stay in 32bits
+    smooth->dx += ((int64_t)(speed - smooth->dx) * mk_smooth_alpha(smooth->dcutoff, dt_us)) >> 16;
+    cutoff = smooth->mincutoff + smooth->beta * (abs(smooth->dx) / 100);
+    if(cutoff > MK_SMOOTH_CUTOFF_MAX){cutoff = MK_SMOOTH_CUTOFF_MAX;}
+    smooth->x += ((int64_t)diff * mk_smooth_alpha(cutoff, dt_us)) >> 16;
+    return (smooth->x + 128) >> 8;
+}
+
+
+static inline int16_t mk_adc_to_bits(int value, int resolution, int bits){ //scale a chip value to an axis resolution, errors kept
+    int max = (1 << bits) - 1;
+    if(value < 0){return value;}
+    if(resolution > bits){value = (value + (1 << (resolution - bits - 1))) >> (resolution - bits);} //round
+    else if(resolution < bits){value <<= bits - resolution;}
+    return value > max ? max : value;
+}
+
+static inline int16_t mk_adc_to_12bits(int value, int resolution){return mk_adc_to_bits(value, resolution, 12);} //12bits axis model
+
+
+#ifdef CONFIG_MK_ADC_ADS1X15
+// ADS1015/ADS1115 per channel full scale (PGA) and data rate, adc->priv; NULL priv or unset channel keeps 0x83E3
+#define MK_ADS1X15_CONFIG 0x83E3 //single shot, +-4.096v FSR, fastest rate
+
+struct mk_ads1x15_priv {
+    uint16_t config[4]; //config register without mux, 0 if unset
+    unsigned int conv_us[4]; //wait for the selected rate
+    uint32_t scale[4]; //Q16 gain from full scale to stick supply, full travel on 12bits, 0 keeps the chip scale
+    int16_t code[4]; //last chip code read, window of the comparator rest
+    bool resting; //continuous conversion, window comparator on ALERT, no reads needed
+    unsigned int rest_mask; //channels watched in turn while resting
+    int watch; //channel converted by the comparator
+};
+
+static const int mk_ads1x15_fsr_mv[] = {6144, 4096, 2048, 1024, 512, 256}; //PGA 0..5
+static const int mk_ads1015_sps[] = {128, 250, 490, 920, 1600, 2400, 3300, 3300}; //DR 0..7
+static const int mk_ads1115_sps[] = {8, 16, 32, 64, 128, 250, 475, 860};
+static const unsigned int mk_ads1015_conv_us[] = {9830, 5060, 2620, 1420, 850, 590, 450, 450}; //period +25% oscillator and wakeup +60us security
+static const unsigned int mk_ads1115_conv_us[] = {156310, 78190, 39130, 19600, 9830, 5060, 2700, 1520};
+
+static inline int mk_ads1x15_setup(struct mk_ads1x15_priv *priv, int channel, bool ads1115, int fsr_mv, int sps, int supply_mv){ //returns the selected rate, -1 if the full scale does not exist
+    const int *rates = ads1115 ? mk_ads1115_sps : mk_ads1015_sps;
+    int pga, dr;
+    if(channel<0||channel>3){return -1;}
+    for(pga = 0; pga < 6 && mk_ads1x15_fsr_mv[pga] != fsr_mv; pga++){}
+    if(pga == 6){return -1;}
+    for(dr = 0; dr < 7 && rates[dr] < sps; dr++){} //slowest rate at least as fast as asked
+    priv->config[channel] = 0x8103 | (pga << 9) | (dr << 5); //single shot, comparator off
+    priv->conv_us[channel] = ads1115 ? mk_ads1115_conv_us[dr] : mk_ads1015_conv_us[dr];
+    priv->scale[channel] = supply_mv > 0 ? ((uint32_t)(2 * fsr_mv) << 16) / supply_mv : 0; //positive half of the full scale is the chip range
+    return rates[dr];
+}
+#endif
+
+#ifndef MK_CORE_NO_I2C
+#ifdef CONFIG_MK_ADC_MCP3021
+static inline int mk_mcp3021_read(struct mk_adc *adc, int channel){return mk_i2c_read_word(adc->client, 0);} //conversion on read, 10bits left aligned in 12
+static const struct mk_adc_ops mk_adc_mcp3021_ops = {"MCP3021", 1, 12, 0, NULL, mk_mcp3021_read, NULL};
+#endif
+
+#ifdef CONFIG_MK_ADC_ADS1X15
+static inline int mk_ads1x15_start(struct mk_adc *adc, int channel){ //based on https://github.com/torvalds/linux/blob/master/drivers/hwmon/ads1015.c
+    static const uint16_t ads1015_ain[] = {0x4000,0x5000,0x6000,0x7000}; //ain0,ain1,ain2,ain3 value for bitwise operation
+    const struct mk_ads1x15_priv *priv = adc->priv;
+    int err;
+    if(channel<0||channel>3){return -1;} //fail: ain oob, return -1
+    if(!priv || !priv->config[channel]){ //default
+        err = mk_i2c_write_word(adc->client,0x01,MK_ADS1X15_CONFIG|ads1015_ain[channel]);
+        return err < 0 ? err : (int)adc->ops->conv_us;
+    }
+    err = mk_i2c_write_word(adc->client,0x01,priv->config[channel]|ads1015_ain[channel]);
+    return err < 0 ? err : (int)priv->conv_us[channel];
+}
+
+static inline int mk_ads1x15_scale(struct mk_adc *adc, int channel, int value){ //chip code to stick supply range, same resolution, code kept for the comparator
+    struct mk_ads1x15_priv *priv = adc->priv;
+    int max = (1 << adc->ops->resolution) - 1;
+    if(value >= 0 && priv){priv->code[channel] = value;}
+    if(value < 0 || !priv || !priv->scale[channel]){return value;}
+    value = ((uint64_t)value * priv->scale[channel]) >> 16; //ADS1115 codes over the supply do not fit 32bits once scaled
+    return value > max ? max : value;
+}
+
+static inline int mk_ads1015_read(struct mk_adc *adc, int channel){
+    int16_t value=mk_i2c_read_word(adc->client,0); //read value, words over 0x7FFF are negative codes
+    if(value>=0){value=value>>4;} //shift bits to get 12bits value
+    return mk_ads1x15_scale(adc, channel, value); //adc result or i2c error
+}
+
+static inline int mk_ads1115_read(struct mk_adc *adc, int channel){
+    int value=mk_i2c_read_word(adc->client,0);
+    if(value<0){return value;} //i2c error
+    return mk_ads1x15_scale(adc, channel, (int16_t)value < 0 ? 0 : value); //single ended, noise under ground reads 0
+}
+
+// ADS1x15 comparator rest: one channel converted continuously, ALERT asserted once it leaves a window around
+// the rest codes, channels of rest_mask watched in turn since the comparator only sees the mux input
+static inline int mk_ads1x15_watch(struct mk_adc *adc, int channel){ //continuous window comparator on channel, latched, active low
+    static const uint16_t ads1015_ain[] = {0x4000,0x5000,0x6000,0x7000};
+    struct mk_ads1x15_priv *priv = adc->priv;
+    uint16_t config = priv->config[channel] ? priv->config[channel] : MK_ADS1X15_CONFIG;
+    priv->watch = channel;
+    return mk_i2c_write_word(adc->client, 0x01, (config & ~0x811F) | 0x0014 | ads1015_ain[channel]); //OS 0, continuous, window, latch, assert after one conversion
+}
+
+static inline int mk_ads1x15_rest(struct mk_adc *adc, unsigned int mask, int window){ //window in 12bits axis units around the last codes of the mask channels
+    struct mk_ads1x15_priv *priv = adc->priv;
+    int shift = adc->ops->resolution == 12 ? 4 : 0; //thresholds are left aligned like the conversion register
+    int max = (1 << (adc->ops->resolution - 1)) - 1, lo = max, hi = 0, channel, err;
+    for(channel = 0; channel < 4; channel++){ //one window for all channels, sticks rest around the same code
+        int margin = (((uint32_t)window << (adc->ops->resolution - 12)) << 16) / (priv->scale[channel] ? priv->scale[channel] : 65536); //back to chip codes
+        if(!(mask & (1U << channel))){continue;}
+        if(priv->code[channel] - margin < lo){lo = priv->code[channel] - margin;}
+        if(priv->code[channel] + margin > hi){hi = priv->code[channel] + margin;}
+    }
+    if(!mask){return -1;}
+    if(lo < 0){lo = 0;}
+    if(hi > max){hi = max;}
+    if((err = mk_i2c_write_word(adc->client, 0x02, (lo << shift) & 0xFFFF)) < 0){return err;}
+    if((err = mk_i2c_write_word(adc->client, 0x03, (hi << shift) & 0xFFFF)) < 0){return err;}
+    for(channel = 0; !(mask & (1U << channel)); channel++){}
+    if((err = mk_ads1x15_watch(adc, channel)) < 0){return err;}
+    priv->rest_mask = mask;
+    priv->resting = true;
+    return 0;
+}
+
+static inline int mk_ads1x15_rest_next(struct mk_adc *adc){ //watch the next channel, nothing to do with a single one
+    struct mk_ads1x15_priv *priv = adc->priv;
+    int channel = priv->watch;
+    do{channel = (channel + 1) & 3;}while(!(priv->rest_mask & (1U << channel)));
+    return channel == priv->watch ? 0 : mk_ads1x15_watch(adc, channel);
+}
+
+static inline int mk_ads1x15_wake(struct mk_adc *adc){ //leave rest: single shot without start powers the chip down, comparator off releases ALERT
+    struct mk_ads1x15_priv *priv = adc->priv;
+    priv->resting = false;
+    return mk_i2c_write_word(adc->client, 0x01, MK_ADS1X15_CONFIG & ~0x8000);
+}
+
+static const struct mk_adc_ops mk_adc_ads1015_ops = {"ADS1015", 4, 12, 450, mk_ads1x15_start, mk_ads1015_read, NULL}; //3300SPS, 390us worst case +60us security
+static const struct mk_adc_ops mk_adc_ads1115_ops = {"ADS1115", 4, 16, 1520, mk_ads1x15_start, mk_ads1115_read, NULL}; //860SPS, axes keep 15bits, 8 times the ADS1015 scale
+#endif
+
+#ifdef CONFIG_MK_ADC_ADS7830
+static inline int mk_ads7830_read(struct mk_adc *adc, int channel){ //command byte starts the conversion, result in the same transfer
+    if(channel<0||channel>7){return -1;}
+    return mk_i2c_read_byte(adc->client, 0x84 | ((channel & 1) << 6) | ((channel >> 1) << 4)); //single ended, odd channels on C2, reference off, adc on
+}
+static const struct mk_adc_ops mk_adc_ads7830_ops = {"ADS7830", 8, 8, 0, NULL, mk_ads7830_read, NULL};
+#endif
+
+
+static inline bool mk_adc_sample(const struct mk_adc_axis *axis, int value, int32_t *sum, int *left, int16_t *result){ //add one conversion of an oversampled axis, true once done
+    int n = axis->oversample > 1 ? axis->oversample : 1;
+    if(value < 0){*result = value; return true;} //error ends the axis
+    *sum += value;
+    if(--*left > 0){return false;}
+    *result = (*sum + n / 2) / n; //rounded mean, integer only
+    return true;
+}
+
+static inline unsigned int mk_adc_poll(const struct mk_adc_axis *axes, int count, int16_t *values){ //read every mapped axis, -1 if unused, returns the conversion wait in usec
+    unsigned int pending = 0, round, failed, waited = 0;
+    int32_t sum[MK_ADC_MAX_AXES];
+    int left[MK_ADC_MAX_AXES]; //conversions still to do
+    int i, j;
+
+    for(i = 0; i < count; i++){
+        values[i] = -1;
+        sum[i] = 0;
+        left[i] = axes[i].oversample > 1 ? axes[i].oversample : 1;
+        if(axes[i].adc){pending |= 1U << i;}
+    }
+
+    for(i = 0; i < count; i++){ //chips able to convert everything in one transfer, once per oversampling pass
+        struct mk_adc *adc = axes[i].adc;
+        if(!(pending & (1U << i)) || !adc->ops->read_all){continue;}
+        for(;;){
+            int channels[MK_ADC_MAX_AXES], index[MK_ADC_MAX_AXES], n = 0;
+            int16_t batch[MK_ADC_MAX_AXES];
+            for(j = i; j < count; j++){
+                if((pending & (1U << j)) && axes[j].adc == adc){channels[n] = axes[j].channel; index[n++] = j;}
+            }
+            if(!n){break;}
+            adc->ops->read_all(adc, channels, batch, n);
+            for(j = 0; j < n; j++){
+                if(mk_adc_sample(&axes[index[j]], mk_adc_to_bits(batch[j], adc->ops->resolution, 12 + axes[index[j]].shift), &sum[index[j]], &left[index[j]], &values[index[j]])){pending &= ~(1U << index[j]);}
+            }
+        }
+    }
+
+    while(pending){ //one conversion per chip at a time, chips convert in parallel and share the wait
+        unsigned int wait = 0;
+        int conv_us;
+        round = 0; failed = 0;
+        for(i = 0; i < count; i++){
+            struct mk_adc *adc = axes[i].adc;
+            if(!(pending & (1U << i))){continue;}
+            for(j = 0; j < i; j++){if((round & (1U << j)) && axes[j].adc == adc){break;}}
+            if(j < i){continue;} //chip already busy in this round
+            round |= 1U << i;
+            if(!adc->ops->start){continue;}
+            if((conv_us = adc->ops->start(adc, axes[i].channel)) < 0){values[i] = conv_us; failed |= 1U << i; continue;}
+            if((unsigned int)conv_us > wait){wait = conv_us;} //slowest conversion of the round
+        }
+        if(wait){mk_udelay(wait); waited += wait;}
+        for(i = 0; i < count; i++){
+            if(!(round & (1U << i))){continue;}
+            if(failed & (1U << i)){pending &= ~(1U << i); continue;}
+            if(mk_adc_sample(&axes[i], mk_adc_to_bits(axes[i].adc->ops->read(axes[i].adc, axes[i].channel), axes[i].adc->ops->resolution, 12 + axes[i].shift), &sum[i], &left[i], &values[i])){pending &= ~(1U << i);} //oversampled axes stay for a burst on the same chip
+        }
+    }
+    return waited;
+}
+#endif
+
+
+/* FORCE FEEDBACK */
+#if defined(CONFIG_MK_FF_GPIO) || defined(CONFIG_MK_FF_PWM)
+static inline void mk_ff_rumble(struct mk_ff_state *state, uint16_t strong_magnitude, uint16_t weak_magnitude, uint16_t direction, bool weak_enable, bool strong_pwm_reverse, bool weak_pwm_reverse, struct mk_ff_cmd *cmd){ //rumble effect to motor outputs
+    if(strong_magnitude!=0&&!state->strong_running){ //run strong
+        cmd->strong=1;
+        cmd->strong_pwm=abs(strong_magnitude/256);
+        if(strong_pwm_reverse){cmd->strong_pwm=abs(255-cmd->strong_pwm);} //reverse logic
+        state->strong_running=true; //running
+    }else{ //stop strong
+        cmd->strong=0;
+        if(strong_pwm_reverse){cmd->strong_pwm=255;}else{cmd->strong_pwm=0;}
+        state->strong_running=false; //reset
+    }
+
+    cmd->weak=-1; cmd->weak_pwm=0;
+    if(weak_enable){
+        if(weak_magnitude!=0&&!state->weak_running){ //run weak
+            cmd->weak=1;
+            cmd->weak_pwm=abs(weak_magnitude/256);
+            if(weak_pwm_reverse){cmd->weak_pwm=abs(255-cmd->weak_pwm);} //reverse logic
+            state->weak_running=true; //running
+        }else{ //stop weak
+            cmd->weak=0;
+            if(weak_pwm_reverse){cmd->weak_pwm=255;}else{cmd->weak_pwm=0;}
+            state->weak_running=false; //reset
+        }
+    }
+
+    //direction is set for both strong and week motor at the same time, https://elixir.bootlin.com/linux/latest/source/include/uapi/linux/input.h#L443
+    if(direction<16384||direction>49152){cmd->dir=0; //assume value under left/over right as down
+    }else{cmd->dir=1;} //assume as up
+}
+#endif
+
+#endif
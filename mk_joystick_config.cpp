@@ -3,7 +3,7 @@ NNS @ 2019
 mk_joystick_config
 Allow user to create new configuration file for mk_arcade_joystick_rpi Analog/GPIO controller driver.
 */
-const char programversion[]="0.1c"; //program version
+const char programversion[]="0.1f"; //program version
 
 #include <fcntl.h> //file io
 #include <stdio.h> //stream io
@@ -15,7 +15,10 @@ const char programversion[]="0.1c"; //program version
 #include <linux/i2c-dev.h> //i2c library
 #include <sys/ioctl.h> //sys io
 #include <pthread.h> //pthread
+#include <atomic> //thread states
 #include <wiringPi.h> //wiringpi
+#include <gpiod.h> //libgpiod
+#include <poll.h> //poll
 #include <sys/time.h> //time
 #include <time.h> //time
 #include <sys/stat.h> //file stat
@@ -24,19 +27,21 @@ const char programversion[]="0.1c"; //program version
 
 //GPIO variables
 pthread_t gpio_thread; //gpio thread id
-int gpio_thread_rc=-1; //gpio thread return code
+std::atomic<int> gpio_thread_rc(-1); //gpio thread return code
 //int gpio_input_trigger=-1;
 int gpio_input[55]; //store if gpio pin is input
 int gpio_input_activelow[55]; //store if gpio pin is active low
 long long gpio_input_timestamp[55]; //store if gpio pin triggered timestamp
 bool gpio_input_enable[55]; //if specific gpio pin allow to be monitored
+char gpio_chip_name[PATH_MAX]="gpiochip0"; //gpio chip to monitor: name, path, label or number
+struct gpiod_chip *gpio_chip=NULL; //gpio chip handle
+struct gpiod_line *gpio_line[55]; //line requested for edge events, NULL if pin not monitored
 int button_A_gpio=-1; //gpio button A for user interaction
 int button_B_gpio=-1; //gpio button B for user interaction
 int button_hkmode=1; //hotkey mode: 1=normal, 2=toggle
 int button_tmp_gpio=-1; //used for user interaction
 int button_tmpbis_gpio=-1; //used for user interaction, most likely for validation
-int button_pressed=-1; //last valid gpio pin triggered
-int button_pressed_tmp=-1; //backup previous variable
+int button_pressed_tmp=-1; //last valid gpio pin triggered
 int button_table[]={-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1}; //store user input
 int button_table_logic[]={1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1}; //store user input reverse logic
 int gpio_button_link_table[]={12,0,1,2,3,6,7,10,9,4,5,11,8,13,14,15,16,17,18,19,20}; //used to match button name and config
@@ -44,25 +49,35 @@ int gpio_button_link_table[]={12,0,1,2,3,6,7,10,9,4,5,11,8,13,14,15,16,17,18,19,
 
 //I2C/ADC variables
 pthread_t adc_thread; //adc thread id
-int adc_thread_rc=-1; //adc thread return code
+std::atomic<int> adc_thread_rc(-1); //adc thread return code
+std::atomic<bool> adc_thread_stop(false); //ask adc thread to exit
+pthread_mutex_t adc_mutex=PTHREAD_MUTEX_INITIALIZER; //protect adc value, center, min and max, updated by adc thread
 char i2c_bus[]="/dev/i2c-1"; //path to i2c bus
 int i2c_handle; //handle to get i2c data
 unsigned char i2c_buffer[16] = {0}; //read/write buffer array
 bool adc_mcp3021 = false; //is mcp3021 enable
 bool adc_ads1015 = false; //is ads1015 enable
-bool adc_user = true; //user selected the adc chip type
-bool adc_calibration = false; //adc calibration started
-bool adc_calibration_done = false; //adc calibration done
+std::atomic<bool> adc_user(true); //user selected the adc chip type
+std::atomic<bool> adc_calibration(false); //adc calibration started
+std::atomic<bool> adc_calibration_done(false); //adc calibration done
 int adc_address[] = {-1,-1,-1,-1,-1,-1,-1,-1}; //detected i2c chip adresses, -1 if nothing
 int adc_address_ads1015 = -1; //specific to ads1015 chip
 int adc_address_count=0; //count of found i2c chip adress
 int adc_detected = 0; //numbers of i2c chip detected
 int adc_detected_back = 0; //numbers of i2c chip detected
 int adc_mapping[] = {-1,-1,-1,-1}; //corresponding array to adc_address: x1,y1,x2,y2. -1 if nothing
-int adc_center[] = {-1,-1,-1,-1,-1,-1,-1,-1}; //store center value, used to detect noise and right adc-axis correspondance
+int adc_center[] = {-1,-1,-1,-1,-1,-1,-1,-1}; //store center value (most frequent at-rest value), used to detect right adc-axis correspondance
+int adc_noise[] = {-1,-1,-1,-1,-1,-1,-1,-1}; //store at-rest spread, -1 until calibrated
 int adc_value[] = {-1,-1,-1,-1,-1,-1,-1,-1}; //store adc value
-int adc_min[] = {-1,-1,-1,-1,-1,-1,-1,-1}; //store adc min value
-int adc_max[] = {-1,-1,-1,-1,-1,-1,-1,-1}; //store adc max value
+int adc_min[] = {-1,-1,-1,-1,-1,-1,-1,-1}; //store adc min value, computed by adc_limits()
+int adc_max[] = {-1,-1,-1,-1,-1,-1,-1,-1}; //store adc max value, computed by adc_limits()
+unsigned int adc_hist_rest[8][4096]; //histogram of values read during calibration
+unsigned int adc_hist_rest_count[8]; //samples in adc_hist_rest
+unsigned int adc_hist_move[8][4096]; //histogram of values read outside the at-rest spread after calibration
+unsigned int adc_hist_move_count[8]; //samples in adc_hist_move
+int adc_rate=100; //adc sampling rate in Hz
+int adc_trim=10; //samples ignored at each end of histograms, per thousand
+int adc_rest_msec=3000; //calibration length in msec
 int adc_reverse[] = {1,1,1,1,1,1,1,1}; //store reverse value: -1=reverse, 1=not reverse
 int adc_skip[] = {1,1,1,1,1,1,1,1}; //use to avoid user to use same adc chip for 2 axis
 int adc_skipbackup[] = {1,1,1,1,1,1,1,1}; //backup of the previous variable
@@ -74,10 +89,19 @@ const char ads1015_config_ain[]={0x40,0x50,0x60,0x70}; //ads1015:ain use to crea
 bool adc_autocenter=false; //allow use to enable auto analog center
 
 
+//Thread hand-off variables
+#define EVENT_QUEUE_SIZE 16 //gpio pins kept until the user interface takes them
+pthread_mutex_t event_mutex=PTHREAD_MUTEX_INITIALIZER; //protect event queue, held by waiters while checking thread states
+pthread_cond_t event_cond; //signaled on new event and thread state change, monotonic clock
+int event_queue[EVENT_QUEUE_SIZE]; //pressed gpio pins, oldest first
+int event_queue_head=0; //index of oldest pressed pin
+int event_queue_count=0; //pressed pins in queue
+
+
 //General variables
 bool debug=false; //debug enable?
 //struct timeval scanning_timeout;
-long long scanning_start=0; //user for timeout stuff in second
+long long scanning_start=0; //calibration start in msec
 bool retry=false; //allow use to change answer
 bool retrymain=false; //allow use to change main answer
 char text_config[4096]; //store config file
@@ -99,59 +123,140 @@ char str_button_name[][16] = {"Hotkey","Dpad Up","Dpad Down","Dpad Left","Dpad R
 //Functions declaration, need when call function declare after the caller
 void ADS1015_read(int addr);
 void MCP3021_read(int addr,int index);
+void adc_sample(int index,int value);
+void adc_rest();
 int adc_highest_delta();
 
 
-long long timestamp_msec(){ //recover timestamp in msec, https://stackoverflow.com/questions/3756323/how-to-get-the-current-time-in-milliseconds-from-c-in-linux
-	struct timeval te;gettimeofday(&te, NULL);long long milliseconds = te.tv_sec*1000LL + te.tv_usec/1000;return milliseconds;
+long long timestamp_msec(){ //recover monotonic timestamp in msec, same clock as gpio line events
+	struct timespec te;clock_gettime(CLOCK_MONOTONIC,&te);long long milliseconds = te.tv_sec*1000LL + te.tv_nsec/1000000;return milliseconds;
+}
+
+
+long long gpio_event_msec(const struct timespec *ts){ //kernel timestamp of a gpio line event in msec
+	long long milliseconds = ts->tv_sec*1000LL + ts->tv_nsec/1000000;
+	long long now = timestamp_msec();
+	if(milliseconds>now||now-milliseconds>1000){milliseconds=now;} //kernels before 5.7 stamp events with CLOCK_REALTIME, use read time instead
+	return milliseconds;
+}
+
+
+void event_notify(){ //wake every waiter after a thread state change
+	pthread_mutex_lock(&event_mutex);
+	pthread_cond_broadcast(&event_cond);
+	pthread_mutex_unlock(&event_mutex);
+}
+
+
+bool event_wait_until(long long deadline){ //wait for event_cond with event_mutex held, deadline in msec (-1 for none), false if deadline reached
+	struct timespec ts;
+	if(deadline<0){pthread_cond_wait(&event_cond,&event_mutex);return true;}
+	if(timestamp_msec()>=deadline){return false;}
+	ts.tv_sec=deadline/1000; ts.tv_nsec=(deadline%1000)*1000000;
+	return pthread_cond_timedwait(&event_cond,&event_mutex,&ts)!=ETIMEDOUT||timestamp_msec()<deadline;
+}
+
+
+void event_push(int gpio_pin){ //queue a pressed gpio pin for the user interface, oldest pin dropped if full
+	pthread_mutex_lock(&event_mutex);
+	if(event_queue_count==EVENT_QUEUE_SIZE){event_queue_head=(event_queue_head+1)%EVENT_QUEUE_SIZE;event_queue_count--;}
+	event_queue[(event_queue_head+event_queue_count)%EVENT_QUEUE_SIZE]=gpio_pin; event_queue_count++;
+	pthread_cond_broadcast(&event_cond);
+	pthread_mutex_unlock(&event_mutex);
+}
+
+
+void event_flush(){ //forget pressed gpio pins not taken yet
+	pthread_mutex_lock(&event_mutex);
+	event_queue_count=0;
+	pthread_mutex_unlock(&event_mutex);
+}
+
+
+int thread_wait(std::atomic<int> *state,int timeout){ //wait until thread state leaves -1 (starting) or timeout (sec, -1 for none), return state
+	long long deadline=-1; //no timeout
+	if(timeout>0){deadline=timestamp_msec()+timeout*1000LL;}
+	pthread_mutex_lock(&event_mutex);
+	while(*state==-1&&event_wait_until(deadline)){}
+	pthread_mutex_unlock(&event_mutex);
+	return *state;
 }
 
 
 void *gpio_routine(void *){ //GPIO input thread routine
 	if(debug){printf("---Debug : GPIO : Thread (%lu) started\n",gpio_thread);} //debug
-	// gpio_thread_rc values : 0:ok, -1:failed, -2:fail because of wiringPi
+	// gpio_thread_rc values : 0:ok, -1:failed, -2:fail because of wiringPi, -3:fail because of gpio chip
 	
-	if(wiringPiSetupGpio()==-1){printf("GPIO : wiringPi not initialized\n");gpio_thread_rc=-2;} //failed
+	struct pollfd gpio_poll[54]; //edge event fd of every monitored pin
+	int gpio_poll_pin[54]; //gpio pin of each gpio_poll entry
+	int gpio_poll_count=0; //monitored pin count
+	struct gpiod_line_event gpio_event; //last read edge event
+	long long gpio_deadline; //time the earliest held pin is considered pressed
+	int gpio_pin,tmploop,timeout; //current gpio pin, loop, poll timeout
 	
-	int gpio_pin; //current gpio pin
-	for(int gpio_pin=0;gpio_pin<54;gpio_pin++){ //initial loop to fill empty array
+	if(wiringPiSetupGpio()==-1){printf("GPIO : wiringPi not initialized\n");gpio_thread_rc=-2;event_notify();return NULL;} //failed
+	if((gpio_chip=gpiod_chip_open_lookup(gpio_chip_name))==NULL){printf("GPIO : failed to open %s\n",gpio_chip_name);gpio_thread_rc=-3;event_notify();return NULL;} //failed
+	
+	for(gpio_pin=0;gpio_pin<54;gpio_pin++){ //initial loop to fill empty array
 		gpio_input[gpio_pin]=0; //default value
-		if(getAlt(gpio_pin)==0){ //pin is a input
-			gpio_input[gpio_pin]=0; //initial value
+		gpio_line[gpio_pin]=NULL; //not monitored
+		if(getAlt(gpio_pin)==0){ //pin is a input, pins in alt mode (i2c, uart...) are never requested
 			gpio_input_enable[gpio_pin]=true; //used when user bind keys
 			if(digitalRead(gpio_pin)){gpio_input_activelow[gpio_pin]=0;}else{gpio_input_activelow[gpio_pin]=1;} //assume low as activelow
 			gpio_input_timestamp[gpio_pin]=0; //initialize timestamp
 			if(gpio_pin!=7&&gpio_pin!=20&&gpio_pin!=21){pullUpDnControl(gpio_pin,PUD_UP);usleep(1000);} //pull all input high except of pin used for power slider, allow 1ms to set pullup register
+			
+			gpio_line[gpio_pin]=gpiod_chip_get_line(gpio_chip,gpio_pin); //request edge events, timestamped by the kernel
+			if(gpio_line[gpio_pin]==NULL||gpiod_line_request_both_edges_events(gpio_line[gpio_pin],"mk_joystick_config")<0){ //line used by someone else
+				if(debug){printf("---Debug : GPIO : %d : request failed : %s\n",gpio_pin,strerror(errno));} //debug
+				gpio_line[gpio_pin]=NULL; gpio_input_enable[gpio_pin]=false; //skip pin
+				continue;
+			}
+			gpio_poll[gpio_poll_count].fd=gpiod_line_event_get_fd(gpio_line[gpio_pin]);
+			gpio_poll[gpio_poll_count].events=POLLIN;
+			gpio_poll_pin[gpio_poll_count++]=gpio_pin;
 		}
 	}
+	if(debug){printf("---Debug : GPIO : %d pins monitored on %s\n",gpio_poll_count,gpio_chip_name);} //debug
 	
-	gpio_thread_rc=0; //update thread state
+	gpio_thread_rc=0; event_notify(); //update thread state
 	
 	while(gpio_thread_rc>-1){ //loop until fail
-		for(int gpio_pin=0;gpio_pin<54;gpio_pin++){ //initial loop to fill array with real data
-			if(getAlt(gpio_pin)==0){ //pin is a input
-				if((!gpio_input_activelow[gpio_pin]&&!digitalRead(gpio_pin))||(gpio_input_activelow[gpio_pin]&&digitalRead(gpio_pin))){ //gpio button is pressed
-					if(gpio_input_timestamp[gpio_pin]==0){ //no timestamp
-						if(debug){printf("---Debug : GPIO : %d : %lli : %lli\n",gpio_pin,timestamp_msec(),gpio_input_timestamp[gpio_pin]);} //debug
-						gpio_input_timestamp[gpio_pin]=timestamp_msec(); //update msec timestamp if no pressed before
-					}else{
-						if(gpio_input[gpio_pin]!=1&&button_pressed==-1&&(timestamp_msec()-gpio_input_timestamp[gpio_pin])>50){ //allow to trigger only once, trigger more than 50msec to avoid detect because of noise
-							if(debug){printf("---Debug : GPIO : %d : %lli : %lli\n",gpio_pin,timestamp_msec(),gpio_input_timestamp[gpio_pin]);} //debug
-							button_pressed=gpio_pin; //assign pin to pressed
-							gpio_input[gpio_pin]=1; //update pin array
-							break; //exit for loop
-						}
-					}
-				}else{ //gpio button not pressed
-					gpio_input[gpio_pin]=0; //reset pin value
-					gpio_input_timestamp[gpio_pin]=0; //reset pin timestamp
+		gpio_deadline=-1; //sleep until next edge if no pin held
+		for(tmploop=0;tmploop<gpio_poll_count;tmploop++){ //earliest pending press
+			gpio_pin=gpio_poll_pin[tmploop];
+			if(gpio_input_timestamp[gpio_pin]!=0&&gpio_input[gpio_pin]!=1&&(gpio_deadline<0||gpio_input_timestamp[gpio_pin]+51<gpio_deadline)){gpio_deadline=gpio_input_timestamp[gpio_pin]+51;}
+		}
+		timeout=-1;
+		if(gpio_deadline>=0){timeout=gpio_deadline-timestamp_msec(); if(timeout<0){timeout=0;}}
+		if(poll(gpio_poll,gpio_poll_count,timeout)<0&&errno!=EINTR){printf("GPIO : poll failed : %s\n",strerror(errno));break;} //wait for edge or deadline
+		
+		for(tmploop=0;tmploop<gpio_poll_count;tmploop++){ //read edges
+			if(!(gpio_poll[tmploop].revents&POLLIN)){continue;}
+			gpio_pin=gpio_poll_pin[tmploop];
+			if(gpiod_line_event_read(gpio_line[gpio_pin],&gpio_event)<0){continue;}
+			if((gpio_event.event_type==GPIOD_LINE_EVENT_RISING_EDGE)==(gpio_input_activelow[gpio_pin]!=0)){ //gpio button is pressed
+				if(gpio_input_timestamp[gpio_pin]==0){ //no timestamp
+					gpio_input_timestamp[gpio_pin]=gpio_event_msec(&gpio_event.ts); //update msec timestamp if no pressed before
+					if(debug){printf("---Debug : GPIO : %d : %lli : %lli\n",gpio_pin,timestamp_msec(),gpio_input_timestamp[gpio_pin]);} //debug
 				}
+			}else{ //gpio button released
+				gpio_input[gpio_pin]=0; //reset pin value
+				gpio_input_timestamp[gpio_pin]=0; //reset pin timestamp
 			}
 		}
 		
-		usleep(20*1000); //wait 20msec
+		for(tmploop=0;tmploop<gpio_poll_count;tmploop++){ //report held pins
+			gpio_pin=gpio_poll_pin[tmploop];
+			if(gpio_input_timestamp[gpio_pin]!=0&&gpio_input[gpio_pin]!=1&&(timestamp_msec()-gpio_input_timestamp[gpio_pin])>50){ //allow to trigger only once, trigger more than 50msec to avoid detect because of noise
+				if(debug){printf("---Debug : GPIO : %d : %lli : %lli\n",gpio_pin,timestamp_msec(),gpio_input_timestamp[gpio_pin]);} //debug
+				event_push(gpio_pin); //hand pin to user interface
+				gpio_input[gpio_pin]=1; //update pin array
+			}
+		}
 	}
 	
+	gpiod_chip_close(gpio_chip); //release all lines
 	pthread_cancel(gpio_thread); //close input thread if trouble
 	return NULL;
 }
@@ -167,7 +272,7 @@ void *adc_routine(void *){ //ADC input thread routine
 	int loop; //use for loop
 	if((i2c_handle=open(i2c_bus,O_RDWR))<0){ //failed open i2c bus
 		printf("\033[91mFailed to open the I2C bus : %d, Analog detection skipped\033[0m\n",i2c_bus);
-		adc_thread_rc=-3; //update thread state
+		adc_thread_rc=-3; event_notify(); //update thread state
 	}else{ //no problem opening i2c bus
 		for(loop=72;loop<=79;loop++){ //try to detect adc chip adresses
 			if(ioctl(i2c_handle,I2C_SLAVE,loop)<0){ //try access i2c device
@@ -208,10 +313,21 @@ void *adc_routine(void *){ //ADC input thread routine
 		*/
 		if(adc_detected==0){adc_thread_rc=-2; //no chip detected
 		}else{adc_thread_rc=0;} //ok
+		event_notify();
 		
 	}
 	
-	while(adc_thread_rc>-1){ //loop until fail
+	struct timespec adc_next; //next sampling time
+	clock_gettime(CLOCK_MONOTONIC,&adc_next);
+	
+	while(adc_thread_rc>-1&&!adc_thread_stop){ //loop until fail or stop
+		if(adc_user&&(adc_calibration||adc_calibration_done)){ //fixed sampling rate, wait for next period
+			adc_next.tv_nsec+=1000000000L/adc_rate;
+			if(adc_next.tv_nsec>=1000000000L){adc_next.tv_sec++;adc_next.tv_nsec-=1000000000L;}
+			if(adc_next.tv_sec*1000LL+adc_next.tv_nsec/1000000<timestamp_msec()-1000/adc_rate){clock_gettime(CLOCK_MONOTONIC,&adc_next);} //more than a period late (standby, slow bus), restart from now
+			clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&adc_next,NULL);
+		}
+		
 		if(adc_user&&adc_calibration){ // user selected right adc type but calibration in progress
 			if(adc_ads1015){ADS1015_read(adc_address_ads1015); //read ads1015 values
 			}else if(adc_mcp3021){ //mcp3021 use
@@ -220,7 +336,7 @@ void *adc_routine(void *){ //ADC input thread routine
 				}
 			}
 			
-			if((time(NULL)-scanning_start)>4){adc_calibration_done=true; adc_calibration=false;} //calibration done
+			if(timestamp_msec()-scanning_start>=adc_rest_msec){adc_rest(); adc_calibration_done=true; adc_calibration=false; event_notify();} //calibration done
 		}else if(adc_user&&adc_calibration_done){ // user selected right adc type and calibration done
 			if(adc_ads1015){ADS1015_read(adc_address_ads1015); //read ads1015 values
 			}else if(adc_mcp3021){ //mcp3021 use
@@ -230,7 +346,11 @@ void *adc_routine(void *){ //ADC input thread routine
 				}
 			}
 			
-		}else{sleep(1);} // standby until user selected right adc type
+		}else{ // standby until user selected right adc type
+			pthread_mutex_lock(&event_mutex);
+			while(!adc_thread_stop&&!(adc_user&&(adc_calibration||adc_calibration_done))){event_wait_until(-1);}
+			pthread_mutex_unlock(&event_mutex);
+		}
 	}
 	
 	if(adc_thread_rc>-3){close(i2c_handle);} //close the handle
@@ -246,13 +366,8 @@ void MCP3021_read(int addr,int index){ //function to read MCP3021 values
 		//if(debug){printf("\r");} //debug
 		read(i2c_handle,i2c_buffer,2); //get result
 		adc_val_tmp=(i2c_buffer[0]<<8)|(i2c_buffer[1]&0xff); //combine buffer bytes into integer
-		adc_value[index]=adc_val_tmp; //backup new value
-		if(adc_center[index]==-1){adc_center[index]=adc_val_tmp;} //set center value if not set
-		if(adc_min[index]==-1){adc_min[index]=adc_val_tmp;} //set min value if not set
-		if(adc_val_tmp<adc_min[index]){adc_min[index]=adc_val_tmp;} //update min value
-		if(adc_max[index]==-1){adc_max[index]=adc_val_tmp;} //set max value if not set
-		if(adc_val_tmp>adc_max[index]){adc_max[index]=adc_val_tmp;} //update max value
-		if(debug){printf("%04d (min: %04d,center: %04d,max: %04d) , ",adc_val_tmp,adc_min[index],adc_center[index],adc_max[index]);} //debug
+		adc_sample(index,adc_val_tmp); //update histograms
+		if(debug){printf("%04d (center: %04d,noise: %04d) , ",adc_val_tmp,adc_center[index],adc_noise[index]);} //debug
 	}else{return ;}
 }
 
@@ -272,24 +387,80 @@ void ADS1015_read(int addr){
 			write(i2c_handle,i2c_buffer,1); //select conversion register
 			read(i2c_handle,i2c_buffer,2); //get result
 			adc_val_tmp=((i2c_buffer[0]<<8)|(i2c_buffer[1]&0xff))>>4; //combine to int
-			adc_value[loop]=adc_val_tmp; //backup new value
-			if(adc_center[loop]==-1){adc_center[loop]=adc_val_tmp;} //set center value if not set
-			if(adc_min[loop]==-1){adc_min[loop]=adc_val_tmp;} //set min value if not set
-			if(adc_val_tmp<adc_min[loop]){adc_min[loop]=adc_val_tmp;} //update min value
-			if(adc_max[loop]==-1){adc_max[loop]=adc_val_tmp;} //set max value if not set
-			if(adc_val_tmp>adc_max[loop]){adc_max[loop]=adc_val_tmp;} //update max value
-			//if(debug){printf("%d : %04d (min: %04d,center: %04d,max: %04d), ",loop,adc_val_tmp,adc_min[loop],adc_center[loop],adc_max[loop]);} //debug
+			adc_sample(loop,adc_val_tmp); //update histograms
+			//if(debug){printf("%d : %04d (center: %04d,noise: %04d), ",loop,adc_val_tmp,adc_center[loop],adc_noise[loop]);} //debug
 		}
 	}else{return ;} //failed to access i2c device
 }
 
 
 
+void adc_sample(int index,int value){ //store a new adc value: at-rest histogram during calibration, moved histogram after
+	value&=0xFFF; //12bits
+	pthread_mutex_lock(&adc_mutex);
+	adc_value[index]=value; //backup new value
+	if(adc_calibration){adc_hist_rest[index][value]++; adc_hist_rest_count[index]++; //at rest
+	}else if(adc_noise[index]>=0&&abs(value-adc_center[index])>adc_noise[index]){adc_hist_move[index][value]++; adc_hist_move_count[index]++;} //moved out of the at-rest spread
+	pthread_mutex_unlock(&adc_mutex);
+}
+
+
+
+int adc_percentile(const unsigned int *hist,unsigned int count,int permille){ //lowest value with more than permille/1000 of the samples at or below it
+	unsigned long long target=(unsigned long long)count*permille/1000, sum=0;
+	for(int value=0;value<4096;value++){
+		sum+=hist[value];
+		if(sum>target){return value;}
+	}
+	return 4095;
+}
+
+
+
+void adc_rest(){ //end of calibration: center from the most frequent value, noise from the trimmed at-rest spread
+	pthread_mutex_lock(&adc_mutex);
+	for(int index=0;index<8;index++){
+		if(!adc_hist_rest_count[index]){continue;} //never read
+		adc_center[index]=0;
+		for(int value=1;value<4096;value++){if(adc_hist_rest[index][value]>adc_hist_rest[index][adc_center[index]]){adc_center[index]=value;}} //mode
+		adc_noise[index]=adc_percentile(adc_hist_rest[index],adc_hist_rest_count[index],1000-adc_trim)-adc_percentile(adc_hist_rest[index],adc_hist_rest_count[index],adc_trim);
+		if(debug){printf("---Debug : ADC : %d : %u samples, center %d, noise %d\n",index,adc_hist_rest_count[index],adc_center[index],adc_noise[index]);} //debug
+	}
+	pthread_mutex_unlock(&adc_mutex);
+}
+
+
+
+void adc_limits(){ //update adc min and max from the trimmed moved histogram, at-rest spread if never moved
+	pthread_mutex_lock(&adc_mutex);
+	for(int index=0;index<8;index++){
+		if(adc_hist_move_count[index]){
+			adc_min[index]=adc_percentile(adc_hist_move[index],adc_hist_move_count[index],adc_trim);
+			adc_max[index]=adc_percentile(adc_hist_move[index],adc_hist_move_count[index],1000-adc_trim);
+		}else if(adc_hist_rest_count[index]){
+			adc_min[index]=adc_percentile(adc_hist_rest[index],adc_hist_rest_count[index],adc_trim);
+			adc_max[index]=adc_percentile(adc_hist_rest[index],adc_hist_rest_count[index],1000-adc_trim);
+		}
+		if(debug&&adc_hist_rest_count[index]){printf("---Debug : ADC : %d : %u moved samples, min %d, max %d\n",index,adc_hist_move_count[index],adc_min[index],adc_max[index]);} //debug
+	}
+	pthread_mutex_unlock(&adc_mutex);
+}
+
+
+
+int adc_fuzz(int index){ //axis fuzz from at-rest noise, 16 at least
+	if(adc_noise[index]/2>16){return adc_noise[index]/2;}
+	return 16;
+}
+
+
+
 int adc_highest_delta(){ //function to report high adc index delta for adc-axis correspondance
 	int delta_current=0; //current delta for current loop
 	int delta_max=0; //maximum delta detected
 	int adc=0; //adc index
 	
+	pthread_mutex_lock(&adc_mutex);
 	for(int delta_loop=0;delta_loop<adc_address_count;delta_loop++){ //loop
 		if(adc_skip[delta_loop]==0){ //adc not skipped
 			delta_current=adc_center[delta_loop]-adc_value[delta_loop]; //compute current delta
@@ -300,22 +471,23 @@ int adc_highest_delta(){ //function to report high adc index delta for adc-axis
 			}
 		}
 	}
+	pthread_mutex_unlock(&adc_mutex);
 	return adc; //return adc index
 }
 
 
 
-int Wait_User_Input(int forbidden_pin,int timeout){ //function to report user input
-	long long start=time(NULL); //initial timestamp
+int Wait_User_Input(int forbidden_pin,int timeout){ //function to report user input, block until a allowed pin is pressed or timeout (sec) expired
+	long long deadline=-1; //no timeout
+	if(timeout>0){deadline=timestamp_msec()+timeout*1000LL;}
+	pthread_mutex_lock(&event_mutex);
 	while(true){ //loop until input detected
-		if(button_pressed!=-1){ //user pressed a allow key
-			button_pressed_tmp=button_pressed; //backup
-			button_pressed=-1; //reset gpio button
-			if(button_pressed_tmp!=forbidden_pin&&gpio_input_enable[button_pressed_tmp]){return button_pressed_tmp;} //return gpio pin if not a forbidden pin
+		while(event_queue_count==0){ //nothing pressed yet
+			if(!event_wait_until(deadline)){pthread_mutex_unlock(&event_mutex);return -1;} //return -1 if timeout
 		}
-		
-		if(timeout>0&&time(NULL)-start>timeout){return -1;} //return -1 if timeout
-		usleep(25*1000); //wait 25msec
+		button_pressed_tmp=event_queue[event_queue_head]; //oldest pressed pin
+		event_queue_head=(event_queue_head+1)%EVENT_QUEUE_SIZE; event_queue_count--;
+		if(button_pressed_tmp!=forbidden_pin&&gpio_input_enable[button_pressed_tmp]){pthread_mutex_unlock(&event_mutex);return button_pressed_tmp;} //return gpio pin if not a forbidden pin
 	}
 }
 
@@ -334,7 +506,9 @@ void show_usage(void){ //usage
 "Options:\n"
 "\t-debug, enable some debug stuff [Optional]\n"
 "\t-adcselect, enable user to select ADC chip type [Optional]\n"
-"\t-maxnoise, maximum noise allowed for ADC chip, relative from raw analog center, lower value than 60 could create false positive [Optional]\n"
+"\t-maxnoise, maximum noise allowed for ADC chip, spread of at-rest values, lower value than 60 could create false positive [Optional]\n"
+"\t-adcrate, ADC sampling rate in Hz during calibration, default 100 [Optional]\n"
+"\t-gpiochip, gpio chip of the buttons (name, path, label or number), default gpiochip0 [Optional]\n"
 ,programversion);
 }
 
@@ -344,10 +518,14 @@ int main(int argc, char *argv[]){ //main
 		if(strcmp(argv[i],"-help")==0){show_usage();return 1;
 		}else if(strcmp(argv[i],"-maxnoise")==0){adc_maxnoise=atoi(argv[i+1]);
 		}else if(strcmp(argv[i],"-adcselect")==0){adc_user=false;
+		}else if(strcmp(argv[i],"-adcrate")==0&&i+1<argc){adc_rate=atoi(argv[i+1]); if(adc_rate<1||adc_rate>1000){adc_rate=100;}
+		}else if(strcmp(argv[i],"-gpiochip")==0&&i+1<argc){strncpy(gpio_chip_name,argv[i+1],sizeof(gpio_chip_name)-1);
 		}else if(strcmp(argv[i],"-debug")==0){debug=true;}
 	}
 	
 	setbuf(stdout,NULL); //unbuffered stdout to allow rewrite on the same line
+	pthread_condattr_t event_condattr; //timed waits on monotonic clock, same as timestamp_msec
+	pthread_condattr_init(&event_condattr); pthread_condattr_setclock(&event_condattr,CLOCK_MONOTONIC); pthread_cond_init(&event_cond,&event_condattr);
 	int tmploop,axisloop; //variables to count loop
 	int delta_max=0; //max detected delta
 	int adc_useinput=-1; //gpio user input
@@ -384,14 +562,6 @@ int main(int argc, char *argv[]){ //main
 	*/
 	
 	
-	pthread_create(&gpio_thread, NULL, gpio_routine, NULL); //create routine thread
-	sleep(1); while(gpio_thread_rc<0){sleep(2);} //wait until gpio fully initialize
-	
-	//once gpio is setup, it is needed to read all inputs at least one time to ensure all pullup will work
-	scanning_start=time(NULL); //scan start timestamp
-	while(time(NULL)-scanning_start<2){button_pressed=-1;} //read for 2sec, reset gpio button
-	
-	
 	printf("\033[1m\033[93m###### Before Start ######\033[0m\n");
 	printf("\033[93mVery important: Because this program is design to create a new configuration file from scratch, it can really mess controls if something goes wrong.\n");
 	printf("If you think you have make a mistake somewhere, you will be able to restart analog and GPIO part as you want.\n");
@@ -405,10 +575,18 @@ int main(int argc, char *argv[]){ //main
 	}else{printf("\033[92mDriver killed with success\033[0m\n\n");} //continue
 	
 	
+	pthread_create(&gpio_thread, NULL, gpio_routine, NULL); //create routine thread, after the driver released its gpio lines
+	thread_wait(&gpio_thread_rc,-1); //wait until gpio fully initialize
+	if(gpio_thread_rc<0){printf("\033[91mFailed to monitor GPIO, exiting\033[0m\n\n"); system("modprobe mk_arcade_joystick_rpi"); return 0;} //restart driver and exit
+	
+	//once gpio is setup, allow pullups to settle and drop edges they triggered
+	sleep(2); event_flush(); //reset gpio button
+	
+	
 	//buttons for item selection
 	printf("\033[1m###### Bind button for User interaction ######\033[0m\n");
 	printf("Please press \033[92m(A)\033[0m button once");
-	button_pressed=-1; //reset user input
+	event_flush(); //reset user input
 	button_A_gpio=Wait_User_Input(-2,-1); //recover user input
 	printf("\033[2K\r\033[92m(A)\033[0m button bind on \033[1mpin %d\033[0m\n",button_A_gpio);
 	
@@ -430,8 +608,6 @@ int main(int argc, char *argv[]){ //main
 					printf("\033[1mRestarting MK Arcade Joystick Rpi Driver\033[0m\n");
 					system("modprobe mk_arcade_joystick_rpi"); //system command
 				}
-				adc_thread_rc=-1; //kill adc thread
-				gpio_thread_rc=-1; //kill gpio thread
 				sleep(5); //allow some time to start the driver
 				return 0; //exit
 			}
@@ -445,13 +621,9 @@ int main(int argc, char *argv[]){ //main
 	printf("\033[1m###### Analog part ######\033[0m\n");
 	pthread_create(&adc_thread, NULL, adc_routine, NULL); //create routine thread
 	
-	scanning_start=time(NULL);
-	while(adc_thread_rc<0){ //detection in progress, wait until gpio fully initialize
-		if((time(NULL)-scanning_start)>9){ //timeout
-			printf("\033[91mADC chip detection timeout (10sec), skipping analog part\033[0m\n\n");
-			adc_ads1015=false; adc_mcp3021=false; adc_detected=0; //disable both analog possible chip
-			break; //exit while loop
-		}else{sleep(2);}
+	if(thread_wait(&adc_thread_rc,10)==-1){ //detection still in progress, timeout
+		printf("\033[91mADC chip detection timeout (10sec), skipping analog part\033[0m\n\n");
+		adc_ads1015=false; adc_mcp3021=false; adc_detected=0; //disable both analog possible chip
 	}
 	
 	if(adc_mcp3021||adc_ads1015){ //adc chip detected
@@ -476,7 +648,7 @@ int main(int argc, char *argv[]){ //main
 					if(button_tmpbis_gpio==button_A_gpio){ //valid input
 						if(button_tmp_gpio==button_A_gpio){printf("\033[2K\r\033[1mMCP3021A\033[0m will be used\n\n");adc_mcp3021=true;adc_ads1015=false;
 						}else if(button_tmp_gpio==button_B_gpio){printf("\033[2K\r\033[1mADS1015\033[0m will be used\n\n");adc_mcp3021=false;adc_ads1015=true;}
-						adc_user=true; //to notify adc thread of user chip selection
+						adc_user=true; event_notify(); //to notify adc thread of user chip selection
 						retry=false; //disable loop
 					}
 				}
@@ -491,15 +663,17 @@ int main(int argc, char *argv[]){ //main
 		
 		
 		printf("\033[93mVery important: Calibration in progress\033[0m\n");
-		printf("\033[93mPlease touch nothing for \033[1m5sec\033[0m\n");
-		scanning_start=time(NULL); //start calibration time
-		adc_calibration=true; //start calibration
-		while(adc_calibration){sleep(1);} printf("\033[2K\rDone\n"); //calibation
+		printf("\033[93mPlease touch nothing for \033[1m%dsec\033[0m\n",adc_rest_msec/1000);
+		scanning_start=timestamp_msec(); //start calibration time
+		adc_calibration=true; event_notify(); //start calibration
+		pthread_mutex_lock(&event_mutex); while(adc_calibration){event_wait_until(-1);} pthread_mutex_unlock(&event_mutex); //wait until adc thread is done
+		printf("\033[2K\rDone\n"); //calibation
 		
 		adc_detected=0; //reset adc chip detected count
+		pthread_mutex_lock(&adc_mutex);
 		for(tmploop=0;tmploop<adc_address_count;tmploop++){ //detect high noise
-			if(adc_max[tmploop]-adc_min[tmploop]>adc_maxnoise){ //high noise in input
-				printf("\033[91mHigh noise level : %d, ",adc_max[tmploop]-adc_min[tmploop]); //report noise
+			if(adc_noise[tmploop]>adc_maxnoise){ //high noise in input
+				printf("\033[91mHigh noise level : %d, ",adc_noise[tmploop]); //report noise
 				if(adc_mcp3021){printf("%d (0x%2x)\n",adc_address[tmploop],adc_address[tmploop]); //mcp
 				}else if(adc_ads1015){printf("AIN%d",tmploop);} //ads
 				printf(" skipped\033[0m\n");
@@ -507,6 +681,7 @@ int main(int argc, char *argv[]){ //main
 				if(adc_center[tmploop]!=-1){adc_skip[tmploop]=0;adc_detected++;} //if center detected, enable this i2c adress or ain
 			}
 		}
+		pthread_mutex_unlock(&adc_mutex);
 		printf("\n");
 		adc_detected_back=adc_detected; //backup for next part
 		
@@ -519,14 +694,14 @@ int main(int argc, char *argv[]){ //main
 		
 		while(retrymain){
 			adc_calibration_done=true;
-			button_pressed=-1; //reset gpio button
+			event_flush(); //reset gpio button
 			adc_detected=adc_detected_back; //restore
 			for(tmploop=0;tmploop<adc_address_count;tmploop++){adc_skip[tmploop]=adc_skipbackup[tmploop];} //reset adc skip
 			for(axisloop=0;axisloop<4;axisloop++){adc_mapping[axisloop]=-1;} //reset
 			
 			for(axisloop=0;axisloop<4;axisloop++){ //start axis user definition
 				if(adc_detected){ //remaining analog to use
-					adc_useinput=-1; delta_max=0; button_pressed=-1; //reset
+					adc_useinput=-1; delta_max=0; event_flush(); //reset
 					
 					retry=true;
 					while(retry){
@@ -550,7 +725,7 @@ int main(int argc, char *argv[]){ //main
 			}
 			
 			if(debug){printf("x1: %d,y1: %d,x2: %d,y2: %d\n",adc_mapping[0],adc_mapping[1],adc_mapping[2],adc_mapping[3]);} //debug
-			for(tmploop=0;tmploop<adc_address_count;tmploop++){adc_min[tmploop]=-1;adc_max[tmploop]=-1;} //reset min/max
+			pthread_mutex_lock(&adc_mutex); memset(adc_hist_move,0,sizeof(adc_hist_move)); memset(adc_hist_move_count,0,sizeof(adc_hist_move_count)); pthread_mutex_unlock(&adc_mutex); //reset min/max
 			
 			if(adc_mapping[0]>-1&&adc_mapping[1]>-1){ //x1 and y1 defined
 				printf("\033[2K\r\033[1mSlightly move analogs to their edges\033[0m then press \033[92m(A)\033[0m");
@@ -564,6 +739,7 @@ int main(int argc, char *argv[]){ //main
 					}
 				}
 				
+				adc_limits(); //compute limits from samples read so far
 				printf("\033[2K\r\033[1m%s\033[0m Analog limits :\n",str_analog_position[0]);
 				
 				printf("\033[1m%s\033[0m : ",str_analog_axis[0]);
@@ -625,7 +801,7 @@ int main(int argc, char *argv[]){ //main
 		}
 	}else{printf("\033[91mNo analog input detected, Skiping analog part\033[0m\n\n");} //no adc chip
 	
-	adc_thread_rc=-1; //end adc thread
+	adc_thread_stop=true; event_notify(); pthread_join(adc_thread,NULL); //end adc thread, limits are final after this
 	
 	//gpio part
 	printf("\033[1m###### GPIO part ######\033[0m\n");
@@ -655,7 +831,7 @@ int main(int argc, char *argv[]){ //main
 					}
 					gpio_input_enable[tmpinput]=false; //disallow user to bind one pin to multiple buttons
 					if(gpio_button_link_table[tmploop]==12){ //hotkey button
-						button_pressed=-1; //reset gpio button
+						event_flush(); //reset gpio button
 						retry=true;
 						while(retry){
 							printf("\033[2K\rPlease select \033[1mHotkey\033[0m mode : \033[92m(A)\033[0m for \033[1mNormal\033[0m, \033[92m(B)\033[0m for \033[1mToggle\033[0m");
@@ -714,7 +890,7 @@ int main(int argc, char *argv[]){ //main
 				adc_min[adc_mapping[0]]=adc_max[adc_mapping[0]]; adc_max[adc_mapping[0]]=adc_tmp; //swap
 			}
 			
-			sprintf(text_config_buffer, " x1params=%d,%d,16,300",adc_min[adc_mapping[0]],adc_max[adc_mapping[0]]); strcat(text_config,text_config_buffer); //x1params
+			sprintf(text_config_buffer, " x1params=%d,%d,%d,300",adc_min[adc_mapping[0]],adc_max[adc_mapping[0]],adc_fuzz(adc_mapping[0])); strcat(text_config,text_config_buffer); //x1params
 			
 			if(adc_reverse[adc_mapping[1]]<1){
 				sprintf(text_config_buffer, " y1dir=%d",-1); strcat(text_config,text_config_buffer); //y1dir
@@ -727,7 +903,7 @@ int main(int argc, char *argv[]){ //main
 				adc_min[adc_mapping[1]]=adc_max[adc_mapping[1]]; adc_max[adc_mapping[1]]=adc_tmp; //swap
 			}
 			
-			sprintf(text_config_buffer, " y1params=%d,%d,16,300",adc_min[adc_mapping[1]],adc_max[adc_mapping[1]]); strcat(text_config,text_config_buffer); //y1params
+			sprintf(text_config_buffer, " y1params=%d,%d,%d,300",adc_min[adc_mapping[1]],adc_max[adc_mapping[1]],adc_fuzz(adc_mapping[1])); strcat(text_config,text_config_buffer); //y1params
 		}
 		
 		if(adc_mapping[2]>-1&&adc_mapping[3]>-1){ //x2 and y2 defined
@@ -745,7 +921,7 @@ int main(int argc, char *argv[]){ //main
 				adc_min[adc_mapping[2]]=adc_max[adc_mapping[2]]; adc_max[adc_mapping[2]]=adc_tmp; //swap
 			}
 			
-			sprintf(text_config_buffer, " x2params=%d,%d,16,300",adc_min[adc_mapping[2]],adc_max[adc_mapping[2]]); strcat(text_config,text_config_buffer); //x2params
+			sprintf(text_config_buffer, " x2params=%d,%d,%d,300",adc_min[adc_mapping[2]],adc_max[adc_mapping[2]],adc_fuzz(adc_mapping[2])); strcat(text_config,text_config_buffer); //x2params
 			
 			if(adc_reverse[adc_mapping[3]]<1){
 				sprintf(text_config_buffer, " y2dir=%d",-1); strcat(text_config,text_config_buffer); //y2dir
@@ -758,7 +934,7 @@ int main(int argc, char *argv[]){ //main
 				adc_min[adc_mapping[3]]=adc_max[adc_mapping[3]]; adc_max[adc_mapping[3]]=adc_tmp; //swap
 			}
 			
-			sprintf(text_config_buffer, " y2params=%d,%d,16,300",adc_min[adc_mapping[3]],adc_max[adc_mapping[3]]); strcat(text_config,text_config_buffer); //y2params
+			sprintf(text_config_buffer, " y2params=%d,%d,%d,300",adc_min[adc_mapping[3]],adc_max[adc_mapping[3]],adc_fuzz(adc_mapping[3])); strcat(text_config,text_config_buffer); //y2params
 		}
 	}
 	
@@ -830,8 +1006,6 @@ int main(int argc, char *argv[]){ //main
 		system("modprobe mk_arcade_joystick_rpi"); //system command
 	}
 	
-	adc_thread_rc=-1; //kill adc thread
-	gpio_thread_rc=-1; //kill gpio thread
 	sleep(5); //allow some time to start the driver
 	
 	return(0);
@@ -0,0 +1,35 @@
+#!/bin/bash
+# End-to-end latency on any Linux box: gpio-sim chip + driver in gpiolib mode + mk_latency
+# usage : sudo tests/latency.sh [mk_latency options], e.g. -n 1000 -s 4 -o latency.json
+# needs CONFIG_GPIO_SIM, configfs and the module built with "make" in the base directory
+
+set -e
+cd "$(dirname "$0")"
+CFS=/sys/kernel/config/gpio-sim/mk-latency
+LABEL=mk-latency-sim
+LINE=${LATENCY_LINE:-24} # b button with map=1
+MODULE=../mk_arcade_joystick_rpi.ko
+
+cleanup(){
+    rmmod mk_arcade_joystick_rpi 2>/dev/null || true
+    if [ -d "$CFS" ]; then
+        echo 0 > "$CFS/live" 2>/dev/null || true
+        rmdir "$CFS/gpio-bank0" "$CFS" 2>/dev/null || true
+    fi
+}
+trap cleanup EXIT
+
+[ -e "$MODULE" ] || { echo "build the driver first ($MODULE missing)"; exit 1; }
+modprobe gpio-sim
+mountpoint -q /sys/kernel/config || mount -t configfs none /sys/kernel/config
+cleanup
+
+mkdir -p "$CFS/gpio-bank0"
+echo 32 > "$CFS/gpio-bank0/num_lines"
+echo "$LABEL" > "$CFS/gpio-bank0/label"
+echo 1 > "$CFS/live"
+PULL="/sys/devices/platform/$(cat $CFS/dev_name)/$(cat $CFS/gpio-bank0/chip_name)/sim_gpio$LINE/pull"
+
+insmod "$MODULE" map=1 gpiobackend=1 gpiochip="$LABEL"
+sleep 1
+./mk_latency -p "$PULL" "$@"
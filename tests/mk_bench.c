@@ -0,0 +1,279 @@
+/*
+ *  Arcade Joystick Driver for RaspberryPi, per tick processing cost
+ *
+ *  Runs the driver core logic in a tight loop and reports the cost of each
+ *  step of a poll: GPIO bitmap decode, hotkey handling, analog calibration
+ *  (computed or from a response curve table),
+ *  evdev diffing, a whole pad tick and the axis dispatch of the poll. I2C transfers and the ADS1015
+ *  conversion wait are not measured, the fake chips answer immediately.
+ *
+ *  usage : mk_bench [-n iterations] [-o results.json]
+ *
+ *  Results are written as one JSON object, ns per operation.
+ */
+
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/utsname.h>
+
+#include "mk_sim.h"
+
+#define BENCH_DEFAULT_ITERATIONS 1000000
+#define BENCH_SAMPLES 1024 //input patterns, power of 2
+
+struct bench_result {const char *name; double ns;};
+
+static struct bench_result bench_results[16];
+static int bench_result_count;
+static volatile unsigned long bench_sink; //keep results alive
+
+static uint32_t bench_levels[BENCH_SAMPLES][2]; //GPLEV0/GPLEV1 patterns
+static int bench_adc[BENCH_SAMPLES]; //raw 12bits patterns
+
+static const int bench_gpio_maps[MK_MAX_BUTTONS] = {4, 17, 27, 22, 10, 9, 25, 24, 23, 18, 15, 14, 2, 33, 34, 35, -40, 41, 42, 43, 44}; //all buttons used
+
+
+static uint64_t bench_now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void bench_add(const char *name, uint64_t start, uint64_t end, unsigned long ops){
+    bench_results[bench_result_count].name = name;
+    bench_results[bench_result_count].ns = (double)(end - start) / ops;
+    bench_result_count++;
+}
+
+
+static void bench_init_samples(void){ //buttons change on 1 tick out of 8, sticks wander around center
+    uint32_t seed = 0x12345678;
+    int i;
+
+    for(i = 0; i < BENCH_SAMPLES; i++){
+        seed = seed * 1103515245 + 12345;
+        if(i % 8 == 0){bench_levels[i][0] = ~(seed & 0x0F8C0E34); bench_levels[i][1] = ~((seed >> 8) & 0x1F0E);
+        }else if(i){bench_levels[i][0] = bench_levels[i - 1][0]; bench_levels[i][1] = bench_levels[i - 1][1];
+        }else{bench_levels[i][0] = bench_levels[i][1] = 0xFFFFFFFF;}
+        bench_adc[i] = 300 + (seed >> 16) % 3200;
+    }
+}
+
+
+static void bench_setup_pad(int axes){
+    int i;
+
+    sim_reset();
+    memcpy(sim_gpio_maps, bench_gpio_maps, sizeof(sim_gpio_maps));
+    sim_hotkey_mode = HOTKEY_MODE_TOGGLE;
+    for(i = 0; i < axes; i++){
+        sim_axis_enable[i] = true;
+        sim_axis_params[i] = (struct analog_abs_params_struct){374, 3418, 16, 384};
+        sim_axis_offset[i] = 1;
+        sim_abs_fuzz[sim_axis_abs[i]] = 16;
+    }
+}
+
+
+static void bench_gpio_decode(unsigned long n){
+    uint64_t start;
+    unsigned long i, acc = 0;
+
+    start = bench_now_ns();
+    for(i = 0; i < n; i++){
+        const uint32_t *lev = bench_levels[i & (BENCH_SAMPLES - 1)];
+        acc += mk_levels_to_pressed(bench_gpio_maps, lev[0], lev[1]);
+    }
+    bench_add("gpio_decode", start, bench_now_ns(), n);
+    bench_sink = acc;
+}
+
+
+static void bench_buttons_decode(unsigned long n, int hotkey_mode, const char *name){
+    struct mk_hotkey hk = {0xFF, 0, -1, 0, 0, -1, 0, -1};
+    unsigned char data[MK_MAX_BUTTONS] = {0};
+    unsigned long pressed[BENCH_SAMPLES];
+    uint64_t start;
+    unsigned long i;
+
+    for(i = 0; i < BENCH_SAMPLES; i++){pressed[i] = mk_levels_to_pressed(bench_gpio_maps, bench_levels[i][0], bench_levels[i][1]);}
+    start = bench_now_ns();
+    for(i = 0; i < n; i++){mk_buttons_decode(bench_gpio_maps, hotkey_mode, &hk, pressed[i & (BENCH_SAMPLES - 1)], data);}
+    bench_add(name, start, bench_now_ns(), n);
+    bench_sink = data[HOTKEY_BUTTON];
+}
+
+
+static void bench_analog_axis(unsigned long n, const int16_t *curve, const char *name){
+    struct analog_abs_params_struct params = {374, 3418, 16, 384};
+    uint16_t seen_min = 0xFFFF, seen_max = 0;
+    uint64_t start;
+    unsigned long i, acc = 0;
+
+    start = bench_now_ns();
+    for(i = 0; i < n; i++){acc += mk_analog_process(bench_adc[i & (BENCH_SAMPLES - 1)], i & 1, &seen_min, &seen_max, &params, 1, curve, 0);}
+    bench_add(name, start, bench_now_ns(), n);
+    bench_sink = acc;
+}
+
+
+static void bench_evdev_diff(unsigned long n){ //input core filtering of the reported values
+    uint64_t start;
+    unsigned long i;
+    int j;
+
+    bench_setup_pad(4);
+    start = bench_now_ns();
+    for(i = 0; i < n; i++){
+        sim_event_count = 0;
+        for(j = 0; j < 4; j++){sim_report_abs(sim_axis_abs[j], bench_adc[(i + j) & (BENCH_SAMPLES - 1)]);}
+        for(j = 0; j < MK_MAX_BUTTONS - 4; j++){sim_report_key(j, (bench_levels[i & (BENCH_SAMPLES - 1)][0] >> j) & 1);}
+    }
+    bench_add("evdev_diff", start, bench_now_ns(), n);
+    bench_sink = sim_event_count;
+}
+
+
+static double bench_tick(unsigned long n, int axes, const char *name){ //whole poll of one pad
+    uint64_t start;
+    unsigned long i;
+    int j;
+
+    bench_setup_pad(axes);
+    start = bench_now_ns();
+    for(i = 0; i < n; i++){
+        const uint32_t *lev = bench_levels[i & (BENCH_SAMPLES - 1)];
+        sim_gplev[0] = lev[0]; sim_gplev[1] = lev[1];
+        for(j = 0; j < axes; j++){sim_ain[j] = bench_adc[(i + j) & (BENCH_SAMPLES - 1)];}
+        sim_tick();
+    }
+    bench_add(name, start, bench_now_ns(), n);
+    bench_sink = sim_event_count;
+    return bench_results[bench_result_count - 1].ns;
+}
+
+
+static volatile bool bench_enable[4], bench_reverse[4]; //xN_enable/xN_reverse module parameters, reloaded every tick as around the input core calls
+
+static inline void bench_axis_step(int i, bool reverse, int abs, int16_t adc_val){ //one axis of mk_input_report
+    adc_val = mk_adc_filter(&sim_axis_filter[i], adc_val);
+    adc_val = mk_smooth(&sim_axis_smooth[i], adc_val, SIM_POLL_US);
+    adc_val = mk_analog_process(adc_val, reverse, &sim_axis_min[i], &sim_axis_max[i], &sim_axis_params[i], sim_axis_offset[i], NULL, 0);
+    sim_report_abs(abs, adc_val);
+}
+
+
+static void bench_axes_dispatch(unsigned long n, bool table){ //x1,y1 of 4 axes: four blocks testing the parameters as before the axis table, or the table of enabled axes
+    struct {int axis, abs; bool reverse;} axes[4];
+    int16_t adc_values[4];
+    int count = 0;
+    uint64_t start;
+    unsigned long i;
+    int j;
+
+    bench_setup_pad(2);
+    for(j = 0; j < 4; j++){bench_enable[j] = sim_axis_enable[j]; bench_reverse[j] = j & 1;}
+    for(j = 0; j < 4; j++){if(bench_enable[j]){axes[count].axis = j; axes[count].abs = sim_axis_abs[j]; axes[count++].reverse = bench_reverse[j];}} //mk_hotpath_init
+    start = bench_now_ns();
+    for(i = 0; i < n; i++){
+        sim_event_count = 0;
+        for(j = 0; j < 4; j++){adc_values[j] = bench_adc[(i + j) & (BENCH_SAMPLES - 1)];}
+        if(table){
+            sim_report_abs(SIM_ABS_HAT0X, 0); //hat codes chosen once
+            sim_report_abs(SIM_ABS_HAT0Y, 0);
+            for(j = 0; j < count; j++){bench_axis_step(axes[j].axis, axes[j].reverse, axes[j].abs, adc_values[axes[j].axis]);}
+        }else{
+            sim_report_abs(bench_enable[0] ? SIM_ABS_HAT0X : SIM_ABS_X, 0);
+            sim_report_abs(bench_enable[1] ? SIM_ABS_HAT0Y : SIM_ABS_Y, 0);
+            if(bench_enable[0]){bench_axis_step(0, bench_reverse[0], SIM_ABS_X, adc_values[0]);}
+            if(bench_enable[1]){bench_axis_step(1, bench_reverse[1], SIM_ABS_Y, adc_values[1]);}
+            if(bench_enable[2]){bench_axis_step(2, bench_reverse[2], SIM_ABS_RX, adc_values[2]);}
+            if(bench_enable[3]){bench_axis_step(3, bench_reverse[3], SIM_ABS_RY, adc_values[3]);}
+        }
+    }
+    bench_add(table ? "axes_table" : "axes_unrolled", start, bench_now_ns(), n);
+    bench_sink = sim_event_count;
+}
+
+static void bench_write(FILE *f, unsigned long n){
+    struct utsname uts;
+    int i;
+
+    uname(&uts);
+    fprintf(f, "{\n  \"machine\": \"%s\",\n", uts.machine);
+#if defined(__clang__)
+    fprintf(f, "  \"compiler\": \"clang %s\",\n", __clang_version__);
+#elif defined(__GNUC__)
+    fprintf(f, "  \"compiler\": \"gcc %s\",\n", __VERSION__);
+#endif
+#if defined(__ARM_ARCH)
+    fprintf(f, "  \"target\": \"armv%d\",\n", __ARM_ARCH);
+#elif defined(__x86_64__)
+    fprintf(f, "  \"target\": \"x86_64\",\n");
+#else
+    fprintf(f, "  \"target\": \"unknown\",\n");
+#endif
+    fprintf(f, "  \"iterations\": %lu,\n  \"unit\": \"ns/op\",\n  \"results\": {\n", n);
+    for(i = 0; i < bench_result_count; i++){
+        fprintf(f, "    \"%s\": %.2f%s\n", bench_results[i].name, bench_results[i].ns, i + 1 < bench_result_count ? "," : "");
+    }
+    fprintf(f, "  }\n}\n");
+}
+
+
+int main(int argc, char **argv){
+    unsigned long n = BENCH_DEFAULT_ITERATIONS;
+    const char *out = NULL;
+    double tick0, tick4;
+    int i;
+
+    for(i = 1; i < argc; i++){
+        if(!strcmp(argv[i], "-n") && i + 1 < argc){n = strtoul(argv[++i], NULL, 0);
+        }else if(!strcmp(argv[i], "-o") && i + 1 < argc){out = argv[++i];
+        }else{fprintf(stderr, "usage : %s [-n iterations] [-o results.json]\n", argv[0]); return 2;}
+    }
+    if(n == 0){n = 1;}
+
+    bench_init_samples();
+    bench_gpio_decode(n);
+    bench_buttons_decode(n, HOTKEY_MODE_NORMAL, "buttons_decode");
+    bench_buttons_decode(n, HOTKEY_MODE_TOGGLE, "buttons_decode_hotkey_toggle");
+    bench_analog_axis(n, NULL, "analog_axis");
+    { //calibration and an S curve from one table
+        static const uint16_t s_curve[MK_CURVE_POINTS] = {0, 16, 64, 144, 256, 400, 576, 784, 1024, 1264, 1472, 1648, 1792, 1904, 1984, 2032, 2048, 2064, 2112, 2192, 2304, 2448, 2624, 2832, 3072, 3312, 3520, 3696, 3840, 3952, 4032, 4080, 4096};
+        struct analog_abs_params_struct params = {374, 3418, 16, 384};
+        static int16_t table[MK_CURVE_SIZE];
+        mk_curve_build(s_curve, table, &params, 1);
+        bench_analog_axis(n, table, "analog_axis_curve");
+    }
+    bench_evdev_diff(n);
+    tick0 = bench_tick(n, 0, "tick_pad_digital");
+    tick4 = bench_tick(n, 4, "tick_pad_4_axes");
+    bench_results[bench_result_count++] = (struct bench_result){"tick_per_axis", (tick4 - tick0) / 4};
+    bench_axes_dispatch(n, false);
+    bench_axes_dispatch(n, true);
+
+    bench_write(stdout, n);
+    if(out){
+        FILE *f = fopen(out, "w");
+        if(!f){perror(out); return 1;}
+        bench_write(f, n);
+        fclose(f);
+    }
+    return 0;
+}
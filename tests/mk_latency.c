@@ -0,0 +1,277 @@
+/*
+ *  Arcade Joystick Driver for RaspberryPi, end-to-end input latency
+ *
+ *  Toggles a line of a gpio-sim chip at random intervals and waits for the
+ *  matching key event on the driver's evdev node. Latency is measured from
+ *  the pull change to the event timestamp (CLOCK_MONOTONIC), so it includes
+ *  the polling period, the driver tick and the input core. The driver must
+ *  be loaded with gpiobackend=1 and gpiochip=<sim chip label>, see latency.sh.
+ *
+ *  usage : mk_latency -p <sim_gpio pull attribute> [options]
+ *    -p path       /sys/devices/platform/gpio-sim.N/gpiochipM/sim_gpioL/pull
+ *    -d name       input device name, default "GPIO Controller 1"
+ *    -k code       key code expected, default 305 (BTN_B, line 24 with map=1)
+ *    -a            line is active high (pull-up presses)
+ *    -n count      presses, default 500
+ *    -i min,max    random hold and release time in msec, default 5,60
+ *    -t msec       timeout before an edge is counted as missed, default 250
+ *    -s cpus       background stressor: cpus spinning threads plus one fsync writer
+ *    -o file       write results as JSON
+ */
+
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+
+#define LAT_DEFAULT_DEVICE "GPIO Controller 1"
+#define LAT_DEFAULT_KEY BTN_B
+#define LAT_MAX_STRESS 16
+
+static const char *lat_pull_path;
+static const char *lat_device = LAT_DEFAULT_DEVICE;
+static int lat_key = LAT_DEFAULT_KEY;
+static int lat_active_high;
+static int lat_count = 500;
+static int lat_min_ms = 5, lat_max_ms = 60;
+static int lat_timeout_ms = 250;
+static int lat_stress;
+static const char *lat_out;
+
+static volatile int lat_stop; //stressor threads exit
+static int64_t *lat_samples; //usec, one per detected edge
+static int lat_sample_count;
+static int lat_missed, lat_late, lat_duplicates, lat_spurious;
+static int lat_pending = -1; //value of the last missed edge, -1 if none
+
+
+static int64_t lat_now_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static int lat_open_device(const char *name){ //find evdev node by device name
+    glob_t g;
+    size_t i;
+    int fd = -1;
+
+    if(glob("/dev/input/event*", 0, NULL, &g)){return -1;}
+    for(i = 0; i < g.gl_pathc && fd < 0; i++){
+        char devname[256] = "";
+        int f = open(g.gl_pathv[i], O_RDONLY | O_NONBLOCK);
+        if(f < 0){continue;}
+        if(ioctl(f, EVIOCGNAME(sizeof(devname)), devname) >= 0 && !strcmp(devname, name)){
+            int clk = CLOCK_MONOTONIC;
+            if(ioctl(f, EVIOCSCLOCKID, &clk)){perror("EVIOCSCLOCKID");}
+            fprintf(stderr, "using %s (%s)\n", g.gl_pathv[i], devname);
+            fd = f;
+        }else{close(f);}
+    }
+    globfree(&g);
+    return fd;
+}
+
+
+static int lat_set_line(int pressed){ //press is a pull toward the active level
+    const char *pull = (pressed ^ lat_active_high) ? "pull-down" : "pull-up";
+    int fd = open(lat_pull_path, O_WRONLY), ret = 0;
+
+    if(fd < 0){return -1;}
+    if(write(fd, pull, strlen(pull)) < 0){ret = -1;}
+    close(fd);
+    return ret;
+}
+
+
+static void lat_drain(int fd){ //drop anything queued, counting unexpected key events
+    struct input_event ev;
+    while(read(fd, &ev, sizeof(ev)) == sizeof(ev)){
+        if(ev.type == EV_KEY && ev.code == lat_key){lat_spurious++;}
+    }
+}
+
+
+static int lat_wait_edge(int fd, int value, int64_t t0){ //wait for key event with value, return latency in usec or -1
+    int64_t deadline = t0 + lat_timeout_ms * 1000, latency = -1;
+    struct input_event ev;
+    struct pollfd pfd = {fd, POLLIN, 0};
+
+    while(latency < 0){
+        int64_t left = deadline - lat_now_us();
+        if(left <= 0 || poll(&pfd, 1, (left + 999) / 1000) <= 0){return -1;}
+        while(read(fd, &ev, sizeof(ev)) == sizeof(ev)){
+            if(ev.type != EV_KEY || ev.code != lat_key){continue;}
+            if(ev.value == value && latency < 0){
+                latency = (int64_t)ev.input_event_sec * 1000000 + ev.input_event_usec - t0;
+            }else{lat_duplicates++;} //same edge reported twice or bounce
+        }
+    }
+    return latency;
+}
+
+
+static void lat_sleep_ms(int ms){
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    while(nanosleep(&ts, &ts) && errno == EINTR){}
+}
+
+
+static void lat_check_quiet(int fd){ //events while the line is stable are duplicates, unless a missed edge shows up late
+    struct input_event ev;
+    while(read(fd, &ev, sizeof(ev)) == sizeof(ev)){
+        if(ev.type != EV_KEY || ev.code != lat_key){continue;}
+        if(ev.value == lat_pending){lat_late++; lat_pending = -1;}else{lat_duplicates++;}
+    }
+}
+
+
+static void *lat_cpu_stress(void *arg){
+    volatile unsigned long x = 0;
+    while(!lat_stop){x++;}
+    return NULL;
+}
+
+
+static void *lat_io_stress(void *arg){
+    char buf[65536], path[] = "/tmp/mk_latency_XXXXXX";
+    int fd = mkstemp(path);
+
+    if(fd < 0){return NULL;}
+    unlink(path);
+    memset(buf, 0x5A, sizeof(buf));
+    while(!lat_stop){
+        if(write(fd, buf, sizeof(buf)) < 0 || fsync(fd)){break;}
+        if(lseek(fd, 0, SEEK_CUR) > (64 << 20)){if(ftruncate(fd, 0) || lseek(fd, 0, SEEK_SET)){break;}}
+    }
+    close(fd);
+    return NULL;
+}
+
+
+static int lat_cmp(const void *a, const void *b){
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int64_t lat_percentile(double p){
+    int idx;
+    if(!lat_sample_count){return 0;}
+    idx = (int)ceil(p / 100.0 * lat_sample_count) - 1;
+    if(idx < 0){idx = 0;}
+    return lat_samples[idx];
+}
+
+
+static void lat_report(FILE *f){
+    double mean = 0, var = 0, jitter = 0;
+    int i;
+
+    for(i = 0; i < lat_sample_count; i++){mean += lat_samples[i];}
+    if(lat_sample_count){mean /= lat_sample_count;}
+    for(i = 0; i < lat_sample_count; i++){var += (lat_samples[i] - mean) * (lat_samples[i] - mean);}
+    if(lat_sample_count > 1){var /= lat_sample_count - 1;}
+    qsort(lat_samples, lat_sample_count, sizeof(lat_samples[0]), lat_cmp);
+    jitter = lat_percentile(99) - lat_percentile(1); //spread of the bulk of the distribution
+
+    fprintf(f, "{\n  \"edges\": %d,\n  \"detected\": %d,\n  \"missed\": %d,\n  \"late\": %d,\n  \"duplicates\": %d,\n  \"spurious\": %d,\n", lat_count * 2, lat_sample_count, lat_missed, lat_late, lat_duplicates, lat_spurious);
+    fprintf(f, "  \"stress_cpus\": %d,\n  \"unit\": \"usec\",\n", lat_stress);
+    fprintf(f, "  \"min\": %lld,\n  \"p50\": %lld,\n  \"p90\": %lld,\n  \"p99\": %lld,\n  \"p99_9\": %lld,\n  \"max\": %lld,\n",
+        (long long)lat_percentile(0), (long long)lat_percentile(50), (long long)lat_percentile(90), (long long)lat_percentile(99), (long long)lat_percentile(99.9),
+        (long long)(lat_sample_count ? lat_samples[lat_sample_count - 1] : 0));
+    fprintf(f, "  \"mean\": %.1f,\n  \"stddev\": %.1f,\n  \"jitter_p1_p99\": %.1f\n}\n", mean, sqrt(var), jitter);
+}
+
+
+static void lat_usage(const char *name){
+    fprintf(stderr, "usage : %s -p <sim_gpio pull attribute> [-d name] [-k code] [-a] [-n count] [-i min,max] [-t msec] [-s cpus] [-o file]\n", name);
+}
+
+
+int main(int argc, char **argv){
+    pthread_t stress[LAT_MAX_STRESS + 1];
+    int opt, fd, i, threads = 0;
+
+    while((opt = getopt(argc, argv, "p:d:k:an:i:t:s:o:")) != -1){
+        switch(opt){
+            case 'p': lat_pull_path = optarg; break;
+            case 'd': lat_device = optarg; break;
+            case 'k': lat_key = atoi(optarg); break;
+            case 'a': lat_active_high = 1; break;
+            case 'n': lat_count = atoi(optarg); break;
+            case 'i': if(sscanf(optarg, "%d,%d", &lat_min_ms, &lat_max_ms) != 2){lat_usage(argv[0]); return 2;} break;
+            case 't': lat_timeout_ms = atoi(optarg); break;
+            case 's': lat_stress = atoi(optarg); break;
+            case 'o': lat_out = optarg; break;
+            default: lat_usage(argv[0]); return 2;
+        }
+    }
+    if(!lat_pull_path || lat_count <= 0 || lat_min_ms < 0 || lat_max_ms < lat_min_ms){lat_usage(argv[0]); return 2;}
+    if(lat_stress > LAT_MAX_STRESS){lat_stress = LAT_MAX_STRESS;}
+
+    fd = lat_open_device(lat_device);
+    if(fd < 0){fprintf(stderr, "input device \"%s\" not found\n", lat_device); return 1;}
+    lat_samples = calloc(lat_count * 2, sizeof(lat_samples[0]));
+    if(!lat_samples){return 1;}
+
+    if(lat_set_line(0)){perror(lat_pull_path); return 1;}
+    lat_sleep_ms(lat_timeout_ms);
+    lat_drain(fd);
+    lat_spurious = 0;
+
+    if(lat_stress > 0){
+        for(i = 0; i < lat_stress; i++){if(!pthread_create(&stress[threads], NULL, lat_cpu_stress, NULL)){threads++;}}
+        if(!pthread_create(&stress[threads], NULL, lat_io_stress, NULL)){threads++;}
+    }
+
+    srand(time(NULL));
+    for(i = 0; i < lat_count * 2; i++){
+        int value = !(i & 1); //press then release
+        int64_t t0, latency;
+
+        lat_check_quiet(fd);
+        t0 = lat_now_us();
+        if(lat_set_line(value)){perror(lat_pull_path); break;}
+        latency = lat_wait_edge(fd, value, t0);
+        if(latency >= 0){lat_samples[lat_sample_count++] = latency; lat_pending = -1;}else{lat_missed++; lat_pending = value;}
+        lat_sleep_ms(lat_min_ms + rand() % (lat_max_ms - lat_min_ms + 1));
+    }
+
+    lat_stop = 1;
+    for(i = 0; i < threads; i++){pthread_join(stress[i], NULL);}
+    lat_set_line(0);
+    close(fd);
+
+    lat_report(stdout);
+    if(lat_out){
+        FILE *f = fopen(lat_out, "w");
+        if(!f){perror(lat_out); return 1;}
+        lat_report(f);
+        fclose(f);
+    }
+    return 0;
+}
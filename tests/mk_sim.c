@@ -0,0 +1,362 @@
+/*
+ *  Arcade Joystick Driver for RaspberryPi, userspace simulation harness
+ *
+ *  Runs the driver core logic (mk_arcade_joystick_rpi_core.h) against a fake
+ *  GPLEV register pair and fake MCP3021/ADS1x15/ADS7830/MCP3x08 chips, replays a scripted
+ *  trace and checks the input events the driver would emit.
+ *
+ *  usage : mk_sim trace.txt [trace.txt ...]
+ *
+ *  Trace commands, one per line, '#' starts a comment :
+ *    requires <CONFIG_MK_*>[|<CONFIG_MK_*>] ...   skip the trace unless these build options
+ *                                   are in, '|' for either one
+ *    map <pin> ...                  gpio map, up to 21 pins (-1 unused, negative pin inverts)
+ *    hkmode <mode>                  hotkey mode, 1=NORMAL, 2=TOGGLE
+ *    turbo <BTN_*>                  button has a turbo rate, its hotkey combo toggles turbo
+ *    combo <BTN_*|UP..RIGHT> <code> <hold_ms>   action key, hotkey combo if hold_ms is 0, else long press
+ *    adc <chip>                     analog chip type: mcp3021 ads1015 ads1115 ads7830 mcp3008 mcp3208
+ *    axis <x1|y1|x2|y2> <min> <max> <fuzz> <flat> <offset> <reverse>
+ *    gpio <pin> <level>             set pin level, 0 is pressed with pull-up
+ *    ain <axis> <value> [<value>...]   set raw chip code, negative value is an i2c error,
+ *                                   several values are returned by successive conversions
+ *    adscfg <axis> <fsr_mv> <sps> <supply_mv>   ADS1x15 full scale and rate of the axis channel, after adc
+ *    adsrest <window> <axis> ...    ADS1x15 comparator rest on the axes channels, after a tick
+ *    adsnext                        ADS1x15 comparator watches the next channel
+ *    adswake                        ADS1x15 leaves comparator rest
+ *    filter <axis> <median> <oversample>   median window and conversions averaged per poll
+ *    smooth <axis> <mincutoff> <beta> <dcutoff>   1 euro filter, centiHz, polled every 10ms
+ *    curve <axis> <p0> ... <p32>    response curve control points, after axis
+ *    tick                           one poll, pending events are replaced
+ *    expect key <BTN_*> <value>     pop a key event
+ *    expect abs <ABS_*> <value>     pop an abs event
+ *    expect none                    no event left from last tick
+ *    expect minmax <axis> <min> <max>
+ *    expect turbo <BTN_*> <0|1>     turbo of the button enabled
+ *    expect action <code> <value>   pop a key event of the hotkeys device
+ *    expect udelay <usec>           time waited for conversions during last tick
+ *    expect adsconfig <hex>         last ADS1x15 config register write
+ *    expect adsthresh <lo> <hi>     ADS1x15 threshold registers, hex
+ *    expect rejected <axis> <count> outliers replaced by the median filter
+ *    ffopt <weak> <strong_reverse> <weak_reverse>
+ *    rumble <strong> <weak> <direction>
+ *    expect ff <strong> <weak> <strong_pwm> <weak_pwm> <dir>
+ */
+
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mk_sim.h"
+
+static const char *sim_btn_names[] = {"BTN_START", "BTN_SELECT", "BTN_A", "BTN_B", "BTN_TR", "BTN_Y", "BTN_X", "BTN_TL", "BTN_MODE", "BTN_TL2", "BTN_TR2", "BTN_C", "BTN_Z", "BTN_TOP", "BTN_TOP2", "BTN_BASE", "BTN_BASE2"};
+static const char *sim_data_names[] = {"UP", "DOWN", "LEFT", "RIGHT", "BTN_START", "BTN_SELECT", "BTN_A", "BTN_B", "BTN_TR", "BTN_Y", "BTN_X", "BTN_TL", "BTN_MODE", "BTN_TL2", "BTN_TR2", "BTN_C", "BTN_Z", "BTN_TOP", "BTN_TOP2", "BTN_BASE", "BTN_BASE2"}; //data[] order
+static const char *sim_abs_names[] = {"ABS_X", "ABS_Y", "ABS_RX", "ABS_RY", "ABS_HAT0X", "ABS_HAT0Y"};
+static const char *sim_axis_names[] = {"x1", "y1", "x2", "y2"};
+
+static const char *sim_options[] = { //build options of the core, CONFIG_MK_OPTIONS and -D flags from the Makefile
+#ifdef CONFIG_MK_ADC_MCP3021
+    "CONFIG_MK_ADC_MCP3021",
+#endif
+#ifdef CONFIG_MK_ADC_ADS1X15
+    "CONFIG_MK_ADC_ADS1X15",
+#endif
+#ifdef CONFIG_MK_ADC_ADS7830
+    "CONFIG_MK_ADC_ADS7830",
+#endif
+#ifdef CONFIG_MK_ADC_SPI
+    "CONFIG_MK_ADC_SPI",
+#endif
+#ifdef CONFIG_MK_ADC_IIO
+    "CONFIG_MK_ADC_IIO",
+#endif
+#ifdef CONFIG_MK_FF_GPIO
+    "CONFIG_MK_FF_GPIO",
+#endif
+#ifdef CONFIG_MK_FF_PWM
+    "CONFIG_MK_FF_PWM",
+#endif
+#ifdef CONFIG_MK_DEBUG
+    "CONFIG_MK_DEBUG",
+#endif
+    NULL};
+
+#if defined(CONFIG_MK_FF_GPIO) || defined(CONFIG_MK_FF_PWM)
+static struct mk_ff_state sim_ff;
+static bool sim_ff_weak = true, sim_ff_strong_reverse, sim_ff_weak_reverse;
+static struct mk_ff_cmd sim_ff_cmd;
+#endif
+
+
+static int sim_lookup(const char *name, const char **names, int count){
+    int i;
+    for(i = 0; i < count; i++){if(!strcmp(name, names[i])){return i;}}
+    return -1;
+}
+
+static int sim_pop(int type, int code, int value, char *err, size_t errlen){ //remove a matching event, events of a tick may come in any order
+    int i;
+    for(i = 0; i < sim_event_count; i++){
+        if(sim_events[i].type == type && sim_events[i].code == code){
+            if(sim_events[i].value != value){
+                snprintf(err, errlen, "got value %d, expected %d", sim_events[i].value, value);
+                return -1;
+            }
+            memmove(&sim_events[i], &sim_events[i + 1], (sim_event_count - i - 1) * sizeof(sim_events[0]));
+            sim_event_count--;
+            return 0;
+        }
+    }
+    snprintf(err, errlen, "no such event");
+    return -1;
+}
+
+
+static bool sim_option_built(char *names){ //one of the '|' separated options is built
+    char *name;
+    int i;
+    for(name = strtok(names, "|"); name; name = strtok(NULL, "|")){
+        for(i = 0; sim_options[i]; i++){if(!strcmp(name, sim_options[i])){return true;}}
+    }
+    return false;
+}
+
+
+static void sim_reset_all(void){
+    sim_reset();
+#if defined(CONFIG_MK_FF_GPIO) || defined(CONFIG_MK_FF_PWM)
+    sim_ff = (struct mk_ff_state){false, false};
+    sim_ff_weak = true; sim_ff_strong_reverse = false; sim_ff_weak_reverse = false;
+#endif
+}
+
+
+#define SIM_SKIP 2 //sim_run_line: build option missing, rest of the trace skipped, apart from a failed file
+
+
+static int sim_run_line(char *line, char *err, size_t errlen){
+    char cmd[16], arg[16];
+    int v[8], n, i;
+
+    if(sscanf(line, "%15s", cmd) != 1 || cmd[0] == '#'){return 0;} //empty or comment
+
+    if(!strcmp(cmd, "requires")){
+        char *p = line + strlen("requires"), option[64];
+        for(i = 0; sscanf(p, "%63s%n", option, &n) == 1; i++, p += n){
+            if(!sim_option_built(option)){
+                snprintf(err, errlen, "%s not built", option);
+                return SIM_SKIP;
+            }
+        }
+        if(!i){goto syntax;}
+    }else if(!strcmp(cmd, "map")){
+        char *p = line + strlen("map");
+        for(i = 0; i < MK_MAX_BUTTONS && sscanf(p, "%d%n", &v[0], &n) == 1; i++, p += n){sim_gpio_maps[i] = v[0];}
+    }else if(!strcmp(cmd, "hkmode")){
+        if(sscanf(line, "%*s %d", &sim_hotkey_mode) != 1){goto syntax;}
+    }else if(!strcmp(cmd, "turbo")){
+        if(sscanf(line, "%*s %15s", arg) != 1 || (i = sim_lookup(arg, sim_btn_names, MK_MAX_BUTTONS - 4)) < 0){goto syntax;}
+        sim_hk.turbo_armed |= 1UL << (i + 4);
+    }else if(!strcmp(cmd, "combo")){
+        if(sscanf(line, "%*s %15s %d %d", arg, &v[0], &v[1]) != 3 || (i = sim_lookup(arg, sim_data_names, MK_MAX_BUTTONS)) < 0){goto syntax;}
+        if(sim_combo_count == MK_MAX_COMBOS || v[0] <= 0 || v[1] < 0){goto syntax;}
+        sim_combos[sim_combo_count++] = (struct mk_combo){i, v[1], v[0]};
+        sim_hk.action_armed = mk_combo_armed(sim_combos, sim_combo_count);
+    }else if(!strcmp(cmd, "adc")){
+        if(sscanf(line, "%*s %15s", arg) != 1){goto syntax;}
+        if(!strcmp(arg, "ads1015")){sim_adc_type = SIM_ADC_ADS1015;}else if(!strcmp(arg, "mcp3021")){sim_adc_type = SIM_ADC_MCP3021;
+        }else if(!strcmp(arg, "mcp3008")){sim_adc_type = SIM_ADC_MCP3008;}else if(!strcmp(arg, "mcp3208")){sim_adc_type = SIM_ADC_MCP3208;
+        }else if(!strcmp(arg, "ads1115")){sim_adc_type = SIM_ADC_ADS1115;}else if(!strcmp(arg, "ads7830")){sim_adc_type = SIM_ADC_ADS7830;}else{goto syntax;}
+    }else if(!strcmp(cmd, "axis")){
+        if(sscanf(line, "%*s %15s %d %d %d %d %d %d", arg, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) != 7){goto syntax;}
+        if((i = sim_lookup(arg, sim_axis_names, 4)) < 0){goto syntax;}
+        sim_axis_enable[i] = true;
+        sim_axis_params[i] = (struct analog_abs_params_struct){v[0], v[1], v[2], v[3]};
+        sim_axis_offset[i] = v[4]; sim_axis_reverse[i] = v[5];
+    }else if(!strcmp(cmd, "gpio")){
+        if(sscanf(line, "%*s %d %d", &v[0], &v[1]) != 2 || v[0] < 0 || v[0] > 63){goto syntax;}
+        if(v[1]){sim_gplev[v[0] / 32] |= 1U << (v[0] % 32);}else{sim_gplev[v[0] / 32] &= ~(1U << (v[0] % 32));}
+    }else if(!strcmp(cmd, "ain")){
+        char *p = line + strlen("ain");
+        if(sscanf(p, "%15s%n", arg, &n) != 1){goto syntax;}
+        if((i = sim_lookup(arg, sim_axis_names, 4)) < 0){goto syntax;}
+        sim_ain_seq_len[i] = sim_ain_seq_pos[i] = 0;
+        for(p += n; sim_ain_seq_len[i] < 16 && sscanf(p, "%d%n", &v[0], &n) == 1; p += n){sim_ain_seq[i][sim_ain_seq_len[i]++] = v[0];}
+        if(!sim_ain_seq_len[i]){goto syntax;}
+        sim_ain[i] = sim_ain_seq[i][0];
+        if(sim_ain_seq_len[i] == 1){sim_ain_seq_len[i] = 0;} //constant
+#ifdef CONFIG_MK_ADC_ADS1X15
+    }else if(!strcmp(cmd, "adscfg")){
+        if(sscanf(line, "%*s %15s %d %d %d", arg, &v[0], &v[1], &v[2]) != 4){goto syntax;}
+        if((i = sim_lookup(arg, sim_axis_names, 4)) < 0){goto syntax;}
+        if(mk_ads1x15_setup(&sim_ads_priv, i, sim_adc_type == SIM_ADC_ADS1115, v[0], v[1], v[2]) < 0){goto syntax;}
+    }else if(!strcmp(cmd, "adsrest")){
+        char *p = line + strlen("adsrest");
+        unsigned int mask = 0;
+        if(sscanf(p, "%d%n", &v[0], &n) != 1){goto syntax;}
+        for(p += n; sscanf(p, "%15s%n", arg, &n) == 1; p += n){
+            if((i = sim_lookup(arg, sim_axis_names, 4)) < 0){goto syntax;}
+            mask |= 1U << i; //channel n for axis n
+        }
+        sim_adc_setup();
+        if(mk_ads1x15_rest(&sim_adcs[0], mask, v[0]) < 0){goto syntax;}
+    }else if(!strcmp(cmd, "adsnext")){
+        mk_ads1x15_rest_next(&sim_adcs[0]);
+    }else if(!strcmp(cmd, "adswake")){
+        mk_ads1x15_wake(&sim_adcs[0]);
+#endif
+    }else if(!strcmp(cmd, "filter")){
+        if(sscanf(line, "%*s %15s %d %d", arg, &v[0], &v[1]) != 3){goto syntax;}
+        if((i = sim_lookup(arg, sim_axis_names, 4)) < 0 || v[0] > MK_FILTER_MEDIAN_MAX || v[1] > MK_FILTER_OVERSAMPLE_MAX){goto syntax;}
+        memset(&sim_axis_filter[i], 0, sizeof(sim_axis_filter[i]));
+        sim_axis_filter[i].median = v[0];
+        sim_axis_oversample[i] = v[1];
+    }else if(!strcmp(cmd, "smooth")){
+        if(sscanf(line, "%*s %15s %d %d %d", arg, &v[0], &v[1], &v[2]) != 4){goto syntax;}
+        if((i = sim_lookup(arg, sim_axis_names, 4)) < 0){goto syntax;}
+        memset(&sim_axis_smooth[i], 0, sizeof(sim_axis_smooth[i]));
+        sim_axis_smooth[i].mincutoff = v[0]; sim_axis_smooth[i].beta = v[1]; sim_axis_smooth[i].dcutoff = v[2];
+    }else if(!strcmp(cmd, "curve")){
+        char *p = line + strlen("curve");
+        uint16_t points[MK_CURVE_POINTS];
+        if(sscanf(p, "%15s%n", arg, &n) != 1 || (i = sim_lookup(arg, sim_axis_names, 4)) < 0){goto syntax;}
+        for(p += n, v[1] = 0; v[1] < MK_CURVE_POINTS && sscanf(p, "%d%n", &v[0], &n) == 1; p += n){points[v[1]++] = v[0];}
+        if(v[1] != MK_CURVE_POINTS || mk_curve_check(points)){goto syntax;}
+        mk_curve_build(points, sim_curve_table[i], &sim_axis_params[i], sim_axis_offset[i]);
+        sim_curve_set[i] = true;
+    }else if(!strcmp(cmd, "tick")){
+        sim_tick();
+#if defined(CONFIG_MK_FF_GPIO) || defined(CONFIG_MK_FF_PWM)
+    }else if(!strcmp(cmd, "ffopt")){
+        if(sscanf(line, "%*s %d %d %d", &v[0], &v[1], &v[2]) != 3){goto syntax;}
+        sim_ff_weak = v[0]; sim_ff_strong_reverse = v[1]; sim_ff_weak_reverse = v[2];
+    }else if(!strcmp(cmd, "rumble")){
+        if(sscanf(line, "%*s %d %d %d", &v[0], &v[1], &v[2]) != 3){goto syntax;}
+        mk_ff_rumble(&sim_ff, v[0], v[1], v[2], sim_ff_weak, sim_ff_strong_reverse, sim_ff_weak_reverse, &sim_ff_cmd);
+#endif
+    }else if(!strcmp(cmd, "expect")){
+        if(sscanf(line, "%*s %15s", cmd) != 1){goto syntax;}
+        if(!strcmp(cmd, "none")){
+            if(sim_event_count){
+                snprintf(err, errlen, "unexpected event type %d code %d value %d", sim_events[0].type, sim_events[0].code, sim_events[0].value);
+                return -1;
+            }
+        }else if(!strcmp(cmd, "key")){
+            if(sscanf(line, "%*s %*s %15s %d", arg, &v[0]) != 2){goto syntax;}
+            if((i = sim_lookup(arg, sim_btn_names, MK_MAX_BUTTONS - 4)) < 0){goto syntax;}
+            return sim_pop(SIM_EV_KEY, i, v[0], err, errlen);
+        }else if(!strcmp(cmd, "abs")){
+            if(sscanf(line, "%*s %*s %15s %d", arg, &v[0]) != 2){goto syntax;}
+            if((i = sim_lookup(arg, sim_abs_names, SIM_ABS_MAX)) < 0){goto syntax;}
+            return sim_pop(SIM_EV_ABS, i, v[0], err, errlen);
+        }else if(!strcmp(cmd, "turbo")){
+            if(sscanf(line, "%*s %*s %15s %d", arg, &v[0]) != 2){goto syntax;}
+            if((i = sim_lookup(arg, sim_btn_names, MK_MAX_BUTTONS - 4)) < 0){goto syntax;}
+            if((int)((sim_hk.turbo_armed & ~sim_hk.turbo_off) >> (i + 4) & 1) != v[0]){
+                snprintf(err, errlen, "got turbo %d", !v[0]);
+                return -1;
+            }
+        }else if(!strcmp(cmd, "action")){
+            if(sscanf(line, "%*s %*s %d %d", &v[0], &v[1]) != 2){goto syntax;}
+            return sim_pop(SIM_EV_ACTION, v[0], v[1], err, errlen);
+        }else if(!strcmp(cmd, "minmax")){
+            if(sscanf(line, "%*s %*s %15s %d %d", arg, &v[0], &v[1]) != 3){goto syntax;}
+            if((i = sim_lookup(arg, sim_axis_names, 4)) < 0){goto syntax;}
+            if(sim_axis_min[i] != v[0] || sim_axis_max[i] != v[1]){
+                snprintf(err, errlen, "got min %d max %d", sim_axis_min[i], sim_axis_max[i]);
+                return -1;
+            }
+        }else if(!strcmp(cmd, "udelay")){
+            if(sscanf(line, "%*s %*s %d", &v[0]) != 1){goto syntax;}
+            if(sim_udelay_total != (unsigned long)v[0]){
+                snprintf(err, errlen, "got %lu usec", sim_udelay_total);
+                return -1;
+            }
+        }else if(!strcmp(cmd, "adsconfig")){
+            if(sscanf(line, "%*s %*s %x", &v[0]) != 1){goto syntax;}
+            if(sim_ads1015_config != v[0]){
+                snprintf(err, errlen, "got 0x%04X", sim_ads1015_config);
+                return -1;
+            }
+        }else if(!strcmp(cmd, "adsthresh")){
+            if(sscanf(line, "%*s %*s %x %x", &v[0], &v[1]) != 2){goto syntax;}
+            if(sim_ads1015_thresh[0] != v[0] || sim_ads1015_thresh[1] != v[1]){
+                snprintf(err, errlen, "got %04X %04X", sim_ads1015_thresh[0], sim_ads1015_thresh[1]);
+                return -1;
+            }
+        }else if(!strcmp(cmd, "rejected")){
+            if(sscanf(line, "%*s %*s %15s %d", arg, &v[0]) != 2){goto syntax;}
+            if((i = sim_lookup(arg, sim_axis_names, 4)) < 0){goto syntax;}
+            if(sim_axis_filter[i].rejected != (unsigned int)v[0]){
+                snprintf(err, errlen, "got %u", sim_axis_filter[i].rejected);
+                return -1;
+            }
+#if defined(CONFIG_MK_FF_GPIO) || defined(CONFIG_MK_FF_PWM)
+        }else if(!strcmp(cmd, "ff")){
+            if(sscanf(line, "%*s %*s %d %d %d %d %d", &v[0], &v[1], &v[2], &v[3], &v[4]) != 5){goto syntax;}
+            if(sim_ff_cmd.strong != v[0] || sim_ff_cmd.weak != v[1] || sim_ff_cmd.strong_pwm != v[2] || sim_ff_cmd.weak_pwm != v[3] || sim_ff_cmd.dir != v[4]){
+                snprintf(err, errlen, "got ff %d %d %d %d %d", sim_ff_cmd.strong, sim_ff_cmd.weak, sim_ff_cmd.strong_pwm, sim_ff_cmd.weak_pwm, sim_ff_cmd.dir);
+                return -1;
+            }
+#endif
+        }else{goto syntax;}
+    }else{goto syntax;}
+    return 0;
+
+syntax:
+    snprintf(err, errlen, "syntax error");
+    return -1;
+}
+
+
+static int sim_run_file(const char *path){ //0 passed, 1 failed, SIM_SKIP skipped
+    char line[256], err[128];
+    int lineno = 0, failures = 0, ret;
+    FILE *f = fopen(path, "r");
+
+    if(!f){perror(path); return 1;}
+    sim_reset_all();
+    while(fgets(line, sizeof(line), f)){
+        lineno++;
+        ret = sim_run_line(line, err, sizeof(err));
+        if(ret == SIM_SKIP){
+            fclose(f);
+            printf("SKIP %s (%s)\n", path, err);
+            return SIM_SKIP;
+        }
+        if(ret){
+            line[strcspn(line, "\n")] = 0;
+            fprintf(stderr, "%s:%d: %s: %s\n", path, lineno, line, err);
+            failures++;
+        }
+    }
+    fclose(f);
+    printf("%s %s\n", failures ? "FAIL" : "PASS", path);
+    return failures != 0;
+}
+
+
+int main(int argc, char **argv){
+    int i, ret, failed = 0, skipped = 0;
+
+    if(argc < 2){fprintf(stderr, "usage : %s trace.txt [trace.txt ...]\n", argv[0]); return 2;}
+    for(i = 1; i < argc; i++){
+        ret = sim_run_file(argv[i]);
+        if(ret == SIM_SKIP){skipped++;}else{failed += ret;}
+    }
+    if(skipped){printf("%d/%d traces passed, %d skipped\n", argc - 1 - failed - skipped, argc - 1 - skipped, skipped);
+    }else{printf("%d/%d traces passed\n", argc - 1 - failed, argc - 1);}
+    return failed != 0;
+}
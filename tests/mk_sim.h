@@ -0,0 +1,286 @@
+/*
+ *  Arcade Joystick Driver for RaspberryPi, simulated pad
+ *
+ *  Fake GPLEV registers, fake MCP3021/ADS1x15/ADS7830/MCP3x08 chips and evdev emulation
+ *  around the driver core logic, shared by mk_sim and mk_bench.
+ */
+
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef MK_SIM_H
+#define MK_SIM_H
+
+#include <string.h>
+#include <stdint.h>
+
+// Fake I2C
+struct i2c_client {
+    int addr; //0x48..0x4B for MCP3021, 0x48 for ADS1015
+};
+
+#define SIM_ADC_MCP3021 0
+#define SIM_ADC_ADS1015 1
+#define SIM_ADC_MCP3008 2
+#define SIM_ADC_MCP3208 3
+#define SIM_ADC_ADS1115 4
+#define SIM_ADC_ADS7830 5
+static int sim_adc_type = SIM_ADC_MCP3021;
+static int sim_ain[4]; //raw chip code per axis (10bits MCP3008, 16bits ADS1115, 8bits ADS7830)
+static int sim_ain_seq[4][16]; //codes returned by successive conversions, repeated, noise and spikes
+static int sim_ain_seq_len[4], sim_ain_seq_pos[4];
+static int sim_ads1015_mux = -1; //last ain selected by a config write
+static uint16_t sim_ads1015_config; //last config write, mux included
+static int sim_ads1015_thresh[2]; //lo and hi threshold registers
+static unsigned long sim_udelay_total; //usec spent waiting for conversions during the last tick
+
+static int sim_ain_next(int channel){ //one conversion of channel
+    if(channel > 3){return 0;}
+    if(!sim_ain_seq_len[channel]){return sim_ain[channel];}
+    sim_ain_seq_pos[channel] %= sim_ain_seq_len[channel];
+    return sim_ain_seq[channel][sim_ain_seq_pos[channel]++];
+}
+
+static inline int mk_i2c_read_word(const struct i2c_client *client, int reg){
+    int value;
+    if(sim_adc_type == SIM_ADC_ADS1015 || sim_adc_type == SIM_ADC_ADS1115){ //conversion register, ADS1015 12bits left aligned
+        if(reg != 0 || sim_ads1015_mux < 0){return -5;}
+        value = sim_ain_next(sim_ads1015_mux);
+        if(value < 0){return value;}
+        return sim_adc_type == SIM_ADC_ADS1015 ? (value << 4) & 0xFFFF : value & 0xFFFF;
+    }
+    return sim_ain_next(client->addr - 0x48); //mcp3021 returns a single conversion
+}
+
+static inline int mk_i2c_write_word(const struct i2c_client *client, int reg, uint16_t value){
+    (void)client;
+    if((sim_adc_type == SIM_ADC_ADS1015 || sim_adc_type == SIM_ADC_ADS1115) && reg == 0x01){sim_ads1015_mux = ((value >> 12) & 0x7) - 4; sim_ads1015_config = value;} //single-ended AINx mux
+    if((sim_adc_type == SIM_ADC_ADS1015 || sim_adc_type == SIM_ADC_ADS1115) && (reg == 0x02 || reg == 0x03)){sim_ads1015_thresh[reg - 2] = value;}
+    return 0;
+}
+
+static inline int mk_i2c_read_byte(const struct i2c_client *client, int command){ //ADS7830, command byte then conversion
+    int channel;
+    if(sim_adc_type != SIM_ADC_ADS7830 || !(command & 0x80)){return -5;} //differential not simulated
+    channel = ((command >> 6) & 1) | (((command >> 4) & 3) << 1);
+    return sim_ain_next(channel);
+}
+
+static void mk_udelay(unsigned long usec){sim_udelay_total += usec;}
+
+#include "../mk_arcade_joystick_rpi_core.h"
+
+
+#ifdef CONFIG_MK_ADC_SPI
+// Fake SPI ADC, answers one MCP3008/MCP3208 conversion frame, channel n is sim_ain[n]
+static int sim_spi_type;
+static void sim_spi_frame(const uint8_t *tx, uint8_t *rx){
+    int channel = -1, value;
+
+    rx[0] = 0xFF; //output high impedance until the null bit, read as ones
+    if(sim_adc_type == SIM_ADC_MCP3208 && (tx[0] & 0x06) == 0x06){channel = ((tx[0] & 1) << 2) | (tx[1] >> 6);}
+    if(sim_adc_type == SIM_ADC_MCP3008 && (tx[0] & 0x01) && (tx[1] & 0x80)){channel = (tx[1] >> 4) & 7;}
+    if(channel < 0){rx[1] = rx[2] = 0xFF; return;} //no start bit or differential mode
+    value = sim_ain_next(channel);
+    if(sim_adc_type == SIM_ADC_MCP3208){rx[1] = 0xE0 | ((value >> 8) & 0x0F); //null bit, B11..B8
+    }else{rx[1] = 0xF8 | ((value >> 8) & 0x03);} //null bit, B9..B8
+    rx[2] = value & 0xFF;
+}
+
+static int sim_spi_read_all(struct mk_adc *adc, const int *channels, int16_t *values, int count){ //mk_spiadc_read_all, one frame per channel
+    int i;
+    for(i = 0; i < count; i++){
+        uint8_t tx[MK_SPIADC_FRAME], rx[MK_SPIADC_FRAME];
+        mk_mcp3x08_frame(sim_spi_type, channels[i], tx);
+        sim_spi_frame(tx, rx);
+        values[i] = mk_mcp3x08_value(sim_spi_type, rx);
+    }
+    return 0;
+}
+
+static const struct mk_adc_ops sim_adc_mcp3x08_ops = {"MCP3x08", 8, 12, 0, NULL, NULL, sim_spi_read_all};
+#endif
+
+
+// Fake GPIO registers
+static uint32_t sim_gplev[2] = {0xFFFFFFFF, 0xFFFFFFFF}; //GPLEV0 and GPLEV1, pulled up
+
+
+// Emulated evdev
+#define SIM_EV_KEY 1
+#define SIM_EV_ABS 3
+#define SIM_EV_ACTION 4 //key of the hotkeys input device
+#define SIM_MAX_EVENTS 64
+
+struct sim_event {int type; int code; int value;};
+
+enum {SIM_ABS_X, SIM_ABS_Y, SIM_ABS_RX, SIM_ABS_RY, SIM_ABS_HAT0X, SIM_ABS_HAT0Y, SIM_ABS_MAX};
+
+static int sim_key_state[MK_MAX_BUTTONS];
+static int sim_abs_state[SIM_ABS_MAX];
+static int sim_abs_fuzz[SIM_ABS_MAX];
+static struct sim_event sim_events[SIM_MAX_EVENTS];
+static int sim_event_count;
+
+static void sim_emit(int type, int code, int value){
+    if(sim_event_count < SIM_MAX_EVENTS){sim_events[sim_event_count++] = (struct sim_event){type, code, value};}
+}
+
+static void sim_report_key(int code, int value){ //input_report_key: only changes reach userspace
+    value = !!value;
+    if(sim_key_state[code] == value){return;}
+    sim_key_state[code] = value;
+    sim_emit(SIM_EV_KEY, code, value);
+}
+
+static void sim_report_abs(int code, int value){ //input_report_abs: same fuzz filter as input_defuzz_abs_event()
+    int old = sim_abs_state[code], fuzz = sim_abs_fuzz[code];
+    if(fuzz){
+        if(value > old - fuzz / 2 && value < old + fuzz / 2){return;}
+        if(value > old - fuzz && value < old + fuzz){value = (old * 3 + value) / 4;}
+        else if(value > old - fuzz * 2 && value < old + fuzz * 2){value = (old + value) / 2;}
+    }
+    if(value == old){return;}
+    sim_abs_state[code] = value;
+    sim_emit(SIM_EV_ABS, code, value);
+}
+
+
+// Simulated pad, mirrors mk_pad and the analog globals of the driver
+static const int sim_axis_abs[] = {SIM_ABS_X, SIM_ABS_Y, SIM_ABS_RX, SIM_ABS_RY};
+
+static int sim_gpio_maps[MK_MAX_BUTTONS];
+static int sim_hotkey_mode = HOTKEY_MODE_UNDEFINED;
+static struct mk_hotkey sim_hk = {0xFF, 0, -1, 0, 0, -1, 0, -1};
+static unsigned char sim_data[MK_MAX_BUTTONS];
+static struct mk_combo sim_combos[MK_MAX_COMBOS]; //hotkey actions
+static int sim_combo_count;
+static struct mk_combo_state sim_combo_st = {0, -1, 0, -1};
+static int sim_combo_key = -1; //combo whose key was reported down
+static bool sim_axis_enable[4];
+static bool sim_axis_reverse[4];
+static int16_t sim_axis_offset[4];
+static uint16_t sim_axis_min[4], sim_axis_max[4];
+static struct analog_abs_params_struct sim_axis_params[4];
+#if defined(CONFIG_MK_ADC_MCP3021) || defined(CONFIG_MK_ADC_ADS1X15) || defined(CONFIG_MK_ADC_ADS7830)
+static struct i2c_client sim_clients[4] = {{0x48}, {0x49}, {0x4A}, {0x4B}};
+#endif
+static struct mk_adc sim_adcs[4];
+static struct mk_adc_axis sim_adc_axes[4];
+#ifdef CONFIG_MK_ADC_ADS1X15
+static struct mk_ads1x15_priv sim_ads_priv; //per channel full scale and rate
+#endif
+static struct mk_adc_filter sim_axis_filter[4]; //median pre-filter
+static int sim_axis_oversample[4];
+static struct mk_smooth sim_axis_smooth[4]; //adaptive smoothing
+static int16_t sim_curve_table[4][MK_CURVE_SIZE]; //response curves
+static bool sim_curve_set[4];
+#define SIM_POLL_US 10000 //MK_REFRESH_TIME
+
+
+static void sim_adc_setup(void){ //chips and axis mapping of mk_init: MCP3021 per axis, other chips shared with channel n for axis n, no chip if not built
+    int i;
+    sim_adcs[0].ops = NULL;
+    for(i = 0; i < 4; i++){
+        sim_adc_axes[i] = (struct mk_adc_axis){NULL, i, sim_axis_oversample[i], 0};
+        if(sim_adc_type == SIM_ADC_MCP3021){
+#ifdef CONFIG_MK_ADC_MCP3021
+            sim_adcs[i] = (struct mk_adc){&mk_adc_mcp3021_ops, &sim_clients[i], NULL};
+            sim_adc_axes[i] = (struct mk_adc_axis){&sim_adcs[i], 0, sim_axis_oversample[i], 0};
+#endif
+#ifdef CONFIG_MK_ADC_ADS1X15
+        }else if(sim_adc_type == SIM_ADC_ADS1015){sim_adcs[0] = (struct mk_adc){&mk_adc_ads1015_ops, &sim_clients[0], &sim_ads_priv};
+        }else if(sim_adc_type == SIM_ADC_ADS1115){sim_adcs[0] = (struct mk_adc){&mk_adc_ads1115_ops, &sim_clients[0], &sim_ads_priv};
+#endif
+#ifdef CONFIG_MK_ADC_ADS7830
+        }else if(sim_adc_type == SIM_ADC_ADS7830){sim_adcs[0] = (struct mk_adc){&mk_adc_ads7830_ops, &sim_clients[0], NULL};
+#endif
+#ifdef CONFIG_MK_ADC_SPI
+        }else if(sim_adc_type == SIM_ADC_MCP3008 || sim_adc_type == SIM_ADC_MCP3208){
+            sim_spi_type = sim_adc_type == SIM_ADC_MCP3208 ? MK_SPIADC_MCP3208 : MK_SPIADC_MCP3008;
+            sim_adcs[0] = (struct mk_adc){&sim_adc_mcp3x08_ops, NULL, NULL};
+#endif
+        }
+        if(sim_adc_type != SIM_ADC_MCP3021 && sim_adcs[0].ops){sim_adc_axes[i].adc = &sim_adcs[0];}
+        if(!sim_axis_enable[i]){sim_adc_axes[i].adc = NULL;}
+    }
+}
+
+
+
+static void sim_tick(void){ //mk_gpio_read_packet + mk_input_report
+    unsigned long pressed;
+    int16_t adc_values[4];
+    int i;
+
+    sim_event_count = 0;
+    sim_udelay_total = 0;
+    pressed = mk_levels_to_pressed(sim_gpio_maps, sim_gplev[0], sim_gplev[1]);
+    mk_buttons_decode(sim_gpio_maps, sim_hotkey_mode, &sim_hk, pressed, sim_data);
+    i = mk_combo_update(sim_combos, sim_combo_count, &sim_combo_st, sim_hk.action_btn, pressed, SIM_POLL_US);
+    if(i != sim_combo_key){ //hotkeys device
+        if(sim_combo_key >= 0){sim_emit(SIM_EV_ACTION, sim_combos[sim_combo_key].code, 0);}
+        if(i >= 0){sim_emit(SIM_EV_ACTION, sim_combos[i].code, 1);}
+        sim_combo_key = i;
+    }
+
+    sim_report_abs(sim_axis_enable[0] ? SIM_ABS_HAT0X : SIM_ABS_X, !sim_data[2] - !sim_data[3]);
+    sim_report_abs(sim_axis_enable[1] ? SIM_ABS_HAT0Y : SIM_ABS_Y, !sim_data[0] - !sim_data[1]);
+
+    sim_adc_setup();
+    for(i = 0; i < 4; i++){ //resolution kept per axis, mk_adc_axis_init and mk_hotpath_init
+        int shift = mk_adc_axis_shift(sim_adc_axes[i].adc);
+        if(!sim_axis_enable[i]){continue;}
+        sim_adc_axes[i].shift = sim_axis_filter[i].shift = sim_axis_smooth[i].shift = shift;
+        sim_abs_fuzz[sim_axis_abs[i]] = sim_axis_params[i].fuzz << shift; //input_set_abs_params
+    }
+    mk_adc_poll(sim_adc_axes, 4, adc_values);
+    for(i = 0; i < 4; i++){
+        int16_t adc_val = adc_values[i];
+        if(!sim_axis_enable[i]){continue;}
+        if(adc_val < 0){continue;} //i2c error, nothing reported
+        adc_val = mk_adc_filter(&sim_axis_filter[i], adc_val);
+        adc_val = mk_smooth(&sim_axis_smooth[i], adc_val, SIM_POLL_US);
+        adc_val = mk_analog_process(adc_val, sim_axis_reverse[i], &sim_axis_min[i], &sim_axis_max[i], &sim_axis_params[i], sim_axis_offset[i], sim_curve_set[i] ? sim_curve_table[i] : NULL, sim_adc_axes[i].shift);
+        sim_report_abs(sim_axis_abs[i], adc_val);
+    }
+
+    for(i = 4; i < MK_MAX_BUTTONS; i++){
+        if(sim_gpio_maps[i] != -1){sim_report_key(i - 4, sim_data[i]);}
+    }
+}
+
+
+static void sim_reset(void){
+    int i;
+    for(i = 0; i < MK_MAX_BUTTONS; i++){sim_gpio_maps[i] = -1; sim_data[i] = 0; sim_key_state[i] = 0;}
+    for(i = 0; i < SIM_ABS_MAX; i++){sim_abs_state[i] = 0; sim_abs_fuzz[i] = 0;}
+    for(i = 0; i < 4; i++){
+        sim_axis_enable[i] = false; sim_axis_reverse[i] = false; sim_axis_offset[i] = 2048;
+        sim_axis_min[i] = 0xFFFF; sim_axis_max[i] = 0; sim_ain[i] = 2048; sim_ain_seq_len[i] = 0;
+    }
+    sim_gplev[0] = sim_gplev[1] = 0xFFFFFFFF;
+    sim_hotkey_mode = HOTKEY_MODE_UNDEFINED;
+    sim_hk = (struct mk_hotkey){0xFF, 0, -1, 0, 0, -1, 0, -1};
+    sim_combo_count = 0; sim_combo_st = (struct mk_combo_state){0, -1, 0, -1}; sim_combo_key = -1;
+    sim_adc_type = SIM_ADC_MCP3021; sim_ads1015_mux = -1;
+    sim_ads1015_config = 0; sim_ads1015_thresh[0] = sim_ads1015_thresh[1] = 0;
+#ifdef CONFIG_MK_ADC_ADS1X15
+    memset(&sim_ads_priv, 0, sizeof(sim_ads_priv));
+#endif
+    memset(sim_axis_filter, 0, sizeof(sim_axis_filter)); memset(sim_axis_oversample, 0, sizeof(sim_axis_oversample));
+    memset(sim_axis_smooth, 0, sizeof(sim_axis_smooth)); memset(sim_curve_set, 0, sizeof(sim_curve_set));
+    sim_event_count = 0;
+}
+
+#endif
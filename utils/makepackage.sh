@@ -17,6 +17,7 @@ mkdir -p "$srcdir"
 cp dkms.conf "$srcdir"
 cp Makefile "$srcdir"
 cp mk_arcade_joystick_rpi.c "$srcdir"
+cp mk_arcade_joystick_rpi_core.h "$srcdir"
 
 mkdir -p "$sharedir"
 cp LICENSE "$sharedir"
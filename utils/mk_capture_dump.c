@@ -0,0 +1,110 @@
+/*
+ *  Arcade Joystick Driver for RaspberryPi, raw capture decoder
+ *
+ *  Converts a recording of /dev/mk_arcade_captureN to CSV, one line per poll:
+ *  time in msec since first sample, GPLEV0, GPLEV1 (or pressed bitmap with
+ *  the gpiolib backend) and raw 12bits value of x1,y1,x2,y2 (empty if unused).
+ *  With -r, converts such a CSV (edited or synthetic) back to a capture that
+ *  can be written to /dev/mk_arcade_injectN.
+ *
+ *  record : sudo timeout 60 cat /dev/mk_arcade_capture0 > pad0.bin
+ *  build  : gcc -o mk_capture_dump utils/mk_capture_dump.c
+ *  usage  : mk_capture_dump pad0.bin > pad0.csv
+ *           mk_capture_dump -r pad0.csv > pad0.bin
+ *  replay : sudo cp pad0.bin /dev/mk_arcade_inject0  (driver loaded with gpiobackend=2)
+ */
+
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define MK_CORE_NO_I2C
+#include "../mk_arcade_joystick_rpi_core.h"
+
+static int csv_to_capture(const char *path){ //CSV back to binary capture on stdout
+    struct mk_capture_header header = {MK_CAPTURE_MAGIC, MK_CAPTURE_VERSION, sizeof(struct mk_capture_sample), 0, 0, 100};
+    struct mk_capture_sample sample;
+    char line[256];
+    unsigned long count = 0, lineno = 0;
+    FILE *f = fopen(path, "r");
+
+    if(!f){perror(path); return 1;}
+    while(fgets(line, sizeof(line), f)){
+        char *p = line, *end;
+        double ms;
+        long v;
+        int i;
+
+        lineno++;
+        if(lineno == 1 && !strncmp(line, "time_ms,", 8)){ //column name tells the level format
+            if(!strncmp(line + 8, "pressed", 7)){header.flags |= MK_CAPTURE_FLAG_GPIOLIB;}
+            continue;
+        }
+        if(!count && fwrite(&header, sizeof(header), 1, stdout) != 1){return 1;}
+        ms = strtod(p, &end);
+        if(end == p || *end != ','){fprintf(stderr, "%s:%lu: bad line\n", path, lineno); return 1;}
+        sample.time_ns = (uint64_t)(ms * 1e6);
+        for(i = 0; i < 2; i++){
+            p = end + 1;
+            sample.level[i] = strtoul(p, &end, 0);
+            if(end == p || *end != ','){fprintf(stderr, "%s:%lu: bad line\n", path, lineno); return 1;}
+        }
+        for(i = 0; i < 4; i++){ //empty or missing column is an unused axis
+            p = end + (*end == ',');
+            sample.adc[i] = MK_CAPTURE_ADC_NONE;
+            v = strtol(p, &end, 0);
+            if(end != p){sample.adc[i] = v;}
+        }
+        if(fwrite(&sample, sizeof(sample), 1, stdout) != 1){return 1;}
+        count++;
+    }
+    fclose(f);
+    fprintf(stderr, "%lu samples\n", count);
+    return 0;
+}
+
+
+int main(int argc, char **argv){
+    struct mk_capture_header header;
+    struct mk_capture_sample sample;
+    uint64_t start = 0;
+    unsigned long count = 0;
+    FILE *f;
+    int i;
+
+    if(argc == 3 && !strcmp(argv[1], "-r")){return csv_to_capture(argv[2]);}
+    if(argc != 2){fprintf(stderr, "usage : %s capture.bin | -r capture.csv\n", argv[0]); return 2;}
+    f = fopen(argv[1], "rb");
+    if(!f){perror(argv[1]); return 1;}
+
+    if(fread(&header, sizeof(header), 1, f) != 1 || header.magic != MK_CAPTURE_MAGIC){fprintf(stderr, "%s: not a capture file\n", argv[1]); return 1;}
+    if(header.version != MK_CAPTURE_VERSION || header.sample_size != sizeof(sample)){fprintf(stderr, "%s: unsupported version %u\n", argv[1], header.version); return 1;}
+    fprintf(stderr, "pad%u, %u Hz polling, %s\n", header.pad, header.poll_hz, (header.flags & MK_CAPTURE_FLAG_GPIOLIB) ? "gpiolib pressed bitmap" : "GPLEV registers");
+
+    printf("time_ms,%s,level1,x1,y1,x2,y2\n", (header.flags & MK_CAPTURE_FLAG_GPIOLIB) ? "pressed" : "level0");
+    while(fread(&sample, sizeof(sample), 1, f) == 1){
+        if(!count++){start = sample.time_ns;}
+        printf("%.3f,0x%08" PRIX32 ",0x%08" PRIX32, (sample.time_ns - start) / 1e6, sample.level[0], sample.level[1]);
+        for(i = 0; i < 4; i++){
+            if(sample.adc[i] == MK_CAPTURE_ADC_NONE){printf(",");}else{printf(",%d", sample.adc[i]);}
+        }
+        printf("\n");
+    }
+    fclose(f);
+    fprintf(stderr, "%lu samples\n", count);
+    return 0;
+}
@@ -0,0 +1,193 @@
+/*
+ *  Arcade Joystick Driver for RaspberryPi, config blob generator
+ *
+ *  Builds the binary config blob loaded by the driver with fwconfig=1 from a
+ *  text description of up to 4 profiles, and checks and prints back an
+ *  existing blob. Every profile starts with the default key mapping, the
+ *  module calibration, linear curves, no turbo and no hotkey action:
+ *
+ *    # comment
+ *    profile <name>
+ *    key <BTN_* button> <BTN_* key>
+ *    axis <x1|y1|x2|y2> <min> <max> <fuzz> <flat>   same order as xNparams
+ *    curve <x1|y1|x2|y2> <33 points, 0..4096>
+ *    turbo <button> <Hz> [<duty %>]
+ *    combo <button> <key code> [<hold msec>]      (4096+n switches to profile n)
+ *
+ *  build   : gcc -o mk_config_tool utils/mk_config_tool.c
+ *  usage   : mk_config_tool profiles.txt > mk_arcade_joystick_rpi.bin
+ *            mk_config_tool -d mk_arcade_joystick_rpi.bin > profiles.txt
+ *  install : sudo cp mk_arcade_joystick_rpi.bin /lib/firmware/  (driver loaded with fwconfig=1)
+ */
+
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <linux/input-event-codes.h>
+
+#define MK_CORE_NO_I2C
+#include "../mk_arcade_joystick_rpi_core.h"
+
+// same order as mk_arcade_gpio_btn in the driver
+static const uint16_t btn_codes[] = {BTN_START, BTN_SELECT, BTN_A, BTN_B, BTN_TR, BTN_Y, BTN_X, BTN_TL, BTN_MODE, BTN_TL2, BTN_TR2, BTN_C, BTN_Z, BTN_TOP, BTN_TOP2, BTN_BASE, BTN_BASE2};
+static const char *btn_names[] = {"UP", "DOWN", "LEFT", "RIGHT", "BTN_START", "BTN_SELECT", "BTN_A", "BTN_B", "BTN_TR", "BTN_Y", "BTN_X", "BTN_TL", "BTN_MODE", "BTN_TL2", "BTN_TR2", "BTN_C", "BTN_Z", "BTN_TOP", "BTN_TOP2", "BTN_BASE", "BTN_BASE2"}; //data[] order
+static const char *axis_names[] = {"x1", "y1", "x2", "y2"};
+
+static int lookup(const char **names, int count, const char *name){ //index of name, -1 if unknown
+    int i;
+    for(i = 0; i < count; i++){if(name && !strcmp(name, names[i])){return i;}}
+    return -1;
+}
+
+
+static long number(const char *s, long min, long max, int *bad){ //decimal or hex field, bad set if missing or out of range
+    char *end;
+    long v;
+    if(!s){*bad = 1; return 0;}
+    v = strtol(s, &end, 0);
+    if(*end || end == s || v < min || v > max){*bad = 1;}
+    return v;
+}
+
+
+static int text_to_config(const char *path){ //text description to blob on stdout
+    static uint8_t blob[sizeof(struct mk_config_header) + MK_MAX_PROFILES * sizeof(struct mk_config_profile)];
+    struct mk_config_header *header = (struct mk_config_header *)blob;
+    struct mk_config_profile *profiles = (struct mk_config_profile *)(blob + sizeof(*header)), *prof = NULL;
+    char line[512];
+    unsigned long lineno = 0;
+    const char *err;
+    FILE *f = fopen(path, "r");
+
+    if(!f){perror(path); return 1;}
+    *header = (struct mk_config_header){MK_CONFIG_MAGIC, MK_CONFIG_VERSION, 0, 0, 0};
+    while(fgets(line, sizeof(line), f)){
+        char *cmd, *arg[40];
+        int i, j, n = 0, bad = 0;
+
+        lineno++;
+        if((cmd = strchr(line, '#'))){*cmd = 0;}
+        cmd = strtok(line, " \t\r\n");
+        if(!cmd){continue;}
+        while(n < 40 && (arg[n] = strtok(NULL, " \t\r\n"))){n++;}
+        for(i = n; i < 40; i++){arg[i] = NULL;}
+
+        if(!strcmp(cmd, "profile")){
+            if(header->profile_count == MK_MAX_PROFILES || !arg[0] || strlen(arg[0]) >= sizeof(prof->name)){bad = 1;
+            }else{
+                prof = &profiles[header->profile_count++];
+                strcpy(prof->name, arg[0]);
+                memcpy(prof->keys, btn_codes, sizeof(prof->keys));
+                for(i = 0; i < 4; i++){mk_curve_linear(prof->axis[i].curve);}
+            }
+        }else if(!prof){bad = 1;
+        }else if(!strcmp(cmd, "key")){
+            i = lookup(btn_names + 4, MK_MAX_BUTTONS - 4, arg[0]);
+            j = lookup(btn_names + 4, MK_MAX_BUTTONS - 4, arg[1]);
+            if(i < 0 || j < 0){bad = 1;}else{prof->keys[i] = btn_codes[j];}
+        }else if(!strcmp(cmd, "axis")){
+            struct mk_config_axis *axis = (i = lookup(axis_names, 4, arg[0])) < 0 ? NULL : &prof->axis[i];
+            if(!axis){bad = 1;
+            }else{
+                axis->min = number(arg[1], 0, 4095, &bad);
+                axis->max = number(arg[2], 1, 4095, &bad);
+                axis->fuzz = number(arg[3], 0, 4095, &bad);
+                axis->flat = number(arg[4], 0, 2047, &bad);
+            }
+        }else if(!strcmp(cmd, "curve")){
+            i = lookup(axis_names, 4, arg[0]);
+            if(i < 0 || n != MK_CURVE_POINTS + 1){bad = 1;
+            }else{
+                for(j = 0; j < MK_CURVE_POINTS; j++){prof->axis[i].curve[j] = number(arg[j + 1], 0, 4096, &bad);}
+            }
+        }else if(!strcmp(cmd, "turbo")){
+            i = lookup(btn_names, MK_MAX_BUTTONS, arg[0]);
+            if(i < 0){bad = 1;
+            }else{
+                prof->turbo_rate[i] = number(arg[1], 0, MK_TURBO_MAX_RATE, &bad);
+                prof->turbo_duty[i] = arg[2] ? number(arg[2], 1, 99, &bad) : 50;
+            }
+        }else if(!strcmp(cmd, "combo")){
+            i = lookup(btn_names, MK_MAX_BUTTONS, arg[0]);
+            if(i < 0 || prof->combo_count == MK_MAX_COMBOS){bad = 1;
+            }else{
+                struct mk_config_combo *combo = &prof->combos[prof->combo_count++];
+                combo->btn = i;
+                combo->code = number(arg[1], 1, MK_COMBO_PROFILE + MK_MAX_PROFILES - 1, &bad);
+                combo->hold_ms = arg[2] ? number(arg[2], 0, MK_COMBO_MAX_HOLD, &bad) : 0;
+            }
+        }else{bad = 1;}
+        if(bad){fprintf(stderr, "%s:%lu: bad line\n", path, lineno); fclose(f); return 1;}
+    }
+    fclose(f);
+    if(!header->profile_count){fprintf(stderr, "%s: no profile\n", path); return 1;}
+
+    header->size = sizeof(*header) + header->profile_count * sizeof(*profiles);
+    header->crc = mk_config_crc32(blob + sizeof(*header), header->size - sizeof(*header));
+    err = mk_config_check(blob, header->size);
+    if(err){fprintf(stderr, "%s: %s\n", path, err); return 1;}
+    if(fwrite(blob, header->size, 1, stdout) != 1){return 1;}
+    fprintf(stderr, "%u profiles, %" PRIu32 " bytes\n", header->profile_count, header->size);
+    return 0;
+}
+
+
+int main(int argc, char **argv){
+    static uint8_t blob[sizeof(struct mk_config_header) + MK_MAX_PROFILES * sizeof(struct mk_config_profile) + 1];
+    const struct mk_config_header *header = (const struct mk_config_header *)blob;
+    const struct mk_config_profile *profiles = (const struct mk_config_profile *)(blob + sizeof(*header));
+    uint16_t linear[MK_CURVE_POINTS];
+    const char *err;
+    size_t size;
+    FILE *f;
+    int i, j, k;
+
+    if(argc == 2 && argv[1][0] != '-'){return text_to_config(argv[1]);}
+    if(argc != 3 || strcmp(argv[1], "-d")){fprintf(stderr, "usage : %s profiles.txt | -d config.bin\n", argv[0]); return 2;}
+    f = fopen(argv[2], "rb");
+    if(!f){perror(argv[2]); return 1;}
+    size = fread(blob, 1, sizeof(blob), f);
+    fclose(f);
+    err = mk_config_check(blob, size);
+    if(err){fprintf(stderr, "%s: %s\n", argv[2], err); return 1;}
+
+    mk_curve_linear(linear);
+    for(i = 0; i < header->profile_count; i++){ //defaults are not printed
+        const struct mk_config_profile *prof = &profiles[i];
+        printf("profile %s\n", prof->name);
+        for(j = 0; j < MK_MAX_BUTTONS - 4; j++){
+            if(prof->keys[j] == btn_codes[j]){continue;}
+            for(k = 0; k < MK_MAX_BUTTONS - 4 && btn_codes[k] != prof->keys[j]; k++){}
+            if(k < MK_MAX_BUTTONS - 4){printf("key %s %s\n", btn_names[j + 4], btn_names[k + 4]);}else{printf("# key %s code %u\n", btn_names[j + 4], prof->keys[j]);}
+        }
+        for(j = 0; j < 4; j++){
+            const struct mk_config_axis *axis = &prof->axis[j];
+            if(axis->max){printf("axis %s %u %u %u %u\n", axis_names[j], axis->min, axis->max, axis->fuzz, axis->flat);}
+            if(memcmp(axis->curve, linear, sizeof(linear))){
+                printf("curve %s", axis_names[j]);
+                for(k = 0; k < MK_CURVE_POINTS; k++){printf(" %u", axis->curve[k]);}
+                printf("\n");
+            }
+        }
+        for(j = 0; j < MK_MAX_BUTTONS; j++){
+            if(prof->turbo_rate[j]){printf("turbo %s %u %u\n", btn_names[j], prof->turbo_rate[j], prof->turbo_duty[j]);}
+        }
+        for(j = 0; j < prof->combo_count; j++){printf("combo %s %u %u\n", btn_names[prof->combos[j].btn], prof->combos[j].code, prof->combos[j].hold_ms);}
+    }
+    fprintf(stderr, "%u profiles, %zu bytes, valid\n", header->profile_count, size);
+    return 0;
+}